@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include <omp.h>
+#include "../common/matrix_view.h"
+#include "../common/verify.h"
+#include "../common/matrix_rng.h"
+#include "../common/arena.h"
+#include "matrix_summa.h"
+
+/*****************************************************
+the following function generates the rows x cols block
+at (row0, col0) of a "size x size" matrix from its
+stream of the counter-based generator (see
+matrix_rng.h), so the blocks of all the ranks put
+together are the matrix of the other drivers
+ ****************************************************/
+void matrix_gen_block(int size, double *block, int row0, int rows, int col0, int cols, int stream){
+  uint64_t key = matrix_rng_key(matrix_seed(), stream);
+  int i;
+
+# pragma omp parallel for schedule(static)
+  for(i=0; i<rows; i++){
+    uint64_t first = (uint64_t)(row0 + i)*size + col0;
+    int j;
+#   pragma omp simd
+    for(j=0; j<cols; j++)
+      block[(size_t)i*cols + j] = rng_uniform(rng_counter(key, first + j));
+  }
+}
+
+
+/*****************************************************
+ Per-rank times, gathered on rank 0 and printed one
+ line per rank, then the overall rate of the slowest
+ ****************************************************/
+void summa_report(const summa_grid *grid, const summa_layout *l, const summa_stats *stats, int panel){
+  double mine[7] = { l->rows, l->cols, stats->compute, stats->comm, stats->wait, stats->total, stats->bytes_received };
+  double *all = NULL;
+  double slowest = 0, flops = 2.0*l->size*(double)l->size*l->size;
+  int r;
+
+  if(grid->rank == 0)
+    all = (double *)malloc(sizeof(mine)*grid->ranks);
+  MPI_Gather(mine, 7, MPI_DOUBLE, all, 7, MPI_DOUBLE, 0, grid->grid);
+  if(grid->rank != 0)
+    return;
+
+  printf("SUMMA ON A %dx%d GRID OF %d RANKS WITH %d (threads) EACH, %d PANELS OF UP TO %d\n",
+	 grid->rows, grid->cols, grid->ranks, omp_get_max_threads(), stats->panels, panel);
+  for(r=0; r<grid->ranks; r++){
+    const double *t = all + 7*r;
+    int coords[2];
+    MPI_Cart_coords(grid->grid, r, 2, coords);
+    printf("  rank %d (%d,%d), C block %dx%d: compute %f (sec) %.2f GFLOP/s, communication %f (sec) of which waiting %f (sec), %.1f MB received\n",
+	   r, coords[0], coords[1], (int)t[0], (int)t[1], t[2],
+	   (t[2] > 0) ? 2.0*t[0]*t[1]*l->size/t[2]*1e-9 : 0.0, t[3], t[4], t[6]/1048576.0);
+    if(t[5] > slowest)
+      slowest = t[5];
+  }
+  printf("DISTRIBUTED EXECUTION: %f (sec), %.2f GFLOP/s\n", slowest, flops/slowest*1e-9);
+  free(all);
+}
+
+
+/*****************************************************
+ Brings every block of C to rank 0, into c_full, each
+ received in place through a strided type
+ ****************************************************/
+void summa_gather(const summa_grid *grid, const summa_layout *mine, const double *c, double *c_full){
+  int r, i;
+
+  if(grid->rank != 0){
+    MPI_Send(c, mine->rows*mine->cols, MPI_DOUBLE, 0, 0, grid->grid);
+    return;
+  }
+  for(i=0; i<mine->rows; i++)
+    memcpy(c_full + (size_t)(mine->row0 + i)*mine->size + mine->col0, c + (size_t)i*mine->cols,
+	   sizeof(double)*mine->cols);
+  for(r=1; r<grid->ranks; r++){
+    summa_layout l;
+    MPI_Datatype block;
+    summa_layout_init(&l, grid, r, mine->size);
+    MPI_Type_vector(l.rows, l.cols, l.size, MPI_DOUBLE, &block);
+    MPI_Type_commit(&block);
+    MPI_Recv(c_full + (size_t)l.row0*l.size + l.col0, 1, block, r, 0, grid->grid, MPI_STATUS_IGNORE);
+    MPI_Type_free(&block);
+  }
+}
+
+
+/*****************************************************
+ Checks the gathered result on rank 0, against the
+ sequential multiply or with Freivalds (MATRIX_VERIFY),
+ and shares the outcome with every rank
+ ****************************************************/
+int summa_verify(const summa_grid *grid, const summa_layout *l, const double *c){
+  int size = l->size, ok = 1;
+
+  if(grid->rank == 0){
+    int method = verify_method(size);
+    arena matrices;
+    if(!arena_init(&matrices, 4*arena_matrix_bytes(size, size, ARENA_ALIGN))){
+      printf("can't allocate the matrices of the check on rank 0\n");
+      ok = 0;
+    }else{
+      double *a = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+      double *b = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+      double *c_full = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+      double *reference = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+      matrix_random(a, size, size, size, matrix_seed(), MATRIX_STREAM_A);
+      matrix_random(b, size, size, size, matrix_seed(), MATRIX_STREAM_B);
+      summa_gather(grid, l, c, c_full);
+      if(method == VERIFY_FULL){
+        gemm_view g;
+        gemm_view_square(&g, size, a, b, reference);
+        matrix_gemm_ref(&g);
+      }
+      ok = verify_square(method, size, a, b, reference, c_full, "SUMMA");
+      arena_release(&matrices);
+    }
+  }else{
+    summa_gather(grid, l, c, NULL);
+  }
+  MPI_Bcast(&ok, 1, MPI_INT, 0, grid->grid);
+  return ok;
+}
+
+
+/****************************************************
+ main
+ ***************************************************/
+int main(int argc, char *argv[]){
+  summa_grid grid;
+  summa_layout l;
+  summa_stats stats;
+  int provided, size, panel, ok;
+
+  // Only the main thread of a rank calls MPI, the OpenMP threads stay inside the kernel
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  summa_grid_init(&grid, MPI_COMM_WORLD);
+
+  size = (argc > 1) ? atoi(argv[1]) : 0;
+  if(size < grid.rows || size < grid.cols){
+    if(grid.rank == 0){
+      if(argc < 2)
+        printf("Usage: mpirun -np ranks %s matrix_size\n", argv[0]);
+      else
+        printf("incorrect arguments, the size should be at least the %dx%d of the grid\n", grid.rows, grid.cols);
+    }
+    summa_grid_release(&grid);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+  panel = summa_panel_width();
+  summa_layout_init(&l, &grid, grid.rank, size);
+
+  // The local blocks of A, B and C and the panels being received, all in one arena
+  arena matrices;
+  if(!arena_init(&matrices, 3*arena_matrix_bytes(l.rows, l.cols, ARENA_ALIGN)
+		 + arena_matrix_bytes(summa_workspace(&l, panel), 1, ARENA_ALIGN))){
+    printf("can't allocate the required memory for the blocks of rank %d\n", grid.rank);
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  double *a = arena_matrix(&matrices, l.rows, l.a_k, ARENA_ALIGN);
+  double *b = arena_matrix(&matrices, l.b_k, l.cols, ARENA_ALIGN);
+  double *c = arena_matrix(&matrices, l.rows, l.cols, ARENA_ALIGN);
+  double *workspace = arena_matrix(&matrices, summa_workspace(&l, panel), 1, ARENA_ALIGN);
+
+  matrix_gen_block(size, a, l.row0, l.rows, l.a_k0, l.a_k, MATRIX_STREAM_A);
+  matrix_gen_block(size, b, l.b_k0, l.b_k, l.col0, l.cols, MATRIX_STREAM_B);
+
+  MPI_Barrier(grid.grid);
+  matrix_gemm_summa(&grid, &l, a, b, c, workspace, panel, &stats);
+
+  summa_report(&grid, &l, &stats, panel);
+
+  //check, the whole matrix against the sequential result or the Freivalds check, see MATRIX_VERIFY
+  ok = summa_verify(&grid, &l, c);
+  if(!ok && grid.rank == 0)
+    printf("wrong result of the distributed multiply\n");
+
+  arena_release(&matrices);
+  summa_grid_release(&grid);
+  MPI_Finalize();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "../common/matrix_view.h"
+#include "../OpenMP/matrix_blocked.h"
+#include "matrix_summa.h"
+
+/*** TYPEDEFS AND STRUCTS***/
+// One step of the multiply: the panel of the inner dimension [k0, k0+width), owned by grid column
+// a_owner in A and grid row b_owner in B, and the broadcasts bringing it in
+typedef struct {
+  int k0, width;
+  int a_owner, b_owner;
+  const double *a; int lda;
+  const double *b;
+  MPI_Request requests[2];
+} summa_step;
+
+
+/*****************************************************
+ Panel width from MATRIX_MPI_PANEL, or the default
+ ****************************************************/
+int summa_panel_width(void){
+  const char *value = getenv("MATRIX_MPI_PANEL");
+  int panel = (value != NULL) ? atoi(value) : 0;
+  return (panel > 0) ? panel : SUMMA_PANEL;
+}
+
+/*****************************************************
+ First index of part out of parts of n, the parts
+ differing by one element at most
+ ****************************************************/
+int summa_block_start(int part, int n, int parts){
+  return (int)((long)part*n / parts);
+}
+
+static int block_owner(int index, int n, int parts){
+  int part = 0;
+  while(summa_block_start(part+1, n, parts) <= index)
+    part++;
+  return part;
+}
+
+
+/*****************************************************
+ Lays the ranks of comm out on a non-periodic 2D grid
+ and splits it into row and column communicators
+ ****************************************************/
+void summa_grid_init(summa_grid *grid, MPI_Comm comm){
+  int dims[2] = {0, 0}, periods[2] = {0, 0}, coords[2];
+  int keep_cols[2] = {0, 1}, keep_rows[2] = {1, 0};
+
+  MPI_Comm_size(comm, &grid->ranks);
+  MPI_Dims_create(grid->ranks, 2, dims);
+  MPI_Cart_create(comm, 2, dims, periods, 0, &grid->grid);
+  MPI_Comm_rank(grid->grid, &grid->rank);
+  MPI_Cart_coords(grid->grid, grid->rank, 2, coords);
+  grid->rows = dims[0];
+  grid->cols = dims[1];
+  grid->my_row = coords[0];
+  grid->my_col = coords[1];
+  MPI_Cart_sub(grid->grid, keep_cols, &grid->row);
+  MPI_Cart_sub(grid->grid, keep_rows, &grid->col);
+}
+
+void summa_grid_release(summa_grid *grid){
+  MPI_Comm_free(&grid->row);
+  MPI_Comm_free(&grid->col);
+  MPI_Comm_free(&grid->grid);
+}
+
+
+/*****************************************************
+ Blocks owned by rank of the grid in a size x size
+ multiply
+ ****************************************************/
+void summa_layout_init(summa_layout *l, const summa_grid *grid, int rank, int size){
+  int coords[2];
+
+  MPI_Cart_coords(grid->grid, rank, 2, coords);
+  l->size = size;
+  l->row0 = summa_block_start(coords[0], size, grid->rows);
+  l->rows = summa_block_start(coords[0]+1, size, grid->rows) - l->row0;
+  l->col0 = summa_block_start(coords[1], size, grid->cols);
+  l->cols = summa_block_start(coords[1]+1, size, grid->cols) - l->col0;
+  // The inner dimension follows the grid columns in A and the grid rows in B
+  l->a_k0 = l->col0;
+  l->a_k = l->cols;
+  l->b_k0 = l->row0;
+  l->b_k = l->rows;
+}
+
+/*****************************************************
+ Doubles of workspace matrix_gemm_summa needs: two
+ panels of A and two of B, one being received while
+ the other is multiplied
+ ****************************************************/
+size_t summa_workspace(const summa_layout *l, int panel){
+  return 2*(size_t)panel*(l->rows + l->cols);
+}
+
+
+/*****************************************************
+ Starts the broadcasts of the step at k0: the owner of
+ the A panel sends it, in place through a strided
+ type, to its grid row, the owner of the B panel (rows
+ of B, contiguous) to its grid column. The others
+ receive them in their half of the workspace
+ ****************************************************/
+static void step_post(const summa_grid *grid, const summa_layout *l, const double *a,
+		      const double *b, double *a_panel, double *b_panel, int k0, int panel,
+		      summa_step *step, summa_stats *stats){
+  int size = l->size;
+  int end;
+
+  step->k0 = k0;
+  step->a_owner = block_owner(k0, size, grid->cols);
+  step->b_owner = block_owner(k0, size, grid->rows);
+  // A panel never straddles two owners, in A nor in B
+  end = k0 + panel;
+  if(end > summa_block_start(step->a_owner+1, size, grid->cols))
+    end = summa_block_start(step->a_owner+1, size, grid->cols);
+  if(end > summa_block_start(step->b_owner+1, size, grid->rows))
+    end = summa_block_start(step->b_owner+1, size, grid->rows);
+  step->width = end - k0;
+
+  if(grid->my_col == step->a_owner){
+    MPI_Datatype columns;
+    MPI_Type_vector(l->rows, step->width, l->a_k, MPI_DOUBLE, &columns);
+    MPI_Type_commit(&columns);
+    step->a = a + (k0 - l->a_k0);
+    step->lda = l->a_k;
+    MPI_Ibcast((void *)step->a, 1, columns, step->a_owner, grid->row, &step->requests[0]);
+    // Freed once the broadcast completes
+    MPI_Type_free(&columns);
+  }else{
+    step->a = a_panel;
+    step->lda = step->width;
+    MPI_Ibcast(a_panel, l->rows*step->width, MPI_DOUBLE, step->a_owner, grid->row, &step->requests[0]);
+    stats->bytes_received += sizeof(double)*(double)l->rows*step->width;
+  }
+
+  if(grid->my_row == step->b_owner){
+    step->b = b + (size_t)(k0 - l->b_k0)*l->cols;
+    MPI_Ibcast((void *)step->b, step->width*l->cols, MPI_DOUBLE, step->b_owner, grid->col, &step->requests[1]);
+  }else{
+    step->b = b_panel;
+    MPI_Ibcast(b_panel, step->width*l->cols, MPI_DOUBLE, step->b_owner, grid->col, &step->requests[1]);
+    stats->bytes_received += sizeof(double)*(double)step->width*l->cols;
+  }
+}
+
+
+/*****************************************************
+ SUMMA: C = A*B over the grid, with the blocks of
+ summa_layout on every rank. Step by step a panel of
+ the inner dimension is broadcast along the grid rows
+ (A) and columns (B) and every rank adds its product
+ into its block of C with the blocked OpenMP kernel.
+ The broadcasts of the next step are posted before
+ the kernel runs, double buffered, so they travel
+ while it computes
+ ****************************************************/
+void matrix_gemm_summa(const summa_grid *grid, const summa_layout *l, const double *a,
+		       const double *b, double *c, double *workspace, int panel,
+		       summa_stats *stats){
+  double *a_panels[2] = { workspace, workspace + (size_t)panel*l->rows };
+  double *b_panels[2] = { workspace + 2*(size_t)panel*l->rows,
+                          workspace + 2*(size_t)panel*l->rows + (size_t)panel*l->cols };
+  summa_step steps[2];
+  double start, time;
+  int s, chunk;
+
+  memset(stats, 0, sizeof(*stats));
+  start = MPI_Wtime();
+  step_post(grid, l, a, b, a_panels[0], b_panels[0], 0, panel, &steps[0], stats);
+  stats->comm += MPI_Wtime() - start;
+
+  for(s=0; ; s++){
+    summa_step *current = &steps[s % 2], *next = &steps[(s+1) % 2];
+    int next_k0 = current->k0 + current->width;
+    gemm_view g = { l->rows, l->cols, current->width, 1.0, (s == 0) ? 0.0 : 1.0,
+                    current->a, current->lda, MV_NOTRANS,
+                    current->b, l->cols, MV_NOTRANS,
+                    c, l->cols };
+
+    time = MPI_Wtime();
+    MPI_Waitall(2, current->requests, MPI_STATUSES_IGNORE);
+    stats->wait += MPI_Wtime() - time;
+    if(next_k0 < l->size)
+      step_post(grid, l, a, b, a_panels[(s+1) % 2], b_panels[(s+1) % 2], next_k0, panel, next, stats);
+    stats->comm += MPI_Wtime() - time;
+
+    for(chunk=0; chunk<SUMMA_PROGRESS_CHUNKS; chunk++){
+      int row_begin = summa_block_start(chunk, l->rows, SUMMA_PROGRESS_CHUNKS);
+      int row_end = summa_block_start(chunk+1, l->rows, SUMMA_PROGRESS_CHUNKS);
+      gemm_view rows;
+
+      time = MPI_Wtime();
+      if(row_end > row_begin && l->cols > 0){
+        gemm_view_block(&g, row_begin, 0, 0, row_end - row_begin, l->cols, g.k, &rows);
+        matrix_gemm_blk(&rows);
+      }
+      stats->compute += MPI_Wtime() - time;
+
+      // Without a progress thread the broadcasts only advance inside MPI calls
+      if(next_k0 < l->size){
+        int done;
+        time = MPI_Wtime();
+        MPI_Testall(2, next->requests, &done, MPI_STATUSES_IGNORE);
+        stats->comm += MPI_Wtime() - time;
+      }
+    }
+    stats->panels++;
+    if(next_k0 >= l->size)
+      break;
+  }
+  stats->total = MPI_Wtime() - start;
+}
@@ -0,0 +1,56 @@
+#ifndef MATRIX_SUMMA_H_
+#define MATRIX_SUMMA_H_
+
+#include <stddef.h>
+#include <mpi.h>
+
+// Width of the panels of A and B broadcast at every step, MATRIX_MPI_PANEL overrides it
+#define SUMMA_PANEL 256
+
+// Pieces the local update of a step is cut in, with a test of the next broadcasts between two
+// of them, so MPI moves them along while the kernel runs
+#define SUMMA_PROGRESS_CHUNKS 4
+
+/*** TYPEDEFS AND STRUCTS***/
+// 2D grid of the ranks, rows x cols as balanced as MPI_Dims_create makes it. row is the
+// communicator of the ranks of my grid row (ranked by grid column), col the one of my grid column
+typedef struct {
+  MPI_Comm grid, row, col;
+  int rank, ranks;
+  int rows, cols;
+  int my_row, my_col;
+} summa_grid;
+
+// Blocks of a size x size multiply owned by one rank. A and C are split by rows over the grid rows,
+// B and C by columns over the grid columns; the inner dimension is split over the grid columns in
+// A and over the grid rows in B
+typedef struct {
+  int size;
+  int row0, rows;
+  int col0, cols;
+  int a_k0, a_k;
+  int b_k0, b_k;
+} summa_layout;
+
+// Time (sec) of one rank: in the kernel, in all the MPI calls of the broadcasts, and the part of
+// those spent blocked waiting for a panel, the communication left exposed
+typedef struct {
+  double compute;
+  double comm;
+  double wait;
+  double total;
+  double bytes_received;
+  int panels;
+} summa_stats;
+
+int summa_panel_width(void);
+int summa_block_start(int part, int n, int parts);
+void summa_grid_init(summa_grid *grid, MPI_Comm comm);
+void summa_grid_release(summa_grid *grid);
+void summa_layout_init(summa_layout *l, const summa_grid *grid, int rank, int size);
+size_t summa_workspace(const summa_layout *l, int panel);
+void matrix_gemm_summa(const summa_grid *grid, const summa_layout *l, const double *a,
+		       const double *b, double *c, double *workspace, int panel,
+		       summa_stats *stats);
+
+#endif /* MATRIX_SUMMA_H_ */
@@ -0,0 +1,18 @@
+#!/bin/sh
+
+rank_num=$1
+thread_num=$2
+matrix_size=$3
+
+echo "compile application"
+
+mpicc -g -O3 -fopenmp matrix_mpi.c matrix_summa.c ../OpenMP/matrix_blocked.c ../common/matrix_view.c ../common/verify.c ../common/matrix_rng.c ../common/arena.c -o matrix_mpi.exe -lm
+
+echo "setting up number of threads value"
+export OMP_NUM_THREADS=$thread_num
+
+# Ranks are processes of this host unless a hostfile says otherwise, --oversubscribe lets a small box run a larger grid
+echo "executing the application"
+mpirun --oversubscribe -np $rank_num ./matrix_mpi.exe $matrix_size
+
+rm -fr *~ matrix_mpi.exe
@@ -1,26 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <malloc.h>
+#include <string.h>
 #include <xmmintrin.h>
+#include <immintrin.h>
 #include <time.h>
 #include <omp.h>
+#include "../common/matrix_view.h"
+#include "../common/bench.h"
+#include "../common/perf_counters.h"
+#include "../common/verify.h"
+#include "../common/matrix_rng.h"
+#include "../common/arena.h"
+#include "../common/precision.h"
+#include "../common/matrix_io.h"
 
 /*****************************************************
 the following function generates a "size"-element vector
-and a "size x size" matrix
+and a "size x size" matrix from its stream of the
+counter-based generator (see matrix_rng.h), in parallel
+and identical for any thread count
  ****************************************************/
-void matrix_gen(int size, int adsize, double *matrix){
-  int i;
-    
-  // Loop that fills the matrix structure.
-  // Verifies if the matrix size is a multiple of 2. If it is not, it will fill the padding columns and columns with zeros, in order not to influence the calculation results
-  for(i=0; i<adsize*adsize; i++){
-    // size!=adsize verifies if entry is padding
-    // At most 1 columns will have to be filled with zeros, in accordance with the remainder of the division between adsize and two.
-    // All rows which satisfy i>size*adsize-1 are serving as pading (filled w/zeros)
-    if( size!=adsize && (((i+1)%adsize==0 &&(adsize-size >0)) || i>(size*adsize-1)) ) matrix[i] = 0;
-    else matrix[i] = i*1.3f + 1;//((float)rand())/5307.0f;
-  }
+void matrix_gen(int size, double *matrix, int stream){
+  // No padding is needed anymore, the SIMD kernels handle any size
+  matrix_random(matrix, size, size, size, matrix_seed(), stream);
 }
 
 
@@ -30,17 +32,10 @@ void matrix_gen(int size, int adsize, double *matrix){
  ***************************************************/
 void matrix_mult_sq(int size, double *matrix1_in,
 		       double *matrix2_in, double *matrix_out){
-  int rows, cols;
-  int j;
-
-  // For cycle added to implement a sequential, matrix by matrix, multiplication that repeats the code given for the vector by matrix multipication for every row of the first operand's matrix
-  for(rows=0; rows<size; rows++){
-    for(cols=0; cols<size; cols++){
-      matrix_out[rows*size + cols] = 0.0;
-      for(j=0; j<size; j++)
-        matrix_out[rows*size + cols] += matrix1_in[ rows*size + j] * matrix2_in[j*size + cols];
-    }
-  }
+  gemm_view g;
+
+  gemm_view_square(&g, size, matrix1_in, matrix2_in, matrix_out);
+  matrix_gemm_ref(&g);
 }
 
 
@@ -48,150 +43,788 @@ void matrix_mult_sq(int size, double *matrix1_in,
 /****************************************************
  
  ***************************************************/
-void matrix_mult_sse(int size, double *matrix1_in,
-		      double *matrix2_in, double *matrix_out){
+void matrix_gemm_sse(const gemm_view *g){
   __m128d a_line, b_line, r_line;
+  __m128d alpha = _mm_set1_pd(g->alpha), beta = _mm_set1_pd(g->beta);
+  int a_rs, a_cs, b_rs, b_cs;
   int i, j, jj;
 
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+
 // OpenMP is used to exploit thread-level parallelism in this function. To that effect, a loop work-sharing construct compiler directive was added to split the for loop iterations among the threads in a team, effectively assigning one thread to each of the vector by matrix multiplication problems we can split the application in. Furthermore the correct directives were given to specify the global and private variables of the implementation
 # pragma omp parallel \
-    shared(jj, matrix1_in, matrix2_in, matrix_out, size) \
+    shared(jj, g, alpha, beta, a_rs, a_cs, b_rs) \
     private(i , j, b_line, a_line, r_line)
 # pragma omp for
-    for(jj=0; jj<size; jj++){
+    for(jj=0; jj<g->m; jj++){
+        const double *a_row = &g->a[(long)jj*a_rs];
+        double *c_row = &g->c[(long)jj*g->ldc];
+        // The vector loads need the rows of op(B) to be contiguous, a transposed B is multiplied with the scalar reference instead
+        if(g->trans_b){
+            matrix_gemm_rows(g, jj, jj+1);
+            continue;
+        }
         // Incrementing clause was halved since the data type size doubled and now only two double floating point data types are loaded with each mm_load_pd operation
-        for (i=0; i<size; i+=2){
-            j = 0;
+        // Rows start at multiples of ldb/ldc, which need not be even, so unaligned loads are used
+        for (i=0; i+2<=g->n; i+=2){
+            r_line = _mm_setzero_pd();
             // _mm_load_ps, _mm_set1_ps and _mm_mul_ps changed to load two double floating point data types
-            b_line = _mm_load_pd(&matrix2_in[i]); // b_line = vec4(matrix[i][0])
-            a_line = _mm_set1_pd(matrix1_in[j+(jj*size)]);      // a_line = vec4(vector_in[0])
-            r_line = _mm_mul_pd(a_line, b_line); // r_line = a_line * b_line
-            for (j=1; j<size; j++) {
-                b_line = _mm_load_pd(&matrix2_in[j*size +i]); // a_line = vec4(column(a, j))
-                a_line = _mm_set1_pd(matrix1_in[j+(jj*size)]);  // b_line = vec4(b[i][j])
+            for (j=0; j<g->k; j++) {
+                b_line = _mm_loadu_pd(&g->b[(long)j*b_rs + i]); // b_line = vec4(column(b, j))
+                a_line = _mm_set1_pd(a_row[(long)j*a_cs]);  // a_line = vec4(a[jj][j])
                 // r_line += a_line * b_line
                 r_line = _mm_add_pd(_mm_mul_pd(a_line, b_line), r_line);
             }
-            _mm_store_pd(&matrix_out[jj*size + i], r_line);     // r[i] = r_line
+            r_line = _mm_mul_pd(alpha, r_line);
+            if(g->beta != 0.0)
+                r_line = _mm_add_pd(r_line, _mm_mul_pd(beta, _mm_loadu_pd(&c_row[i])));
+            _mm_storeu_pd(&c_row[i], r_line);     // r[i] = r_line
+        }
+        // Odd sizes leave a single column, computed with a scalar tail instead of padding the matrices
+        if (i<g->n){
+            double r = 0.0;
+            for (j=0; j<g->k; j++)
+                r += a_row[(long)j*a_cs] * g->b[(long)j*b_rs + i];
+            c_row[i] = (g->beta == 0.0) ? g->alpha*r : g->alpha*r + g->beta*c_row[i];
+        }
+    }
+}
+
+
+
+/****************************************************
+ Same row split as matrix_gemm_sse, but with 256-bit
+ vectors and fused multiply-adds. Four independent
+ accumulators are kept per pass to hide the FMA latency
+ ***************************************************/
+__attribute__((target("avx2,fma")))
+void matrix_gemm_avx2(const gemm_view *g){
+  int a_rs, a_cs, b_rs, b_cs;
+  int i, j, jj;
+
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+
+# pragma omp parallel \
+    shared(g, a_rs, a_cs, b_rs) \
+    private(i, j)
+# pragma omp for
+    for(jj=0; jj<g->m; jj++){
+        const double *a_row = &g->a[(long)jj*a_rs];
+        double *c_row = &g->c[(long)jj*g->ldc];
+        __m256d alpha = _mm256_set1_pd(g->alpha), beta = _mm256_set1_pd(g->beta);
+        if(g->trans_b){
+            matrix_gemm_rows(g, jj, jj+1);
+            continue;
+        }
+        // 16 columns of the result row at a time, in four registers
+        for (i=0; i+16<=g->n; i+=16){
+            __m256d r0 = _mm256_setzero_pd(), r1 = _mm256_setzero_pd();
+            __m256d r2 = _mm256_setzero_pd(), r3 = _mm256_setzero_pd();
+            for (j=0; j<g->k; j++) {
+                __m256d a_line = _mm256_set1_pd(a_row[(long)j*a_cs]);
+                const double *b_row = &g->b[(long)j*b_rs + i];
+                r0 = _mm256_fmadd_pd(a_line, _mm256_loadu_pd(b_row), r0);
+                r1 = _mm256_fmadd_pd(a_line, _mm256_loadu_pd(b_row+4), r1);
+                r2 = _mm256_fmadd_pd(a_line, _mm256_loadu_pd(b_row+8), r2);
+                r3 = _mm256_fmadd_pd(a_line, _mm256_loadu_pd(b_row+12), r3);
+            }
+            r0 = _mm256_mul_pd(alpha, r0); r1 = _mm256_mul_pd(alpha, r1);
+            r2 = _mm256_mul_pd(alpha, r2); r3 = _mm256_mul_pd(alpha, r3);
+            if(g->beta != 0.0){
+                r0 = _mm256_fmadd_pd(beta, _mm256_loadu_pd(&c_row[i]), r0);
+                r1 = _mm256_fmadd_pd(beta, _mm256_loadu_pd(&c_row[i+4]), r1);
+                r2 = _mm256_fmadd_pd(beta, _mm256_loadu_pd(&c_row[i+8]), r2);
+                r3 = _mm256_fmadd_pd(beta, _mm256_loadu_pd(&c_row[i+12]), r3);
+            }
+            _mm256_storeu_pd(&c_row[i], r0);
+            _mm256_storeu_pd(&c_row[i+4], r1);
+            _mm256_storeu_pd(&c_row[i+8], r2);
+            _mm256_storeu_pd(&c_row[i+12], r3);
+        }
+        // Remaining columns, 4 at a time, the last 1 to 3 of them through a masked load/store
+        for (; i<g->n; i+=4){
+            __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(g->n - i),
+                                              _mm256_setr_epi64x(0, 1, 2, 3));
+            __m256d r_line = _mm256_setzero_pd();
+            for (j=0; j<g->k; j++)
+                r_line = _mm256_fmadd_pd(_mm256_set1_pd(a_row[(long)j*a_cs]),
+                                         _mm256_maskload_pd(&g->b[(long)j*b_rs + i], mask), r_line);
+            r_line = _mm256_mul_pd(alpha, r_line);
+            if(g->beta != 0.0)
+                r_line = _mm256_fmadd_pd(beta, _mm256_maskload_pd(&c_row[i], mask), r_line);
+            _mm256_maskstore_pd(&c_row[i], mask, r_line);
+        }
+    }
+}
+
+
+
+/****************************************************
+ 512-bit version of matrix_gemm_avx2. The last partial
+ vector of a row is handled with a masked load/store
+ ***************************************************/
+__attribute__((target("avx512f")))
+void matrix_gemm_avx512(const gemm_view *g){
+  int a_rs, a_cs, b_rs, b_cs;
+  int i, j, jj;
+
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+
+# pragma omp parallel \
+    shared(g, a_rs, a_cs, b_rs) \
+    private(i, j)
+# pragma omp for
+    for(jj=0; jj<g->m; jj++){
+        const double *a_row = &g->a[(long)jj*a_rs];
+        double *c_row = &g->c[(long)jj*g->ldc];
+        __m512d alpha = _mm512_set1_pd(g->alpha), beta = _mm512_set1_pd(g->beta);
+        if(g->trans_b){
+            matrix_gemm_rows(g, jj, jj+1);
+            continue;
+        }
+        // 32 columns of the result row at a time, in four registers
+        for (i=0; i+32<=g->n; i+=32){
+            __m512d r0 = _mm512_setzero_pd(), r1 = _mm512_setzero_pd();
+            __m512d r2 = _mm512_setzero_pd(), r3 = _mm512_setzero_pd();
+            for (j=0; j<g->k; j++) {
+                __m512d a_line = _mm512_set1_pd(a_row[(long)j*a_cs]);
+                const double *b_row = &g->b[(long)j*b_rs + i];
+                r0 = _mm512_fmadd_pd(a_line, _mm512_loadu_pd(b_row), r0);
+                r1 = _mm512_fmadd_pd(a_line, _mm512_loadu_pd(b_row+8), r1);
+                r2 = _mm512_fmadd_pd(a_line, _mm512_loadu_pd(b_row+16), r2);
+                r3 = _mm512_fmadd_pd(a_line, _mm512_loadu_pd(b_row+24), r3);
+            }
+            r0 = _mm512_mul_pd(alpha, r0); r1 = _mm512_mul_pd(alpha, r1);
+            r2 = _mm512_mul_pd(alpha, r2); r3 = _mm512_mul_pd(alpha, r3);
+            if(g->beta != 0.0){
+                r0 = _mm512_fmadd_pd(beta, _mm512_loadu_pd(&c_row[i]), r0);
+                r1 = _mm512_fmadd_pd(beta, _mm512_loadu_pd(&c_row[i+8]), r1);
+                r2 = _mm512_fmadd_pd(beta, _mm512_loadu_pd(&c_row[i+16]), r2);
+                r3 = _mm512_fmadd_pd(beta, _mm512_loadu_pd(&c_row[i+24]), r3);
+            }
+            _mm512_storeu_pd(&c_row[i], r0);
+            _mm512_storeu_pd(&c_row[i+8], r1);
+            _mm512_storeu_pd(&c_row[i+16], r2);
+            _mm512_storeu_pd(&c_row[i+24], r3);
+        }
+        // Remaining columns, 8 at a time, the last group being masked
+        for (; i<g->n; i+=8){
+            __mmask8 mask = (g->n - i >= 8) ? 0xFF : (__mmask8)((1u << (g->n - i)) - 1);
+            __m512d r_line = _mm512_setzero_pd();
+            for (j=0; j<g->k; j++)
+                r_line = _mm512_fmadd_pd(_mm512_set1_pd(a_row[(long)j*a_cs]),
+                                         _mm512_maskz_loadu_pd(mask, &g->b[(long)j*b_rs + i]), r_line);
+            r_line = _mm512_mul_pd(alpha, r_line);
+            if(g->beta != 0.0)
+                r_line = _mm512_fmadd_pd(beta, _mm512_maskz_loadu_pd(mask, &c_row[i]), r_line);
+            _mm512_mask_storeu_pd(&c_row[i], mask, r_line);
+        }
+    }
+}
+
+
+
+/****************************************************
+ Writes count float sums of a result row as doubles,
+ scaled by alpha and added to beta times the old values
+ ***************************************************/
+static void store_float_sums(double *c_row, const float *sums, int count, double alpha, double beta){
+  int i;
+
+  for(i=0; i<count; i++)
+    c_row[i] = (beta == 0.0) ? alpha*sums[i] : alpha*sums[i] + beta*c_row[i];
+}
+
+
+
+/****************************************************
+ Single precision version of matrix_gemm_sse: four
+ floats per __m128 instead of two doubles, so twice
+ the columns per instruction. The row of C stays double
+ ***************************************************/
+void matrix_gemm_sse_float(const gemm_view_f *g){
+  int a_rs = g->trans_a ? 1 : g->lda, a_cs = g->trans_a ? g->lda : 1;
+  int b_rs = g->trans_b ? 1 : g->ldb;
+  int i, j, jj;
+
+  // The vector loads need the rows of op(B) to be contiguous
+  if(g->trans_b){
+    matrix_gemm_float_ref(g);
+    return;
+  }
+
+# pragma omp parallel \
+    shared(g, a_rs, a_cs, b_rs) \
+    private(i, j)
+# pragma omp for
+    for(jj=0; jj<g->m; jj++){
+        const float *a_row = &g->a[(long)jj*a_rs];
+        double *c_row = &g->c[(long)jj*g->ldc];
+        float sums[4];
+        for (i=0; i+4<=g->n; i+=4){
+            __m128 r_line = _mm_setzero_ps();
+            for (j=0; j<g->k; j++)
+                r_line = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a_row[(long)j*a_cs]),
+                                               _mm_loadu_ps(&g->b[(long)j*b_rs + i])), r_line);
+            _mm_storeu_ps(sums, r_line);
+            store_float_sums(&c_row[i], sums, 4, g->alpha, g->beta);
+        }
+        // The last 1 to 3 columns with a scalar tail
+        for (; i<g->n; i++){
+            sums[0] = 0.0f;
+            for (j=0; j<g->k; j++)
+                sums[0] += a_row[(long)j*a_cs] * g->b[(long)j*b_rs + i];
+            store_float_sums(&c_row[i], sums, 1, g->alpha, g->beta);
+        }
+    }
+}
+
+
+
+/****************************************************
+ Single precision version of matrix_gemm_avx2, eight
+ floats per vector and 32 columns per pass
+ ***************************************************/
+__attribute__((target("avx2,fma")))
+void matrix_gemm_avx2_float(const gemm_view_f *g){
+  int a_rs = g->trans_a ? 1 : g->lda, a_cs = g->trans_a ? g->lda : 1;
+  int b_rs = g->trans_b ? 1 : g->ldb;
+  int i, j, jj;
+
+  if(g->trans_b){
+    matrix_gemm_float_ref(g);
+    return;
+  }
+
+# pragma omp parallel \
+    shared(g, a_rs, a_cs, b_rs) \
+    private(i, j)
+# pragma omp for
+    for(jj=0; jj<g->m; jj++){
+        const float *a_row = &g->a[(long)jj*a_rs];
+        double *c_row = &g->c[(long)jj*g->ldc];
+        float sums[32];
+        for (i=0; i+32<=g->n; i+=32){
+            __m256 r0 = _mm256_setzero_ps(), r1 = _mm256_setzero_ps();
+            __m256 r2 = _mm256_setzero_ps(), r3 = _mm256_setzero_ps();
+            for (j=0; j<g->k; j++) {
+                __m256 a_line = _mm256_set1_ps(a_row[(long)j*a_cs]);
+                const float *b_row = &g->b[(long)j*b_rs + i];
+                r0 = _mm256_fmadd_ps(a_line, _mm256_loadu_ps(b_row), r0);
+                r1 = _mm256_fmadd_ps(a_line, _mm256_loadu_ps(b_row+8), r1);
+                r2 = _mm256_fmadd_ps(a_line, _mm256_loadu_ps(b_row+16), r2);
+                r3 = _mm256_fmadd_ps(a_line, _mm256_loadu_ps(b_row+24), r3);
+            }
+            _mm256_storeu_ps(sums, r0);
+            _mm256_storeu_ps(sums+8, r1);
+            _mm256_storeu_ps(sums+16, r2);
+            _mm256_storeu_ps(sums+24, r3);
+            store_float_sums(&c_row[i], sums, 32, g->alpha, g->beta);
+        }
+        // Remaining columns, 8 at a time, the last 1 to 7 of them through a masked load
+        for (; i<g->n; i+=8){
+            int count = (g->n - i < 8) ? g->n - i : 8;
+            __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(count),
+                                              _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            __m256 r_line = _mm256_setzero_ps();
+            for (j=0; j<g->k; j++)
+                r_line = _mm256_fmadd_ps(_mm256_set1_ps(a_row[(long)j*a_cs]),
+                                         _mm256_maskload_ps(&g->b[(long)j*b_rs + i], mask), r_line);
+            _mm256_storeu_ps(sums, r_line);
+            store_float_sums(&c_row[i], sums, count, g->alpha, g->beta);
+        }
+    }
+}
+
+
+
+/****************************************************
+ Single precision version of matrix_gemm_avx512,
+ sixteen floats per vector and 64 columns per pass
+ ***************************************************/
+__attribute__((target("avx512f")))
+void matrix_gemm_avx512_float(const gemm_view_f *g){
+  int a_rs = g->trans_a ? 1 : g->lda, a_cs = g->trans_a ? g->lda : 1;
+  int b_rs = g->trans_b ? 1 : g->ldb;
+  int i, j, jj;
+
+  if(g->trans_b){
+    matrix_gemm_float_ref(g);
+    return;
+  }
+
+# pragma omp parallel \
+    shared(g, a_rs, a_cs, b_rs) \
+    private(i, j)
+# pragma omp for
+    for(jj=0; jj<g->m; jj++){
+        const float *a_row = &g->a[(long)jj*a_rs];
+        double *c_row = &g->c[(long)jj*g->ldc];
+        float sums[64];
+        for (i=0; i+64<=g->n; i+=64){
+            __m512 r0 = _mm512_setzero_ps(), r1 = _mm512_setzero_ps();
+            __m512 r2 = _mm512_setzero_ps(), r3 = _mm512_setzero_ps();
+            for (j=0; j<g->k; j++) {
+                __m512 a_line = _mm512_set1_ps(a_row[(long)j*a_cs]);
+                const float *b_row = &g->b[(long)j*b_rs + i];
+                r0 = _mm512_fmadd_ps(a_line, _mm512_loadu_ps(b_row), r0);
+                r1 = _mm512_fmadd_ps(a_line, _mm512_loadu_ps(b_row+16), r1);
+                r2 = _mm512_fmadd_ps(a_line, _mm512_loadu_ps(b_row+32), r2);
+                r3 = _mm512_fmadd_ps(a_line, _mm512_loadu_ps(b_row+48), r3);
+            }
+            _mm512_storeu_ps(sums, r0);
+            _mm512_storeu_ps(sums+16, r1);
+            _mm512_storeu_ps(sums+32, r2);
+            _mm512_storeu_ps(sums+48, r3);
+            store_float_sums(&c_row[i], sums, 64, g->alpha, g->beta);
+        }
+        // Remaining columns, 16 at a time, the last group being masked
+        for (; i<g->n; i+=16){
+            int count = (g->n - i < 16) ? g->n - i : 16;
+            __mmask16 mask = (count == 16) ? 0xFFFF : (__mmask16)((1u << count) - 1);
+            __m512 r_line = _mm512_setzero_ps();
+            for (j=0; j<g->k; j++)
+                r_line = _mm512_fmadd_ps(_mm512_set1_ps(a_row[(long)j*a_cs]),
+                                         _mm512_maskz_loadu_ps(mask, &g->b[(long)j*b_rs + i]), r_line);
+            _mm512_storeu_ps(sums, r_line);
+            store_float_sums(&c_row[i], sums, count, g->alpha, g->beta);
         }
     }
 }
 
 
 
+/****************************************************
+ Mixed precision version of matrix_gemm_sse: float
+ operands, so half the bytes of B are streamed, widened
+ to double with _mm_cvtps_pd and summed in double. Each
+ load of four floats feeds two double registers
+ ***************************************************/
+void matrix_gemm_sse_mixed(const gemm_view_f *g){
+  int a_rs = g->trans_a ? 1 : g->lda, a_cs = g->trans_a ? g->lda : 1;
+  int b_rs = g->trans_b ? 1 : g->ldb;
+  int i, j, jj;
+
+  if(g->trans_b){
+    matrix_gemm_mixed_ref(g);
+    return;
+  }
+
+# pragma omp parallel \
+    shared(g, a_rs, a_cs, b_rs) \
+    private(i, j)
+# pragma omp for
+    for(jj=0; jj<g->m; jj++){
+        const float *a_row = &g->a[(long)jj*a_rs];
+        double *c_row = &g->c[(long)jj*g->ldc];
+        __m128d alpha = _mm_set1_pd(g->alpha), beta = _mm_set1_pd(g->beta);
+        for (i=0; i+4<=g->n; i+=4){
+            __m128d r0 = _mm_setzero_pd(), r1 = _mm_setzero_pd();
+            for (j=0; j<g->k; j++){
+                __m128d a_line = _mm_set1_pd(a_row[(long)j*a_cs]);
+                __m128 b_line = _mm_loadu_ps(&g->b[(long)j*b_rs + i]);
+                r0 = _mm_add_pd(_mm_mul_pd(a_line, _mm_cvtps_pd(b_line)), r0);
+                r1 = _mm_add_pd(_mm_mul_pd(a_line, _mm_cvtps_pd(_mm_movehl_ps(b_line, b_line))), r1);
+            }
+            r0 = _mm_mul_pd(alpha, r0);
+            r1 = _mm_mul_pd(alpha, r1);
+            if(g->beta != 0.0){
+                r0 = _mm_add_pd(_mm_mul_pd(beta, _mm_loadu_pd(&c_row[i])), r0);
+                r1 = _mm_add_pd(_mm_mul_pd(beta, _mm_loadu_pd(&c_row[i+2])), r1);
+            }
+            _mm_storeu_pd(&c_row[i], r0);
+            _mm_storeu_pd(&c_row[i+2], r1);
+        }
+        // The last 1 to 3 columns with a scalar tail
+        for (; i<g->n; i++){
+            double sum = 0.0;
+            for (j=0; j<g->k; j++)
+                sum += (double)a_row[(long)j*a_cs] * (double)g->b[(long)j*b_rs + i];
+            c_row[i] = (g->beta == 0.0) ? g->alpha*sum : g->alpha*sum + g->beta*c_row[i];
+        }
+    }
+}
+
+
+
+/****************************************************
+ Mixed precision version of matrix_gemm_avx2: four
+ floats of B widened by _mm256_cvtps_pd per FMA, 16
+ columns per pass summed in double
+ ***************************************************/
+__attribute__((target("avx2,fma")))
+void matrix_gemm_avx2_mixed(const gemm_view_f *g){
+  int a_rs = g->trans_a ? 1 : g->lda, a_cs = g->trans_a ? g->lda : 1;
+  int b_rs = g->trans_b ? 1 : g->ldb;
+  int i, j, jj;
+
+  if(g->trans_b){
+    matrix_gemm_mixed_ref(g);
+    return;
+  }
+
+# pragma omp parallel \
+    shared(g, a_rs, a_cs, b_rs) \
+    private(i, j)
+# pragma omp for
+    for(jj=0; jj<g->m; jj++){
+        const float *a_row = &g->a[(long)jj*a_rs];
+        double *c_row = &g->c[(long)jj*g->ldc];
+        __m256d alpha = _mm256_set1_pd(g->alpha), beta = _mm256_set1_pd(g->beta);
+        for (i=0; i+16<=g->n; i+=16){
+            __m256d r0 = _mm256_setzero_pd(), r1 = _mm256_setzero_pd();
+            __m256d r2 = _mm256_setzero_pd(), r3 = _mm256_setzero_pd();
+            for (j=0; j<g->k; j++) {
+                __m256d a_line = _mm256_set1_pd(a_row[(long)j*a_cs]);
+                const float *b_row = &g->b[(long)j*b_rs + i];
+                r0 = _mm256_fmadd_pd(a_line, _mm256_cvtps_pd(_mm_loadu_ps(b_row)), r0);
+                r1 = _mm256_fmadd_pd(a_line, _mm256_cvtps_pd(_mm_loadu_ps(b_row+4)), r1);
+                r2 = _mm256_fmadd_pd(a_line, _mm256_cvtps_pd(_mm_loadu_ps(b_row+8)), r2);
+                r3 = _mm256_fmadd_pd(a_line, _mm256_cvtps_pd(_mm_loadu_ps(b_row+12)), r3);
+            }
+            r0 = _mm256_mul_pd(alpha, r0); r1 = _mm256_mul_pd(alpha, r1);
+            r2 = _mm256_mul_pd(alpha, r2); r3 = _mm256_mul_pd(alpha, r3);
+            if(g->beta != 0.0){
+                r0 = _mm256_fmadd_pd(beta, _mm256_loadu_pd(&c_row[i]), r0);
+                r1 = _mm256_fmadd_pd(beta, _mm256_loadu_pd(&c_row[i+4]), r1);
+                r2 = _mm256_fmadd_pd(beta, _mm256_loadu_pd(&c_row[i+8]), r2);
+                r3 = _mm256_fmadd_pd(beta, _mm256_loadu_pd(&c_row[i+12]), r3);
+            }
+            _mm256_storeu_pd(&c_row[i], r0);
+            _mm256_storeu_pd(&c_row[i+4], r1);
+            _mm256_storeu_pd(&c_row[i+8], r2);
+            _mm256_storeu_pd(&c_row[i+12], r3);
+        }
+        // Remaining columns, 4 at a time, the last 1 to 3 of them through masked loads and a masked store
+        for (; i<g->n; i+=4){
+            __m128i mask_f = _mm_cmpgt_epi32(_mm_set1_epi32(g->n - i), _mm_setr_epi32(0, 1, 2, 3));
+            __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(g->n - i),
+                                              _mm256_setr_epi64x(0, 1, 2, 3));
+            __m256d r_line = _mm256_setzero_pd();
+            for (j=0; j<g->k; j++)
+                r_line = _mm256_fmadd_pd(_mm256_set1_pd(a_row[(long)j*a_cs]),
+                                         _mm256_cvtps_pd(_mm_maskload_ps(&g->b[(long)j*b_rs + i], mask_f)), r_line);
+            r_line = _mm256_mul_pd(alpha, r_line);
+            if(g->beta != 0.0)
+                r_line = _mm256_fmadd_pd(beta, _mm256_maskload_pd(&c_row[i], mask), r_line);
+            _mm256_maskstore_pd(&c_row[i], mask, r_line);
+        }
+    }
+}
+
+
+
+/****************************************************
+ Mixed precision version of matrix_gemm_avx512: eight
+ floats of B widened by _mm512_cvtps_pd per FMA, 32
+ columns per pass summed in double
+ ***************************************************/
+__attribute__((target("avx512f")))
+void matrix_gemm_avx512_mixed(const gemm_view_f *g){
+  int a_rs = g->trans_a ? 1 : g->lda, a_cs = g->trans_a ? g->lda : 1;
+  int b_rs = g->trans_b ? 1 : g->ldb;
+  int i, j, jj;
+
+  if(g->trans_b){
+    matrix_gemm_mixed_ref(g);
+    return;
+  }
+
+# pragma omp parallel \
+    shared(g, a_rs, a_cs, b_rs) \
+    private(i, j)
+# pragma omp for
+    for(jj=0; jj<g->m; jj++){
+        const float *a_row = &g->a[(long)jj*a_rs];
+        double *c_row = &g->c[(long)jj*g->ldc];
+        __m512d alpha = _mm512_set1_pd(g->alpha), beta = _mm512_set1_pd(g->beta);
+        for (i=0; i+32<=g->n; i+=32){
+            __m512d r0 = _mm512_setzero_pd(), r1 = _mm512_setzero_pd();
+            __m512d r2 = _mm512_setzero_pd(), r3 = _mm512_setzero_pd();
+            for (j=0; j<g->k; j++) {
+                __m512d a_line = _mm512_set1_pd(a_row[(long)j*a_cs]);
+                const float *b_row = &g->b[(long)j*b_rs + i];
+                __m512 b_lo = _mm512_loadu_ps(b_row), b_hi = _mm512_loadu_ps(b_row+16);
+                r0 = _mm512_fmadd_pd(a_line, _mm512_cvtps_pd(_mm512_castps512_ps256(b_lo)), r0);
+                r1 = _mm512_fmadd_pd(a_line, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(b_lo), 1))), r1);
+                r2 = _mm512_fmadd_pd(a_line, _mm512_cvtps_pd(_mm512_castps512_ps256(b_hi)), r2);
+                r3 = _mm512_fmadd_pd(a_line, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(b_hi), 1))), r3);
+            }
+            r0 = _mm512_mul_pd(alpha, r0); r1 = _mm512_mul_pd(alpha, r1);
+            r2 = _mm512_mul_pd(alpha, r2); r3 = _mm512_mul_pd(alpha, r3);
+            if(g->beta != 0.0){
+                r0 = _mm512_fmadd_pd(beta, _mm512_loadu_pd(&c_row[i]), r0);
+                r1 = _mm512_fmadd_pd(beta, _mm512_loadu_pd(&c_row[i+8]), r1);
+                r2 = _mm512_fmadd_pd(beta, _mm512_loadu_pd(&c_row[i+16]), r2);
+                r3 = _mm512_fmadd_pd(beta, _mm512_loadu_pd(&c_row[i+24]), r3);
+            }
+            _mm512_storeu_pd(&c_row[i], r0);
+            _mm512_storeu_pd(&c_row[i+8], r1);
+            _mm512_storeu_pd(&c_row[i+16], r2);
+            _mm512_storeu_pd(&c_row[i+24], r3);
+        }
+        // Remaining columns, 8 at a time, the last group being masked
+        for (; i<g->n; i+=8){
+            __mmask8 mask = (g->n - i >= 8) ? 0xFF : (__mmask8)((1u << (g->n - i)) - 1);
+            __m512d r_line = _mm512_setzero_pd();
+            for (j=0; j<g->k; j++)
+                r_line = _mm512_fmadd_pd(_mm512_set1_pd(a_row[(long)j*a_cs]),
+                                         _mm512_cvtps_pd(_mm512_castps512_ps256(_mm512_maskz_loadu_ps(mask, &g->b[(long)j*b_rs + i]))), r_line);
+            r_line = _mm512_mul_pd(alpha, r_line);
+            if(g->beta != 0.0)
+                r_line = _mm512_fmadd_pd(beta, _mm512_maskz_loadu_pd(mask, &c_row[i]), r_line);
+            _mm512_mask_storeu_pd(&c_row[i], mask, r_line);
+        }
+    }
+}
+
+
+
+/*** TYPEDEFS AND STRUCTS***/
+typedef void (*matrix_gemm_fn)(const gemm_view *g);
+
+/****************************************************
+ Picks the widest kernel the running cpu supports. The
+ MATRIX_SIMD environment variable (sse2, avx2, avx512)
+ can force a narrower one, e.g. to compare them
+ ***************************************************/
+matrix_gemm_fn matrix_gemm_select(const char **name, precision_kernels *kernels){
+  const char *force = getenv("MATRIX_SIMD");
+
+  __builtin_cpu_init();
+  // The float and mixed kernels have the same width as the double one
+  if((force == NULL || strcmp(force, "avx512") == 0) && __builtin_cpu_supports("avx512f")){
+    *name = "avx512";
+    kernels->double_kernel = matrix_gemm_avx512;
+    kernels->float_kernel = matrix_gemm_avx512_float;
+    kernels->mixed_kernel = matrix_gemm_avx512_mixed;
+    return matrix_gemm_avx512;
+  }
+  if((force == NULL || strcmp(force, "avx512") == 0 || strcmp(force, "avx2") == 0)
+     && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+    *name = "avx2";
+    kernels->double_kernel = matrix_gemm_avx2;
+    kernels->float_kernel = matrix_gemm_avx2_float;
+    kernels->mixed_kernel = matrix_gemm_avx2_mixed;
+    return matrix_gemm_avx2;
+  }
+  *name = "sse2";
+  kernels->double_kernel = matrix_gemm_sse;
+  kernels->float_kernel = matrix_gemm_sse_float;
+  kernels->mixed_kernel = matrix_gemm_sse_mixed;
+  return matrix_gemm_sse;
+}
+
+
+
+/*** TYPEDEFS AND STRUCTS***/
+// One kernel call of the bench mode
+typedef struct {
+  matrix_gemm_fn kernel;
+  gemm_view g;
+} bench_call;
+
+static void bench_call_run(void *context){
+  bench_call *call = (bench_call *)context;
+  call->kernel(&call->g);
+}
+
+/****************************************************
+ bench mode: sweeps sizes and thread counts over the
+ sequential kernel and every SIMD kernel the cpu runs
+ ***************************************************/
+int bench_main(int argc, char *argv[]){
+  const char *names[] = {"sse2", "avx2", "avx512"};
+  matrix_gemm_fn kernels[] = {matrix_gemm_sse, matrix_gemm_avx2, matrix_gemm_avx512};
+  int supported[3];
+  bench_config config;
+  bench_output output;
+  arena matrices;
+  int s, t, k, largest = 0;
+
+  if(!bench_parse_args(argc, argv, &config) || !bench_open(&output, &config))
+    return 0;
+
+  // One arena sized for the largest matrices is reused by every size of the sweep
+  for(s=0; s<config.num_sizes; s++)
+    if(config.sizes[s] > largest)
+      largest = config.sizes[s];
+  if(!arena_init(&matrices, 3*arena_matrix_bytes(largest, largest, ARENA_ALIGN)))
+    return 0;
+
+  __builtin_cpu_init();
+  supported[0] = 1;
+  supported[1] = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  supported[2] = __builtin_cpu_supports("avx512f");
+
+  for(s=0; s<config.num_sizes; s++){
+    int size = config.sizes[s];
+    double *matrix1, *matrix2, *result;
+    bench_result sq = {.backend = "sse", .kernel = "sq", .size = size, .threads = 1};
+    bench_call call;
+
+    arena_reset(&matrices);
+    matrix1 = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+    matrix2 = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+    result = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+    matrix_gen(size, matrix1, MATRIX_STREAM_A);
+    matrix_gen(size, matrix2, MATRIX_STREAM_B);
+    gemm_view_square(&call.g, size, matrix1, matrix2, result);
+
+    // The sequential kernel is the baseline of every speedup, so it always runs
+    call.kernel = matrix_gemm_ref;
+    bench_measure(bench_call_run, &call, &config, &sq);
+    sq.speedup = 1.0;
+    if(bench_kernel_enabled(&config, "sq"))
+      bench_emit(&output, &sq);
+
+    for(t=0; t<config.num_threads; t++){
+      omp_set_num_threads(config.threads[t]);
+      for(k=0; k<3; k++){
+        bench_result r = {.backend = "sse", .kernel = names[k], .size = size, .threads = config.threads[t]};
+        if(!supported[k] || !bench_kernel_enabled(&config, names[k]))
+          continue;
+        call.kernel = kernels[k];
+        bench_measure(bench_call_run, &call, &config, &r);
+        r.speedup = sq.median / r.median;
+        bench_emit(&output, &r);
+      }
+    }
+  }
+  arena_release(&matrices);
+  bench_close(&output);
+  return 1;
+}
+
+
+
 /****************************************************
  
  ***************************************************/
 int main(int argc, char *argv[]){
     
-  int i, j, adsize;
   if(argc < 2){
-    printf("Usage: %s matrix/vector_size\n", argv[0]);
+    printf("Usage: %s matrix/vector_size [--input A.bin B.bin] [--output C.bin]\n", argv[0]);
+    printf("       %s bench [--sizes n,..] [--threads t,..] [--kernels sq,sse2,avx2,avx512] [--trials n] [--warmup n] [--format csv|json] [--output file] [--append]\n", argv[0]);
     return 0;
   }
+  if(strcmp(argv[1], "bench") == 0)
+    return bench_main(argc-2, argv+2);
 
-  // Calculates the lowest multiple of two that is greater than "size" and stores the value in adsize. Adsize will be size of padded matrix and "size" of the actual matrix. If size==adsize, no padding will be required
+  // The SIMD kernels take any size (tails are masked or scalar), so the matrices are allocated and multiplied at their real size
   int size = atoi(argv[1]);
-    adsize = size;
-  if(size%2 != 0){
-    do{ adsize++; }while(adsize%2 != 0);
+  int arg;
+
+  // --input multiplies two matrix files (see common/matrix_io.h), a size of 0 takes theirs, and --output writes the result
+  matrix_io_args io = { NULL, NULL, NULL };
+  matrix_file file_a, file_b, file_c;
+  for(arg=2; arg < argc; arg++){
+    if(!matrix_io_option(argc, argv, &arg, &io)){
+      printf("unknown option %s\n", argv[arg]);
+      return 0;
+    }
   }
-    
-  // Alocation of "adsize*adsize" number of double floating point data types (to store the matriz operands) with a memory address multiple of sizeof(double)*2. This last argument was halved as now our data types are twice as long
-  double *matrix1 = (double *)memalign(sizeof(double)*2, sizeof(double)*adsize*adsize);
-  if(matrix1==NULL){
-    printf("can't allocate the required memory for matrix\n");
-    free(matrix1);
+  if(!matrix_io_load_inputs(&io, &size, &file_a, &file_b))
     return 0;
-  }
-
-  double *matrix2 = (double *)memalign(sizeof(double)*2, sizeof(double)*adsize*adsize);
-  if(matrix2==NULL){
-    printf("can't allocate the required memory for matrix\n");
-    free(matrix2);
+  if(size <= 0){
+    printf("incorrect arguments, the size should be greater than zero\n");
     return 0;
   }
-
-  double *result_sq = (double *)memalign(sizeof(double)*2, sizeof(double)*adsize*adsize);
-  if(result_sq==NULL){
-    printf("can't allocate the required memory for result_sq\n");
-    free(matrix1);
-    free(matrix2);
+    
+  // The four matrices are carved out of one mapping, on huge pages when the system offers them, 64-byte aligned for the widest vectors and released by a single arena_release
+  arena matrices;
+  if(!arena_init(&matrices, 4*arena_matrix_bytes(size, size, ARENA_ALIGN))){
+    printf("can't allocate the required memory for the matrices\n");
     return 0;
   }
+  double *matrix1 = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+  double *matrix2 = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+  double *result_sq = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+  double *result_pl = arena_matrix(&matrices, size, size, ARENA_ALIGN);
 
-  double *result_pl = (double *)memalign(sizeof(double)*2, sizeof(double)*adsize*adsize);
-  if(result_pl==NULL){
-    printf("can't allocate the required memory for result_pl\n");
-    free(matrix1);
-    free(matrix2);
-    free(result_sq);
-    return 0;
+  // The result written out is computed straight into the mapping of the output file
+  if(io.output != NULL){
+    result_pl = (double *)matrix_file_create(&file_c, io.output, size, size, MATRIX_DTYPE_FLOAT64,
+					     MATRIX_LAYOUT_ROW_MAJOR, 0, ARENA_ALIGN);
+    if(result_pl == NULL){
+      arena_release(&matrices);
+      return 0;
+    }
   }
 
-  matrix_gen(size, adsize, matrix1);
-  matrix_gen(size, adsize, matrix2);
+  // Inputs of doubles in row-major order are multiplied in place, others are converted into the arena
+  if(io.input_a != NULL){
+    matrix1 = matrix_io_operand(&file_a, io.input_a, matrix1, size);
+    matrix2 = matrix_io_operand(&file_b, io.input_b, matrix2, size);
+  }else{
+    matrix_gen(size, matrix1, MATRIX_STREAM_A);
+    matrix_gen(size, matrix2, MATRIX_STREAM_B);
+  }
     
   double time_sq;
   double time_sse;
 
-  time_sq = omp_get_wtime();
-  matrix_mult_sq(adsize, matrix1, matrix2, result_sq);
-  time_sq = omp_get_wtime() - time_sq;
+  // The kernel is chosen once at startup, so the same binary runs at full vector width on every host
+  const char *simd_name;
+  precision_kernels kernels;
+  matrix_gemm_select(&simd_name, &kernels);
+  // MATRIX_PRECISION runs the SIMD kernel on float operands, with float or double sums, or on exact float products of operand slices summed to double accuracy (refine)
+  int precision = precision_mode();
+  gemm_view g;
+  // Filled only when MATRIX_PERF=1 asks for the hardware counters of both kernels
+  perf_session perf_sq, perf_sse;
+
+  // The sequential multiply is only needed as the reference of a full check, Freivalds checks large runs without it
+  int verify = verify_method(size);
+
+  if(verify == VERIFY_FULL){
+    perf_begin(&perf_sq);
+    time_sq = omp_get_wtime();
+    matrix_mult_sq(size, matrix1, matrix2, result_sq);
+    time_sq = omp_get_wtime() - time_sq;
+    perf_end(&perf_sq);
+  }
 
+  perf_begin(&perf_sse);
   time_sse = omp_get_wtime();
-  matrix_mult_sse(adsize, matrix1, matrix2, result_pl);
+  gemm_view_square(&g, size, matrix1, matrix2, result_pl);
+  matrix_gemm_precision(&g, precision, &kernels);
   time_sse = omp_get_wtime() - time_sse;
+  perf_end(&perf_sse);
     
-  printf("SEQUENTIAL EXECUTION: %f (sec)\n",time_sq);
-  printf("PARALLEL EXECUTION: %f (sec)\n", time_sse);
-    
-    
-    // If padding was used, this if clause will take the resulting matrix and create the requested result. In effect it will now allocate a correct size structure and clean the artifacts created by the adding of the padding to the operand matrixes, copying the correct results to the final resulting matrix
-    double *fresult_sq, *fresult_pl;
-    if(size!=adsize){
-        fresult_sq = (double *)memalign(sizeof(double)*2, sizeof(double)*size*size);
-        fresult_pl = (double *)memalign(sizeof(double)*2, sizeof(double)*size*size);
-        if(fresult_pl==NULL || fresult_sq==NULL){
-            printf("can't allocate the required memory for result_pl\n");
-            free(matrix1);
-            free(matrix2);
-            free(result_sq);
-            return 0;
-        }
-        
-        j=0;
-        for(i=0;i<adsize*adsize; i++){
-            if(  !( ((i+1)%adsize==0 && (adsize-size >0)) || i>(size*adsize-1) )  ){
-                fresult_pl[j]= result_pl[i];
-                fresult_sq[j]= result_sq[i];
-                j++;
-            }
-        }
-    }
+  printf("MATRICES IN A %zu MB ARENA ON %s\n", matrices.capacity >> 20, arena_pages_name(&matrices));
+  if(verify == VERIFY_FULL){
+    printf("SEQUENTIAL EXECUTION: %f (sec)\n",time_sq);
+    perf_report(&perf_sq, "SEQUENTIAL", 2.0*size*(double)size*size);
+  }else{
+    printf("SEQUENTIAL EXECUTION: skipped\n");
+  }
+  printf("PARALLEL EXECUTION (%s, %s precision): %f (sec)\n", simd_name, precision_name(precision), time_sse);
+  perf_report(&perf_sse, simd_name, 2.0*size*(double)size*size);
     
 
-  //check
-  for(i=0; i<size*size; i++)
-    if((int)result_sq[i] != (int)result_pl[i]){
-      printf("wrong at position %d\n", i);
-      free(matrix1);
-      free(matrix2);
-      free(result_sq);
-      free(result_pl);
-      return 0;
-    }
+  //check, the whole matrix against the sequential result or the Freivalds check, see MATRIX_VERIFY
+  // Results in less than double precision are checked against the tolerance of their precision
+  if(!verify_square_tol(verify, size, matrix1, matrix2, result_sq, result_pl, precision_tol(precision, size), simd_name)){
+    printf("wrong result of the %s multiply\n", simd_name);
+    arena_release(&matrices);
+    return 0;
+  }
     
   //printf("\nCorrect Result!\n\n");
 
-  free(matrix1);
-  free(matrix2);
-  free(result_sq);
-  free(result_pl);
-  if(size!=adsize){
-    free(fresult_sq);
-    free(fresult_pl);
+  // Only a checked result is sealed, an unsealed output file is rejected by the readers
+  if(io.output != NULL){
+    if(!matrix_file_commit(&file_c))
+      return 0;
+    printf("OUTPUT %s: %dx%d float64 row-major, %.1f MB\n", io.output, size, size, file_c.bytes/1048576.0);
+    matrix_file_close(&file_c);
+  }
+  if(io.input_a != NULL){
+    matrix_file_close(&file_a);
+    matrix_file_close(&file_b);
   }
+  arena_release(&matrices);
     
   return 1;
 }
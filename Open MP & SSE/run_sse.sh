@@ -4,7 +4,7 @@ matrix_size=$1
 
 echo "compile application"
 
-gcc -g -lm -msse -fopenmp  matrix_sse.c -o matrix_sse.exe
+gcc -g -msse -fopenmp  matrix_sse.c ../common/matrix_view.c ../common/bench.c ../common/perf_counters.c ../common/verify.c ../common/matrix_rng.c ../common/arena.c ../common/precision.c ../common/matrix_io.c -o matrix_sse.exe -lm
 
 echo "executing the application"
 ./matrix_sse.exe $matrix_size
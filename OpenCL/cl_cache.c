@@ -0,0 +1,197 @@
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include "matrix_cl.h"
+
+// Directory used when CL_CACHE_DIR is not set
+#define CL_CACHE_DEFAULT_DIR ".clcache"
+
+
+/*****************************************************
+ 64-bit FNV-1a hash, folded over several strings to
+ form the cache key
+ ****************************************************/
+static unsigned long long fnv1a(unsigned long long hash, const void *data, size_t length){
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t i;
+
+    for(i=0; i<length; i++){
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    // A separator keeps ("ab","c") and ("a","bc") apart
+    hash ^= 0xff;
+    hash *= 0x100000001b3ULL;
+    return hash;
+}
+
+static unsigned long long fnv1a_info(unsigned long long hash, cl_int (*get)(void *, cl_uint, size_t, void *, size_t *),
+                                     void *object, cl_uint param){
+    char value[1024];
+    size_t length = 0;
+
+    if(get(object, param, sizeof(value), value, &length) != CL_SUCCESS)
+        length = 0;
+    return fnv1a(hash, value, length);
+}
+
+static cl_int platform_info(void *object, cl_uint param, size_t size, void *value, size_t *ret){
+    return clGetPlatformInfo((cl_platform_id)object, param, size, value, ret);
+}
+
+static cl_int device_info(void *object, cl_uint param, size_t size, void *value, size_t *ret){
+    return clGetDeviceInfo((cl_device_id)object, param, size, value, ret);
+}
+
+
+/*****************************************************
+ Builds the path of the cache entry for this platform,
+ device, driver, build options and kernel source
+ ****************************************************/
+static void cache_path(cl_platform_id platform, cl_device_id device, const char *source,
+                       size_t length, const char *options, char *path, size_t path_size){
+    const char *dir = getenv("CL_CACHE_DIR");
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+
+    if(dir == NULL || dir[0] == '\0')
+        dir = CL_CACHE_DEFAULT_DIR;
+
+    hash = fnv1a_info(hash, platform_info, platform, CL_PLATFORM_NAME);
+    hash = fnv1a_info(hash, platform_info, platform, CL_PLATFORM_VERSION);
+    hash = fnv1a_info(hash, device_info, device, CL_DEVICE_NAME);
+    hash = fnv1a_info(hash, device_info, device, CL_DEVICE_VERSION);
+    hash = fnv1a_info(hash, device_info, device, CL_DRIVER_VERSION);
+    hash = fnv1a(hash, options, strlen(options));
+    hash = fnv1a(hash, source, length);
+
+    snprintf(path, path_size, "%s/%016llx.bin", dir, hash);
+}
+
+
+/*****************************************************
+ Loads a cached binary, returning NULL on a miss or
+ when the driver rejects it
+ ****************************************************/
+static cl_program load_binary(cl_context context, cl_device_id device, const char *path,
+                              const char *options){
+    FILE *file = fopen(path, "rb");
+    unsigned char *binary;
+    size_t length;
+    cl_int status, binary_status;
+    cl_program program;
+
+    if(file == NULL)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    rewind(file);
+    binary = (unsigned char *)malloc(length);
+    if(binary == NULL || fread(binary, 1, length, file) != length){
+        fclose(file);
+        free(binary);
+        return NULL;
+    }
+    fclose(file);
+
+    program = clCreateProgramWithBinary(context, 1, &device, &length,
+        (const unsigned char **)&binary, &binary_status, &status);
+    free(binary);
+    if(status != CL_SUCCESS || binary_status != CL_SUCCESS)
+        return NULL;
+
+    // Binaries still have to go through clBuildProgram, which is cheap since there is nothing left to compile
+    if(clBuildProgram(program, 1, &device, options, NULL, NULL) != CL_SUCCESS){
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+
+/*****************************************************
+ Stores the binary of a freshly built program. It is
+ written to a temporary file and renamed, so concurrent
+ runs never see a partial entry
+ ****************************************************/
+static void store_binary(cl_program program, const char *path){
+    char tmp_path[1100];
+    size_t length = 0;
+    unsigned char *binary;
+    FILE *file;
+    char *dir_end;
+
+    if(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(length), &length, NULL) != CL_SUCCESS
+       || length == 0)
+        return;
+    binary = (unsigned char *)malloc(length);
+    if(binary == NULL)
+        return;
+    if(clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) != CL_SUCCESS){
+        free(binary);
+        return;
+    }
+
+    // Create the cache directory on first use
+    snprintf(tmp_path, sizeof(tmp_path), "%s", path);
+    if((dir_end = strrchr(tmp_path, '/')) != NULL){
+        *dir_end = '\0';
+        if(mkdir(tmp_path, 0755) != 0 && errno != EEXIST){
+            free(binary);
+            return;
+        }
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    if((file = fopen(tmp_path, "wb")) != NULL){
+        int ok = (fwrite(binary, 1, length, file) == length);
+        ok &= (fclose(file) == 0);
+        if(!ok || rename(tmp_path, path) != 0)
+            remove(tmp_path);
+    }
+    free(binary);
+}
+
+
+/*****************************************************
+ Returns the program built for the device, from the
+ on-disk cache when a matching entry exists and from
+ source otherwise (the new binary then being cached).
+ Setting CL_CACHE_DIR=off disables the cache
+ ****************************************************/
+cl_program cl_cache_build_program(cl_context context, cl_platform_id platform, cl_device_id device,
+                                  const char *source, size_t length, const char *options,
+                                  int *from_cache, cl_int *status){
+    const char *dir = getenv("CL_CACHE_DIR");
+    int enabled = (dir == NULL || strcmp(dir, "off") != 0);
+    char path[1024];
+    cl_program program;
+
+    *from_cache = 0;
+    if(enabled){
+        cache_path(platform, device, source, length, options, path, sizeof(path));
+        if((program = load_binary(context, device, path, options)) != NULL){
+            *from_cache = 1;
+            *status = CL_SUCCESS;
+            return program;
+        }
+    }
+
+    program = clCreateProgramWithSource(context, 1, &source, &length, status);
+    if(*status != CL_SUCCESS)
+        return NULL;
+
+    // Build (compile) the program for the devices with
+    // clBuildProgram()
+    *status = clBuildProgram(program, 1, &device, options, NULL, NULL);
+    if(*status != CL_SUCCESS){
+        char log[4096];
+        if(clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(log), log, NULL) == CL_SUCCESS)
+            printf("%s\n", log);
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    if(enabled)
+        store_binary(program, path);
+    return program;
+}
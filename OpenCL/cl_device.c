@@ -0,0 +1,166 @@
+#include <ctype.h>
+#include "matrix_cl.h"
+
+// Largest number of devices considered over all the platforms
+#define CL_MAX_DEVICES 64
+
+/*** TYPEDEFS AND STRUCTS***/
+typedef struct {
+    cl_platform_id platform;
+    cl_device_id device;
+    cl_device_type type;
+    char name[256];
+    char platform_name[256];
+} cl_device_entry;
+
+
+/*****************************************************
+ Enumerates every device of every platform, returning
+ how many were found
+ ****************************************************/
+static int enumerate_devices(cl_device_entry *entries, int max_entries){
+    cl_uint numPlatforms = 0;
+    cl_platform_id *platforms;
+    cl_uint p, d;
+    int count = 0;
+
+    if(clGetPlatformIDs(0, NULL, &numPlatforms) != CL_SUCCESS || numPlatforms == 0)
+        return 0;
+    platforms = (cl_platform_id*)malloc(numPlatforms*sizeof(cl_platform_id));
+    if(clGetPlatformIDs(numPlatforms, platforms, NULL) != CL_SUCCESS){
+        free(platforms);
+        return 0;
+    }
+
+    for(p=0; p<numPlatforms; p++){
+        cl_uint numDevices = 0;
+        cl_device_id *devices;
+        char platform_name[256] = "";
+
+        // A platform without any device reports CL_DEVICE_NOT_FOUND, which only means there is nothing to add
+        if(clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 0, NULL, &numDevices) != CL_SUCCESS || numDevices == 0)
+            continue;
+        devices = (cl_device_id*)malloc(numDevices*sizeof(cl_device_id));
+        if(clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, numDevices, devices, NULL) != CL_SUCCESS){
+            free(devices);
+            continue;
+        }
+        clGetPlatformInfo(platforms[p], CL_PLATFORM_NAME, sizeof(platform_name), platform_name, NULL);
+
+        for(d=0; d<numDevices && count<max_entries; d++){
+            cl_device_entry *entry = &entries[count++];
+            entry->platform = platforms[p];
+            entry->device = devices[d];
+            entry->type = 0;
+            entry->name[0] = '\0';
+            clGetDeviceInfo(devices[d], CL_DEVICE_TYPE, sizeof(entry->type), &entry->type, NULL);
+            clGetDeviceInfo(devices[d], CL_DEVICE_NAME, sizeof(entry->name), entry->name, NULL);
+            snprintf(entry->platform_name, sizeof(entry->platform_name), "%s", platform_name);
+        }
+        free(devices);
+    }
+    free(platforms);
+    return count;
+}
+
+static const char *type_name(cl_device_type type){
+    if(type & CL_DEVICE_TYPE_GPU) return "gpu";
+    if(type & CL_DEVICE_TYPE_CPU) return "cpu";
+    if(type & CL_DEVICE_TYPE_ACCELERATOR) return "accelerator";
+    return "other";
+}
+
+/*****************************************************
+ Case-insensitive substring search
+ ****************************************************/
+static int contains(const char *text, const char *pattern){
+    size_t i, j, n = strlen(text), m = strlen(pattern);
+
+    for(i=0; i+m<=n; i++){
+        for(j=0; j<m && tolower((unsigned char)text[i+j]) == tolower((unsigned char)pattern[j]); j++);
+        if(j == m)
+            return 1;
+    }
+    return 0;
+}
+
+static int first_of_type(const cl_device_entry *entries, int count, cl_device_type type){
+    int i;
+
+    for(i=0; i<count; i++)
+        if(entries[i].type & type)
+            return i;
+    return -1;
+}
+
+
+/*****************************************************
+ Prints the devices with the index used by --device
+ ****************************************************/
+void cl_device_list(void){
+    cl_device_entry entries[CL_MAX_DEVICES];
+    int count = enumerate_devices(entries, CL_MAX_DEVICES);
+    int i;
+
+    if(count == 0)
+        printf("no OpenCL device found\n");
+    for(i=0; i<count; i++)
+        printf("%d: [%s] %s (%s)\n", i, type_name(entries[i].type), entries[i].name, entries[i].platform_name);
+}
+
+
+/*****************************************************
+ Picks a device from a specification, which is one of
+   auto             first GPU, else accelerator, else CPU
+   gpu|cpu|accelerator  first device of that type
+   <n>              n-th device of cl_device_list
+   anything else    first device whose name or platform
+                    name contains it (case-insensitive)
+ ****************************************************/
+cl_int cl_device_select(const char *spec, cl_platform_id *platform, cl_device_id *device){
+    cl_device_entry entries[CL_MAX_DEVICES];
+    int count = enumerate_devices(entries, CL_MAX_DEVICES);
+    int chosen = -1;
+    int i;
+
+    if(count == 0){
+        printf("error in step 1, no OpenCL platform or device found\n");
+        return CL_DEVICE_NOT_FOUND;
+    }
+    if(spec == NULL || spec[0] == '\0')
+        spec = "auto";
+
+    if(strcmp(spec, "auto") == 0){
+        // Most nodes have no GPU, so the engine falls back on whatever else is there instead of giving up
+        chosen = first_of_type(entries, count, CL_DEVICE_TYPE_GPU);
+        if(chosen < 0) chosen = first_of_type(entries, count, CL_DEVICE_TYPE_ACCELERATOR);
+        if(chosen < 0) chosen = first_of_type(entries, count, CL_DEVICE_TYPE_CPU);
+        if(chosen < 0) chosen = 0;
+    }else if(strcmp(spec, "gpu") == 0){
+        chosen = first_of_type(entries, count, CL_DEVICE_TYPE_GPU);
+    }else if(strcmp(spec, "cpu") == 0){
+        chosen = first_of_type(entries, count, CL_DEVICE_TYPE_CPU);
+    }else if(strcmp(spec, "accelerator") == 0){
+        chosen = first_of_type(entries, count, CL_DEVICE_TYPE_ACCELERATOR);
+    }else if(isdigit((unsigned char)spec[0])){
+        chosen = atoi(spec);
+        if(chosen >= count)
+            chosen = -1;
+    }else{
+        for(i=0; i<count && chosen<0; i++)
+            if(contains(entries[i].name, spec) || contains(entries[i].platform_name, spec))
+                chosen = i;
+    }
+
+    if(chosen < 0){
+        printf("error in step 2, no OpenCL device matches \"%s\", available devices are:\n", spec);
+        cl_device_list();
+        return CL_DEVICE_NOT_FOUND;
+    }
+
+    *platform = entries[chosen].platform;
+    *device = entries[chosen].device;
+    printf("USING OPENCL DEVICE %d: [%s] %s (%s)\n", chosen, type_name(entries[chosen].type),
+           entries[chosen].name, entries[chosen].platform_name);
+    return CL_SUCCESS;
+}
@@ -0,0 +1,821 @@
+#include "matrix_cl.h"
+#include "../common/precision.h"
+
+
+/*****************************************************
+ Reads a whole kernel source file into a new buffer
+ ****************************************************/
+static char *read_source(const char *file_name, size_t *length){
+    FILE *file = fopen(file_name, "r");
+    char *buffer;
+
+    if(file == NULL){
+        printf("cannot open .cl file\n");
+        printf("current path: %s\n", file_name);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    rewind(file);
+
+    // read kernel source into buffer
+    buffer = (char*) malloc(*length + 1);
+    buffer[*length] = '\0';
+    if(fread(buffer, sizeof(char), *length, file) != *length){
+        printf("cannot read .cl file %s\n", file_name);
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+    return buffer;
+}
+
+
+/*****************************************************
+ Makes sure the device buffers hold at least "elems"
+ doubles each, recreating them only when they grow
+ ****************************************************/
+cl_int cl_engine_buffers(cl_engine *engine, size_t elems){
+    cl_int status = CL_SUCCESS;
+
+    if(elems <= engine->buffer_elems)
+        return CL_SUCCESS;
+
+    if(engine->buffer_in1 != NULL) clReleaseMemObject(engine->buffer_in1);
+    if(engine->buffer_in2 != NULL) clReleaseMemObject(engine->buffer_in2);
+    if(engine->buffer_out != NULL) clReleaseMemObject(engine->buffer_out);
+    engine->buffer_in1 = engine->buffer_in2 = engine->buffer_out = NULL;
+    engine->buffer_elems = 0;
+
+    engine->buffer_in1 = clCreateBuffer(engine->context, CL_MEM_READ_ONLY,
+        elems*sizeof(cl_double), NULL, &status);
+    if(status != CL_SUCCESS){
+        printf("error in step 5, creating buffer for bufferA: %s\n", getErrorString(status));
+        return status;
+    }
+
+    engine->buffer_in2 = clCreateBuffer(engine->context, CL_MEM_READ_ONLY,
+        elems*sizeof(cl_double), NULL, &status);
+    if(status != CL_SUCCESS){
+        printf("error in step 5, creating buffer for bufferB: %s\n", getErrorString(status));
+        return status;
+    }
+
+    engine->buffer_out = clCreateBuffer(engine->context, CL_MEM_WRITE_ONLY,
+        elems*sizeof(cl_double), NULL, &status);
+    if(status != CL_SUCCESS){
+        printf("error in step 5, creating buffer for bufferC: %s\n", getErrorString(status));
+        return status;
+    }
+
+    engine->buffer_elems = elems;
+    return CL_SUCCESS;
+}
+
+
+/*****************************************************
+ Settings used when nothing is given on the command line
+ ****************************************************/
+void cl_engine_config_default(cl_engine_config *config){
+    config->kernel_file = "vectorMatrixMul.cl";
+    config->device = "auto";
+    config->kernel = CL_KERNEL_NAIVE;
+    config->tile_size = 16;
+    config->rows_per_item = 4;
+    config->queues = 0;
+    config->panels = 8;
+    config->zero_copy = -1;
+    config->profiling = 0;
+}
+
+
+/*****************************************************
+ One-off setup: platform, device, context, queue and
+ the compiled program and kernels
+ ****************************************************/
+cl_int cl_engine_init(cl_engine *engine, const cl_engine_config *config){
+    cl_int status;
+    double time_start = omp_get_wtime();
+
+    memset(engine, 0, sizeof(*engine));
+    engine->config = *config;
+
+    if(config->tile_size <= 0 || config->rows_per_item <= 0 || config->tile_size % config->rows_per_item != 0){
+        printf("the tile size should be a multiple of the rows per work-item\n");
+        return CL_INVALID_VALUE;
+    }
+    if(config->queues < 0 || config->queues > CL_MAX_QUEUES || config->panels <= 0){
+        printf("the pipeline takes 1 to %d queues and at least one panel\n", CL_MAX_QUEUES);
+        return CL_INVALID_VALUE;
+    }
+
+    //-----------------------------------------------------
+    // STEP 1-2: Discover the platforms and pick the device
+    //-----------------------------------------------------
+    // Every platform and device is enumerated and the one matching config->device is used, so the same binary runs on GPU-less nodes through a CPU OpenCL implementation
+    status = cl_device_select(config->device, &engine->platform, &engine->device);
+    if(status != CL_SUCCESS)
+        return status;
+
+    // CPU and integrated devices share the host memory, copying to them only duplicates the matrices
+    cl_bool unified = CL_FALSE;
+    if(clGetDeviceInfo(engine->device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL) != CL_SUCCESS)
+        unified = CL_FALSE;
+    engine->zero_copy = (config->zero_copy < 0) ? (unified == CL_TRUE) : config->zero_copy;
+
+    //-----------------------------------------------------
+    // STEP 3: Create a context
+    //-----------------------------------------------------
+    // Create a context using clCreateContext() and
+    // associate it with the devices
+    engine->context = clCreateContext(
+        NULL,
+        1,
+        &engine->device,
+        NULL,
+        NULL,
+        &status);
+
+    if(status != CL_SUCCESS){
+        printf("error in step 3\n");
+        return status;
+    }
+
+    //-----------------------------------------------------
+    // STEP 4: Create a command queue
+    //-----------------------------------------------------
+    // Create a command queue using clCreateCommandQueue(),
+    // and associate it with the device you want to execute
+    // on
+    engine->queue = clCreateCommandQueue(
+        engine->context,
+        engine->device,
+        config->profiling ? CL_QUEUE_PROFILING_ENABLE : 0,
+        &status);
+
+    if(status != CL_SUCCESS){
+        printf("error in step 4\n");
+        return status;
+    }
+
+    // The pipelined multiply spreads its panels over extra in-order queues, with profiling on to measure how much the transfers and kernels overlapped
+    int q;
+    for(q=0; q<config->queues; q++){
+        engine->pipeline_queues[q] = clCreateCommandQueue(
+            engine->context,
+            engine->device,
+            CL_QUEUE_PROFILING_ENABLE,
+            &status);
+
+        if(status != CL_SUCCESS){
+            printf("error in step 4, creating pipeline queue %d\n", q);
+            return status;
+        }
+    }
+
+    // Buffers (STEP 5) are created lazily by the first multiply, once the problem size is known
+    engine->time_init = omp_get_wtime() - time_start;
+    time_start = omp_get_wtime();
+
+    //-----------------------------------------------------
+    // STEP 6: Create and compile the program
+    //-----------------------------------------------------
+    size_t mulSize;
+    char *mulBuffer = read_source(config->kernel_file, &mulSize);
+    if(mulBuffer == NULL)
+        return CL_INVALID_VALUE;
+
+    // The built program is looked up in the on-disk binary cache first, so only the first run on a given device pays for the JIT compilation
+    // The tile shape of mul_kernel_tiled is baked in at compile time, which also makes it part of the cache key
+    char options[128];
+    snprintf(options, sizeof(options), "-cl-std=CL1.2 -DTS=%d -DWPT=%d -DREFINE_SLICES=%d -DREFINE_PANEL=%d",
+             config->tile_size, config->rows_per_item, REFINE_SLICES, REFINE_PANEL);
+    engine->program = cl_cache_build_program(
+        engine->context,
+        engine->platform,
+        engine->device,
+        mulBuffer,
+        mulSize,
+        options,
+        &engine->program_cached,
+        &status);
+    free(mulBuffer);
+
+    if(status != CL_SUCCESS){
+        printf("error in step 6: %s\n", getErrorString(status));
+        return status;
+    }
+
+    //-----------------------------------------------------
+    // STEP 7: Create the kernel
+    //-----------------------------------------------------
+    // The kernels using doubles are only in the program when the device has fp64 (cl_khr_fp64), without it only the float and refine kernels are there
+    cl_device_fp_config fp64_config = 0;
+    if(clGetDeviceInfo(engine->device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64_config), &fp64_config, NULL) != CL_SUCCESS)
+        fp64_config = 0;
+    engine->fp64 = (fp64_config != 0);
+
+    // Use clCreateKernel() to create a kernel from the
+    if(engine->fp64){
+        engine->mul_kernel = clCreateKernel(engine->program, "mul_kernel", &status);
+        if(status != CL_SUCCESS){
+            printf("error in step 7\n");
+            return status;
+        }
+        engine->tiled_kernel = clCreateKernel(engine->program, "mul_kernel_tiled", &status);
+        if(status != CL_SUCCESS){
+            printf("error in step 7, creating mul_kernel_tiled\n");
+            return status;
+        }
+        engine->batched_kernel = clCreateKernel(engine->program, "mul_kernel_batched", &status);
+        if(status != CL_SUCCESS){
+            printf("error in step 7, creating mul_kernel_batched\n");
+            return status;
+        }
+        engine->batched_local_kernel = clCreateKernel(engine->program, "mul_kernel_batched_local", &status);
+        if(status != CL_SUCCESS){
+            printf("error in step 7, creating mul_kernel_batched_local\n");
+            return status;
+        }
+    }
+    const char *precision_kernel_names[] = { NULL, "mul_kernel_float", "mul_kernel_mixed", "mul_kernel_refine" };
+    int p;
+    for(p=PREC_FLOAT; p<=PREC_REFINE; p++){
+        // Only the mixed kernel sums in double
+        if(p == PREC_MIXED && !engine->fp64)
+            continue;
+        engine->precision_kernels[p] = clCreateKernel(engine->program, precision_kernel_names[p], &status);
+        if(status != CL_SUCCESS){
+            printf("error in step 7, creating %s\n", precision_kernel_names[p]);
+            return status;
+        }
+    }
+
+    engine->time_compile = omp_get_wtime() - time_start;
+    return CL_SUCCESS;
+}
+
+
+/*****************************************************
+ CL_SUCCESS when the device of the engine does double
+ precision, which every multiply but the float one
+ needs, an error otherwise
+ ****************************************************/
+cl_int cl_engine_require_fp64(const cl_engine *engine){
+    if(engine->fp64)
+        return CL_SUCCESS;
+    printf("the device has no double precision (cl_khr_fp64), only --precision float runs on it\n");
+    return CL_INVALID_OPERATION;
+}
+
+
+/*****************************************************
+ Sets the kernel arguments and enqueues the selected
+ kernel over the whole size x size result
+ ****************************************************/
+static cl_int enqueue_kernel(cl_engine *engine, cl_int size, cl_int local_size,
+                             cl_mem in1, cl_mem in2, cl_mem out, cl_event *done){
+    cl_kernel kernel = (engine->config.kernel == CL_KERNEL_TILED) ? engine->tiled_kernel : engine->mul_kernel;
+    cl_int status;
+
+    //-----------------------------------------------------
+    // STEP 8: Set the kernel arguments
+    //-----------------------------------------------------
+    // Associate the input and output buffers with the
+    // kernel
+    // using clSetKernelArg()
+    status  = clSetKernelArg(
+        kernel,
+        0,
+        sizeof(cl_mem),
+        &in1);
+    status |= clSetKernelArg(
+        kernel,
+        1,
+        sizeof(cl_mem),
+        &in2);
+    status |= clSetKernelArg(
+        kernel,
+        2,
+        sizeof(cl_mem),
+        &out);
+    status |= clSetKernelArg(
+        kernel,
+        3,
+        sizeof(cl_int),
+        &size);
+
+    if(status != CL_SUCCESS){
+        printf("error in step 8\n");
+        return status;
+    }
+
+    //-----------------------------------------------------
+    // STEP 9: Configure the work-item structure
+    //-----------------------------------------------------
+    // Define an index space (global work size) of work
+    // items for
+    // execution. A workgroup size (local work size) is not
+    // required,
+    // but can be used.
+    size_t globalWorkSize[2];
+    size_t localWorkSize[2];
+    cl_uint workDim;
+
+    if(engine->config.kernel == CL_KERNEL_TILED){
+        // One work-group per TS x TS tile of the result, rounded up so sizes that are not a multiple of the tile are covered too
+        size_t tiles = (size + engine->config.tile_size - 1) / engine->config.tile_size;
+        workDim = 2;
+        localWorkSize[0] = engine->config.tile_size;
+        localWorkSize[1] = engine->config.tile_size / engine->config.rows_per_item;
+        globalWorkSize[0] = tiles * localWorkSize[0];
+        globalWorkSize[1] = tiles * localWorkSize[1];
+    }else{
+        workDim = 1;
+        globalWorkSize[0] = (size_t)size*size;
+        localWorkSize[0] = local_size;
+    }
+
+    status = clEnqueueNDRangeKernel(
+        engine->queue,
+        kernel,
+        workDim,
+        NULL,
+        globalWorkSize,
+        localWorkSize,
+        0,
+        NULL,
+        done);
+
+    if(status != CL_SUCCESS)
+        printf("error in clEnqueueNDRangeKernel: %s\n", getErrorString(status));
+    return status;
+}
+
+
+/*****************************************************
+ Zero-copy multiply: the device buffers wrap the host
+ matrices themselves (CL_MEM_USE_HOST_PTR), and a
+ map/unmap takes the place of every copy. On CPU and
+ integrated devices mapping only hands the pages over
+ ****************************************************/
+static cl_int mul_zero_copy(cl_engine *engine, cl_int size, cl_int local_size,
+                            const cl_double *matrix1_in, const cl_double *matrix2_in,
+                            cl_double *matrix_out, cl_engine_times *times){
+    cl_int status = CL_SUCCESS;
+    cl_event mulDone, events[3];
+    size_t bytes = (size_t)size*size*sizeof(cl_double);
+    double time_start = omp_get_wtime();
+    void *mapped;
+
+    // The wrapping buffers are tied to the host pointers, so they are only recreated when the caller passes different matrices
+    if(engine->host_in1 != matrix1_in || engine->host_in2 != matrix2_in
+       || engine->host_out != matrix_out || engine->host_bytes != bytes){
+        if(engine->zc_in1 != NULL) clReleaseMemObject(engine->zc_in1);
+        if(engine->zc_in2 != NULL) clReleaseMemObject(engine->zc_in2);
+        if(engine->zc_out != NULL) clReleaseMemObject(engine->zc_out);
+        engine->zc_in1 = engine->zc_in2 = engine->zc_out = NULL;
+        engine->host_in1 = engine->host_in2 = engine->host_out = NULL;
+
+        engine->zc_in1 = clCreateBuffer(engine->context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+            bytes, (void *)matrix1_in, &status);
+        if(status == CL_SUCCESS)
+            engine->zc_in2 = clCreateBuffer(engine->context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                bytes, (void *)matrix2_in, &status);
+        if(status == CL_SUCCESS)
+            engine->zc_out = clCreateBuffer(engine->context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
+                bytes, matrix_out, &status);
+        if(status != CL_SUCCESS){
+            printf("error in step 5, wrapping the host matrices: %s\n", getErrorString(status));
+            return status;
+        }
+        engine->host_in1 = matrix1_in;
+        engine->host_in2 = matrix2_in;
+        engine->host_out = matrix_out;
+        engine->host_bytes = bytes;
+    }
+
+    // The host may have rewritten the inputs since the last multiply, a write map/unmap hands their current content to the device.
+    // Invalidating the region keeps the map from bringing the device's stale copy back over them
+    cl_event *ev = engine->config.profiling ? events : NULL;
+    mapped = clEnqueueMapBuffer(engine->queue, engine->zc_in1, CL_FALSE, CL_MAP_WRITE_INVALIDATE_REGION, 0, bytes, 0, NULL, NULL, &status);
+    if(status == CL_SUCCESS)
+        status = clEnqueueUnmapMemObject(engine->queue, engine->zc_in1, mapped, 0, NULL, ev ? &ev[0] : NULL);
+    if(status == CL_SUCCESS)
+        mapped = clEnqueueMapBuffer(engine->queue, engine->zc_in2, CL_FALSE, CL_MAP_WRITE_INVALIDATE_REGION, 0, bytes, 0, NULL, NULL, &status);
+    if(status == CL_SUCCESS)
+        status = clEnqueueUnmapMemObject(engine->queue, engine->zc_in2, mapped, 0, NULL, ev ? &ev[1] : NULL);
+    if(status != CL_SUCCESS){
+        printf("error in step 5, mapping the inputs: %s\n", getErrorString(status));
+        return status;
+    }
+    clFinish(engine->queue);
+    if(ev){
+        cl_profile_add(&engine->profile, ev[0], "unmap", 0, 0, 0);
+        cl_profile_add(&engine->profile, ev[1], "unmap", 0, 0, 0);
+        clReleaseEvent(ev[0]);
+        clReleaseEvent(ev[1]);
+    }
+    times->copy = omp_get_wtime() - time_start;
+    time_start = omp_get_wtime();
+
+    status = enqueue_kernel(engine, size, local_size, engine->zc_in1, engine->zc_in2, engine->zc_out, &mulDone);
+    if(status != CL_SUCCESS)
+        return status;
+
+    // Mapping the result for reading makes it visible in matrix_out, which CL_MEM_USE_HOST_PTR makes the mapped pointer
+    mapped = clEnqueueMapBuffer(engine->queue, engine->zc_out, CL_TRUE, CL_MAP_READ, 0, bytes, 1, &mulDone, ev ? &ev[2] : NULL, &status);
+    if(ev && status == CL_SUCCESS){
+        cl_profile_add(&engine->profile, mulDone, "kernel", 0, 0, 2.0*size*size*(double)size);
+        cl_profile_add(&engine->profile, ev[2], "map", 0, 0, 0);
+        clReleaseEvent(ev[2]);
+    }
+    clReleaseEvent(mulDone);
+    if(status != CL_SUCCESS){
+        printf("error in reading data\n");
+        return status;
+    }
+    clEnqueueUnmapMemObject(engine->queue, engine->zc_out, mapped, 0, NULL, NULL);
+    clFinish(engine->queue);
+
+    times->kernel = omp_get_wtime() - time_start;
+    times->total = times->copy + times->kernel;
+    times->overlap = 0.0;
+    return CL_SUCCESS;
+}
+
+
+/*****************************************************
+ Page-aligned host allocation, which the zero-copy
+ mode needs to wrap a matrix without a hidden copy
+ ****************************************************/
+void *cl_engine_host_alloc(size_t bytes){
+    void *ptr = NULL;
+
+    if(posix_memalign(&ptr, CL_HOST_ALIGNMENT, bytes) != 0)
+        return NULL;
+    return ptr;
+}
+
+
+/*****************************************************
+ Multiplies two size x size matrices on the device,
+ reusing every object created by cl_engine_init
+ ****************************************************/
+cl_int cl_engine_mul(cl_engine *engine, cl_int size, cl_int local_size,
+                     const cl_double *matrix1_in, const cl_double *matrix2_in,
+                     cl_double *matrix_out, cl_engine_times *times){
+    cl_int status;
+    cl_event mulDone, events[3];
+    size_t bytes = (size_t)size*size*sizeof(cl_double);
+    double time_start;
+
+    status = cl_engine_require_fp64(engine);
+    if(status != CL_SUCCESS)
+        return status;
+
+    // Matrices that are not page aligned could only be wrapped through a copy, those go through the regular transfers
+    if(engine->zero_copy && (uintptr_t)matrix1_in % CL_HOST_ALIGNMENT == 0
+       && (uintptr_t)matrix2_in % CL_HOST_ALIGNMENT == 0 && (uintptr_t)matrix_out % CL_HOST_ALIGNMENT == 0)
+        return mul_zero_copy(engine, size, local_size, matrix1_in, matrix2_in, matrix_out, times);
+
+    time_start = omp_get_wtime();
+
+    //-----------------------------------------------------
+    // STEP 5: Create device buffers and copy data to buffers
+    //-----------------------------------------------------
+    status = cl_engine_buffers(engine, (size_t)size*size);
+    if(status != CL_SUCCESS)
+        return status;
+
+    // With profiling on, every command gets an event whose device timestamps are collected once the multiply is over
+    cl_event *ev = engine->config.profiling ? events : NULL;
+
+    status = clEnqueueWriteBuffer (
+        engine->queue,
+        engine->buffer_in1,
+        CL_FALSE,
+        0,
+        bytes,
+        matrix1_in,
+        0,
+        NULL,
+        ev ? &ev[0] : NULL);
+
+    status |= clEnqueueWriteBuffer (
+        engine->queue,
+        engine->buffer_in2,
+        CL_FALSE,
+        0,
+        bytes,
+        matrix2_in,
+        0,
+        NULL,
+        ev ? &ev[1] : NULL);
+
+    if(status != CL_SUCCESS){
+        printf("error in step 5, writing data\n");
+        return status;
+    }
+
+    // The writes are waited for, so the copy time covers the transfers themselves and not only their enqueueing
+    clFinish(engine->queue);
+    times->copy = omp_get_wtime() - time_start;
+    time_start = omp_get_wtime();
+
+    status = enqueue_kernel(engine, size, local_size, engine->buffer_in1, engine->buffer_in2,
+                            engine->buffer_out, &mulDone);
+    if(status != CL_SUCCESS)
+        return status;
+
+    status = clEnqueueReadBuffer(
+        engine->queue,
+        engine->buffer_out,
+        CL_TRUE,
+        0,
+        bytes,
+        matrix_out,
+        1,
+        &mulDone,
+        ev ? &ev[2] : NULL);
+
+    if(ev && status == CL_SUCCESS){
+        cl_profile_add(&engine->profile, ev[0], "write", 0, bytes, 0);
+        cl_profile_add(&engine->profile, ev[1], "write", 0, bytes, 0);
+        cl_profile_add(&engine->profile, mulDone, "kernel", 0, 0, 2.0*size*size*(double)size);
+        cl_profile_add(&engine->profile, ev[2], "read", 0, bytes, 0);
+        clReleaseEvent(ev[0]);
+        clReleaseEvent(ev[1]);
+        clReleaseEvent(ev[2]);
+    }
+    clReleaseEvent(mulDone);
+
+    if(status != CL_SUCCESS){
+        printf("error in reading data\n");
+        return status;
+    }
+
+    times->kernel = omp_get_wtime() - time_start;
+    // Every stage waits for the previous one, so nothing overlaps here
+    times->total = times->copy + times->kernel;
+    times->overlap = 0.0;
+    return CL_SUCCESS;
+}
+
+
+/*****************************************************
+ Multiplies a batch of count independent size x size
+ products, stored one after the other in each array,
+ with a single kernel launch. When a whole product fits
+ a work-group its operands are staged in local memory
+ ****************************************************/
+cl_int cl_engine_mul_batched(cl_engine *engine, cl_int size, cl_int count,
+                             const cl_double *matrix1_in, const cl_double *matrix2_in,
+                             cl_double *matrix_out, cl_engine_times *times){
+    cl_int status;
+    cl_event mulDone;
+    size_t elems = (size_t)size*size;
+    size_t bytes = elems*count*sizeof(cl_double);
+    size_t group_limit = 0;
+    // Room for the sizes of every dimension the device may report, at least three
+    size_t item_limits[16] = { 0 };
+    cl_ulong local_bytes = 0;
+    double time_start = omp_get_wtime();
+
+    status = cl_engine_require_fp64(engine);
+    if(status != CL_SUCCESS)
+        return status;
+
+    //-----------------------------------------------------
+    // STEP 5: Create device buffers and copy data to buffers
+    //-----------------------------------------------------
+    status = cl_engine_buffers(engine, elems*count);
+    if(status != CL_SUCCESS)
+        return status;
+
+    status = clEnqueueWriteBuffer(engine->queue, engine->buffer_in1, CL_FALSE, 0, bytes, matrix1_in, 0, NULL, NULL);
+    status |= clEnqueueWriteBuffer(engine->queue, engine->buffer_in2, CL_FALSE, 0, bytes, matrix2_in, 0, NULL, NULL);
+    if(status != CL_SUCCESS){
+        printf("error in step 5, writing data\n");
+        return status;
+    }
+    clFinish(engine->queue);
+    times->copy = omp_get_wtime() - time_start;
+    time_start = omp_get_wtime();
+
+    // The local-memory kernel needs a work-group of size*size work-items and room for both operands. The
+    // work-group is one-dimensional, so it is also bounded by the device's work-items along dimension 0
+    if(clGetKernelWorkGroupInfo(engine->batched_local_kernel, engine->device, CL_KERNEL_WORK_GROUP_SIZE,
+                                sizeof(group_limit), &group_limit, NULL) != CL_SUCCESS)
+        group_limit = 0;
+    if(clGetDeviceInfo(engine->device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(item_limits), item_limits, NULL) != CL_SUCCESS)
+        item_limits[0] = 0;
+    if(clGetDeviceInfo(engine->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_bytes), &local_bytes, NULL) != CL_SUCCESS)
+        local_bytes = 0;
+    int staged = (elems <= group_limit && elems <= item_limits[0] && 2*elems*sizeof(cl_double) <= local_bytes);
+    cl_kernel kernel = staged ? engine->batched_local_kernel : engine->batched_kernel;
+
+    //-----------------------------------------------------
+    // STEP 8: Set the kernel arguments
+    //-----------------------------------------------------
+    status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &engine->buffer_in1);
+    status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &engine->buffer_in2);
+    status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &engine->buffer_out);
+    status |= clSetKernelArg(kernel, 3, sizeof(cl_int), &size);
+    status |= clSetKernelArg(kernel, 4, sizeof(cl_int), &count);
+    if(staged){
+        status |= clSetKernelArg(kernel, 5, elems*sizeof(cl_double), NULL);
+        status |= clSetKernelArg(kernel, 6, elems*sizeof(cl_double), NULL);
+    }
+    if(status != CL_SUCCESS){
+        printf("error in step 8\n");
+        return status;
+    }
+
+    //-----------------------------------------------------
+    // STEP 9: Configure the work-item structure
+    //-----------------------------------------------------
+    // One row of the 2D index space per product, the whole batch going out in one launch
+    size_t globalWorkSize[2] = { elems, (size_t)count };
+    size_t localWorkSize[2] = { elems, 1 };
+
+    status = clEnqueueNDRangeKernel(
+        engine->queue,
+        kernel,
+        2,
+        NULL,
+        globalWorkSize,
+        staged ? localWorkSize : NULL,
+        0,
+        NULL,
+        &mulDone);
+    if(status != CL_SUCCESS){
+        printf("error in clEnqueueNDRangeKernel: %s\n", getErrorString(status));
+        return status;
+    }
+
+    status = clEnqueueReadBuffer(engine->queue, engine->buffer_out, CL_TRUE, 0, bytes, matrix_out, 1, &mulDone, NULL);
+    if(engine->config.profiling && status == CL_SUCCESS)
+        cl_profile_add(&engine->profile, mulDone, "batched", 0, 0, 2.0*elems*size*count);
+    clReleaseEvent(mulDone);
+    if(status != CL_SUCCESS){
+        printf("error in reading data\n");
+        return status;
+    }
+
+    times->kernel = omp_get_wtime() - time_start;
+    times->total = times->copy + times->kernel;
+    times->overlap = 0.0;
+    return CL_SUCCESS;
+}
+
+
+/*****************************************************
+ Multiplies two size x size matrices in the given
+ precision. The operands are rounded to float on the
+ host and sent in half the bytes, or cut in the
+ REFINE_SLICES float slices of refine. A float result
+ comes back as floats and is widened on the host, the
+ one of refine as a head and a tail of floats the host
+ adds up in double
+ ****************************************************/
+cl_int cl_engine_mul_precision(cl_engine *engine, cl_int size, cl_int local_size, int precision,
+                               const cl_double *matrix1_in, const cl_double *matrix2_in,
+                               cl_double *matrix_out, cl_engine_times *times){
+    cl_int status;
+    cl_event mulDone;
+    cl_kernel kernel;
+    size_t elems = (size_t)size*size;
+    int parts = (precision == PREC_REFINE) ? REFINE_SLICES : 1;
+    size_t in_bytes = parts*elems*sizeof(cl_float);
+    // mixed returns doubles, refine a head and a tail of floats (as many bytes) and float a float each
+    size_t out_bytes = elems*((precision == PREC_FLOAT) ? sizeof(cl_float) : sizeof(cl_double));
+    int float_result = (precision != PREC_MIXED);
+    double time_start = omp_get_wtime();
+    cl_float *host;
+    size_t i;
+
+    if(precision == PREC_DOUBLE)
+        return cl_engine_mul(engine, size, local_size, matrix1_in, matrix2_in, matrix_out, times);
+    if(precision == PREC_MIXED){
+        status = cl_engine_require_fp64(engine);
+        if(status != CL_SUCCESS)
+            return status;
+    }
+    kernel = engine->precision_kernels[precision];
+
+    //-----------------------------------------------------
+    // STEP 5: Create device buffers and copy data to buffers
+    //-----------------------------------------------------
+    // The buffers hold doubles, two floats each: size*size of them for the results, and room for the slices of refine
+    status = cl_engine_buffers(engine, (parts*elems + 1)/2 > elems ? (parts*elems + 1)/2 : elems);
+    if(status != CL_SUCCESS)
+        return status;
+
+    host = (cl_float *)malloc(2*in_bytes);
+    if(host == NULL){
+        printf("can't allocate the float copies of the operands\n");
+        return CL_OUT_OF_HOST_MEMORY;
+    }
+    if(precision == PREC_REFINE){
+        // Slices scaled by the rows of A and the columns of B
+        precision_slices(matrix1_in, size, size, size, 1, host);
+        precision_slices(matrix2_in, size, size, size, 0, host + parts*elems);
+    }else{
+        precision_split(matrix1_in, size, size, size, host, NULL);
+        precision_split(matrix2_in, size, size, size, host + elems, NULL);
+    }
+
+    status = clEnqueueWriteBuffer(engine->queue, engine->buffer_in1, CL_FALSE, 0, in_bytes, host, 0, NULL, NULL);
+    status |= clEnqueueWriteBuffer(engine->queue, engine->buffer_in2, CL_FALSE, 0, in_bytes, host + parts*elems, 0, NULL, NULL);
+    if(status != CL_SUCCESS){
+        printf("error in step 5, writing data\n");
+        free(host);
+        return status;
+    }
+    clFinish(engine->queue);
+    times->copy = omp_get_wtime() - time_start;
+    time_start = omp_get_wtime();
+
+    //-----------------------------------------------------
+    // STEP 8: Set the kernel arguments
+    //-----------------------------------------------------
+    status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &engine->buffer_in1);
+    status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &engine->buffer_in2);
+    status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &engine->buffer_out);
+    status |= clSetKernelArg(kernel, 3, sizeof(cl_int), &size);
+    if(status != CL_SUCCESS){
+        printf("error in step 8\n");
+        free(host);
+        return status;
+    }
+
+    //-----------------------------------------------------
+    // STEP 9: Configure the work-item structure
+    //-----------------------------------------------------
+    // One work-item per entry of the result, as for mul_kernel
+    size_t globalWorkSize[1] = { elems };
+    size_t localWorkSize[1] = { (size_t)local_size };
+
+    status = clEnqueueNDRangeKernel(engine->queue, kernel, 1, NULL, globalWorkSize, localWorkSize, 0, NULL, &mulDone);
+    if(status != CL_SUCCESS){
+        printf("error in clEnqueueNDRangeKernel: %s\n", getErrorString(status));
+        free(host);
+        return status;
+    }
+
+    // A float result is read into the host copy of the operands, which is no longer needed, and widened into matrix_out
+    status = clEnqueueReadBuffer(engine->queue, engine->buffer_out, CL_TRUE, 0, out_bytes,
+                                 float_result ? (void *)host : (void *)matrix_out, 1, &mulDone, NULL);
+    if(engine->config.profiling && status == CL_SUCCESS)
+        cl_profile_add(&engine->profile, mulDone, "kernel", 0, 0, 2.0*elems*size);
+    clReleaseEvent(mulDone);
+    if(status != CL_SUCCESS){
+        printf("error in reading data\n");
+        free(host);
+        return status;
+    }
+    if(precision == PREC_FLOAT)
+        for(i=0; i<elems; i++)
+            matrix_out[i] = host[i];
+    else if(precision == PREC_REFINE)
+        for(i=0; i<elems; i++)
+            matrix_out[i] = (double)host[i] + (double)host[elems + i];
+    free(host);
+
+    times->kernel = omp_get_wtime() - time_start;
+    times->total = times->copy + times->kernel;
+    times->overlap = 0.0;
+    return CL_SUCCESS;
+}
+
+
+/*****************************************************
+ Releases everything owned by the engine
+ ****************************************************/
+void cl_engine_release(cl_engine *engine){
+    //-----------------------------------------------------
+    // STEP 10: Release OpenCL resources
+    //-----------------------------------------------------
+    if(engine->mul_kernel != NULL) clReleaseKernel(engine->mul_kernel);
+    if(engine->tiled_kernel != NULL) clReleaseKernel(engine->tiled_kernel);
+    if(engine->batched_kernel != NULL) clReleaseKernel(engine->batched_kernel);
+    if(engine->batched_local_kernel != NULL) clReleaseKernel(engine->batched_local_kernel);
+    int p;
+    for(p=0; p<4; p++)
+        if(engine->precision_kernels[p] != NULL) clReleaseKernel(engine->precision_kernels[p]);
+    if(engine->program != NULL) clReleaseProgram(engine->program);
+    if(engine->queue != NULL) clReleaseCommandQueue(engine->queue);
+    int q;
+    for(q=0; q<CL_MAX_QUEUES; q++)
+        if(engine->pipeline_queues[q] != NULL) clReleaseCommandQueue(engine->pipeline_queues[q]);
+    if(engine->buffer_in1 != NULL) clReleaseMemObject(engine->buffer_in1);
+    if(engine->buffer_in2 != NULL) clReleaseMemObject(engine->buffer_in2);
+    if(engine->buffer_out != NULL) clReleaseMemObject(engine->buffer_out);
+    if(engine->zc_in1 != NULL) clReleaseMemObject(engine->zc_in1);
+    if(engine->zc_in2 != NULL) clReleaseMemObject(engine->zc_in2);
+    if(engine->zc_out != NULL) clReleaseMemObject(engine->zc_out);
+    if(engine->context != NULL) clReleaseContext(engine->context);
+    cl_profile_free(&engine->profile);
+    memset(engine, 0, sizeof(*engine));
+}
@@ -0,0 +1,377 @@
+#include <pthread.h>
+#include "matrix_cl.h"
+#include "../common/matrix_view.h"
+#include "../OpenMP/matrix_blocked.h"
+
+// Chunks a device has enqueued at once, so the next one is already queued when one finishes
+#define HYBRID_INFLIGHT 2
+
+/*** TYPEDEFS AND STRUCTS***/
+// State shared by the workers of one multiply. Worker w still owns the chunks [head[w], tail[w]),
+// it takes them from the head and thieves take them from the tail, both under the lock. Its share
+// started at first[w], and redo holds the redo_count chunks a failing device handed back
+typedef struct {
+    cl_hybrid *hybrid;
+    pthread_mutex_t lock;
+    int first[1 + CL_HYBRID_MAX_DEVICES];
+    int head[1 + CL_HYBRID_MAX_DEVICES];
+    int tail[1 + CL_HYBRID_MAX_DEVICES];
+    int *redo;
+    int redo_count;
+    int chunks;
+    cl_int size, local_size;
+    const cl_double *matrix1_in, *matrix2_in;
+    cl_double *matrix_out;
+    double time_start;
+} hybrid_run;
+
+// A device worker: its engine, the run it belongs to and how it ended
+typedef struct {
+    hybrid_run *run;
+    cl_engine *engine;
+    int worker;
+    cl_int status;
+    pthread_t thread;
+} hybrid_device;
+
+
+/*****************************************************
+ Chunk size from MATRIX_HYBRID_CHUNK, or the default
+ ****************************************************/
+static int hybrid_chunk_rows(void){
+    const char *value = getenv("MATRIX_HYBRID_CHUNK");
+    int rows = (value != NULL) ? atoi(value) : 0;
+    return (rows > 0) ? rows : CL_HYBRID_CHUNK;
+}
+
+void cl_hybrid_init(cl_hybrid *hybrid, int devices){
+    memset(hybrid, 0, sizeof(*hybrid));
+    hybrid->workers = 1 + devices;
+    hybrid->chunk_rows = hybrid_chunk_rows();
+}
+
+
+/*****************************************************
+ Next chunk of worker w: the head of its own share, a
+ chunk handed back by a failing device, or else the
+ tail of the largest share still left, -1 once every
+ chunk is taken
+ ****************************************************/
+static int hybrid_claim(hybrid_run *run, int w){
+    int chunk = -1, victim = -1, left = 0, v;
+
+    pthread_mutex_lock(&run->lock);
+    if(run->head[w] < run->tail[w]){
+        chunk = run->head[w]++;
+    }else if(run->redo_count > 0){
+        chunk = run->redo[--run->redo_count];
+        run->hybrid->stolen[w]++;
+    }else{
+        for(v=0; v<run->hybrid->workers; v++){
+            if(run->tail[v] - run->head[v] > left){
+                left = run->tail[v] - run->head[v];
+                victim = v;
+            }
+        }
+        if(victim >= 0){
+            chunk = --run->tail[victim];
+            run->hybrid->stolen[w]++;
+        }
+    }
+    if(chunk >= 0)
+        run->hybrid->done[w]++;
+    pthread_mutex_unlock(&run->lock);
+    return chunk;
+}
+
+/*****************************************************
+ Hands a chunk worker w claimed but could not complete
+ back to the others, no longer counted as done by w
+ ****************************************************/
+static void hybrid_release(hybrid_run *run, int w, int chunk){
+    pthread_mutex_lock(&run->lock);
+    run->redo[run->redo_count++] = chunk;
+    run->hybrid->done[w]--;
+    if(chunk < run->first[w] || chunk >= run->first[w] + run->hybrid->owned[w])
+        run->hybrid->stolen[w]--;
+    pthread_mutex_unlock(&run->lock);
+}
+
+static void chunk_rows(const hybrid_run *run, int chunk, size_t *row0, size_t *rows){
+    *row0 = (size_t)chunk*run->hybrid->chunk_rows;
+    *rows = (*row0 + run->hybrid->chunk_rows > (size_t)run->size) ? run->size - *row0 : (size_t)run->hybrid->chunk_rows;
+}
+
+
+/*****************************************************
+ Enqueues one chunk on the device: upload of its rows
+ of A, the kernel over its rows through a global work
+ offset, and the readback of its rows of C, whose
+ event is returned in done
+ ****************************************************/
+static cl_int device_enqueue(hybrid_run *run, cl_engine *engine, cl_kernel kernel, int chunk, cl_event *done){
+    int tiled = (engine->config.kernel == CL_KERNEL_TILED);
+    cl_int size = run->size;
+    size_t row0, rows;
+    size_t globalOffset[2], globalWorkSize[2], localWorkSize[2];
+    cl_uint workDim;
+    cl_int status;
+
+    chunk_rows(run, chunk, &row0, &rows);
+    status = clEnqueueWriteBuffer(engine->queue, engine->buffer_in1, CL_FALSE, row0*size*sizeof(cl_double),
+        rows*size*sizeof(cl_double), run->matrix1_in + row0*size, 0, NULL, NULL);
+    if(status != CL_SUCCESS){
+        printf("error in step 5, writing chunk %d\n", chunk);
+        return status;
+    }
+
+    if(tiled){
+        size_t tiles_n = (size + engine->config.tile_size - 1) / engine->config.tile_size;
+        size_t tiles_m = (rows + engine->config.tile_size - 1) / engine->config.tile_size;
+        size_t item_rows = engine->config.tile_size / engine->config.rows_per_item;
+        workDim = 2;
+        localWorkSize[0] = engine->config.tile_size;
+        localWorkSize[1] = item_rows;
+        globalWorkSize[0] = tiles_n * localWorkSize[0];
+        globalWorkSize[1] = tiles_m * item_rows;
+        globalOffset[0] = 0;
+        globalOffset[1] = row0 / engine->config.tile_size * item_rows;
+    }else{
+        workDim = 1;
+        globalWorkSize[0] = rows*size;
+        globalOffset[0] = row0*size;
+        localWorkSize[0] = run->local_size;
+    }
+    status = clEnqueueNDRangeKernel(engine->queue, kernel, workDim, globalOffset, globalWorkSize,
+        (!tiled && globalWorkSize[0] % run->local_size != 0) ? NULL : localWorkSize, 0, NULL, NULL);
+    if(status != CL_SUCCESS){
+        printf("error in clEnqueueNDRangeKernel for chunk %d: %s\n", chunk, getErrorString(status));
+        return status;
+    }
+
+    status = clEnqueueReadBuffer(engine->queue, engine->buffer_out, CL_FALSE, row0*size*sizeof(cl_double),
+        rows*size*sizeof(cl_double), run->matrix_out + row0*size, 0, NULL, done);
+    if(status != CL_SUCCESS){
+        printf("error in reading chunk %d\n", chunk);
+        return status;
+    }
+    // Flushing right away lets the device start on this chunk while the next one is being enqueued
+    clFlush(engine->queue);
+    return CL_SUCCESS;
+}
+
+
+/*****************************************************
+ Device worker: uploads B once, then keeps up to
+ HYBRID_INFLIGHT chunks enqueued on the in-order queue
+ of its engine until no chunk is left. A device that
+ fails stops claiming: the chunks of its share are
+ stolen by the others, and the ones it claimed but
+ did not complete are handed back to them
+ ****************************************************/
+static void *device_run(void *context){
+    hybrid_device *d = (hybrid_device *)context;
+    hybrid_run *run = d->run;
+    cl_engine *engine = d->engine;
+    cl_kernel kernel = (engine->config.kernel == CL_KERNEL_TILED) ? engine->tiled_kernel : engine->mul_kernel;
+    cl_int size = run->size;
+    cl_event inflight[HYBRID_INFLIGHT];
+    int inflight_chunk[HYBRID_INFLIGHT];
+    int count = 0, i, chunk;
+
+    d->status = cl_engine_buffers(engine, (size_t)size*size);
+    if(d->status != CL_SUCCESS)
+        return NULL;
+    d->status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &engine->buffer_in1);
+    d->status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &engine->buffer_in2);
+    d->status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &engine->buffer_out);
+    d->status |= clSetKernelArg(kernel, 3, sizeof(cl_int), &size);
+    if(d->status != CL_SUCCESS){
+        printf("error in step 8\n");
+        return NULL;
+    }
+    // Every chunk needs all of B
+    d->status = clEnqueueWriteBuffer(engine->queue, engine->buffer_in2, CL_FALSE, 0,
+        (size_t)size*size*sizeof(cl_double), run->matrix2_in, 0, NULL, NULL);
+    if(d->status != CL_SUCCESS){
+        printf("error in step 5, writing data\n");
+        return NULL;
+    }
+
+    for(;;){
+        while(count < HYBRID_INFLIGHT && (chunk = hybrid_claim(run, d->worker)) >= 0){
+            d->status = device_enqueue(run, engine, kernel, chunk, &inflight[count]);
+            if(d->status != CL_SUCCESS){
+                hybrid_release(run, d->worker, chunk);
+                break;
+            }
+            inflight_chunk[count++] = chunk;
+        }
+        if(count == 0 || d->status != CL_SUCCESS)
+            break;
+        // The queue is in order, the oldest chunk finishes first
+        d->status = clWaitForEvents(1, &inflight[0]);
+        if(d->status != CL_SUCCESS){
+            printf("error in chunk %d: %s\n", inflight_chunk[0], getErrorString(d->status));
+            break;
+        }
+        clReleaseEvent(inflight[0]);
+        for(i=1; i<count; i++){
+            inflight[i-1] = inflight[i];
+            inflight_chunk[i-1] = inflight_chunk[i];
+        }
+        count--;
+        run->hybrid->busy[d->worker] = omp_get_wtime() - run->time_start;
+    }
+
+    // After a failure the chunks still in flight may not have completed, those are handed back
+    clFinish(engine->queue);
+    for(i=0; i<count; i++){
+        if(clWaitForEvents(1, &inflight[i]) != CL_SUCCESS)
+            hybrid_release(run, d->worker, inflight_chunk[i]);
+        clReleaseEvent(inflight[i]);
+    }
+    return NULL;
+}
+
+
+/*****************************************************
+ Host worker: runs the chunks it claims on the blocked
+ kernel with every OpenMP thread
+ ****************************************************/
+static void host_run(hybrid_run *run, const gemm_view *g){
+    int chunk;
+
+    while((chunk = hybrid_claim(run, 0)) >= 0){
+        size_t row0, rows;
+        gemm_view block;
+        chunk_rows(run, chunk, &row0, &rows);
+        gemm_view_block(g, row0, 0, 0, rows, run->size, run->size, &block);
+        matrix_gemm_blk(&block);
+        run->hybrid->busy[0] = omp_get_wtime() - run->time_start;
+    }
+}
+
+
+/*****************************************************
+ Multiplies two size x size matrices with the host
+ threads and the devices of engines at the same time.
+ The shares come from the rates of the previous call
+ (even shares the first time), stealing evens out
+ what they got wrong, and the rates measured here set
+ the shares of the next call. A failing device only
+ slows the multiply down: the host completes whatever
+ it left, so every chunk is done on success
+ ****************************************************/
+cl_int cl_hybrid_mul(cl_hybrid *hybrid, cl_engine *const *engines, cl_int size, cl_int local_size,
+                     const cl_double *matrix1_in, const cl_double *matrix2_in,
+                     cl_double *matrix_out){
+    hybrid_device devices[CL_HYBRID_MAX_DEVICES];
+    hybrid_run run;
+    gemm_view g;
+    double rate_sum = 0, share = 0;
+    cl_int status = CL_SUCCESS;
+    int measured = 1, w, d;
+
+    for(d=0; d<hybrid->workers-1; d++){
+        status = cl_engine_require_fp64(engines[d]);
+        if(status != CL_SUCCESS)
+            return status;
+    }
+
+    // The tiled kernel covers whole tiles of rows
+    if(engines[0]->config.kernel == CL_KERNEL_TILED)
+        hybrid->chunk_rows = (hybrid->chunk_rows + engines[0]->config.tile_size - 1) / engines[0]->config.tile_size * engines[0]->config.tile_size;
+
+    memset(&run, 0, sizeof(run));
+    run.hybrid = hybrid;
+    run.chunks = (size + hybrid->chunk_rows - 1) / hybrid->chunk_rows;
+    run.size = size;
+    run.local_size = local_size;
+    run.matrix1_in = matrix1_in;
+    run.matrix2_in = matrix2_in;
+    run.matrix_out = matrix_out;
+    // A chunk is handed back at most once before someone claims it again
+    run.redo = (int *)malloc(sizeof(int)*run.chunks);
+    if(run.redo == NULL){
+        printf("can't allocate the chunk list of the hybrid multiply\n");
+        return CL_OUT_OF_HOST_MEMORY;
+    }
+    pthread_mutex_init(&run.lock, NULL);
+
+    // Contiguous shares in proportion to the measured rates, even ones until every worker was measured
+    for(w=0; w<hybrid->workers; w++){
+        rate_sum += hybrid->rates[w];
+        measured = measured && (hybrid->rates[w] > 0);
+    }
+    for(w=0; w<hybrid->workers; w++){
+        share += measured ? hybrid->rates[w] / rate_sum : 1.0 / hybrid->workers;
+        run.head[w] = run.first[w] = (w == 0) ? 0 : run.tail[w-1];
+        run.tail[w] = (w == hybrid->workers - 1) ? run.chunks : (int)(share*run.chunks + 0.5);
+        if(run.tail[w] < run.head[w])
+            run.tail[w] = run.head[w];
+        hybrid->owned[w] = run.tail[w] - run.head[w];
+        hybrid->done[w] = hybrid->stolen[w] = 0;
+        hybrid->busy[w] = 0;
+    }
+
+    run.time_start = omp_get_wtime();
+    for(d=0; d<hybrid->workers-1; d++){
+        devices[d].run = &run;
+        devices[d].engine = engines[d];
+        devices[d].worker = 1 + d;
+        devices[d].status = CL_SUCCESS;
+        if(pthread_create(&devices[d].thread, NULL, device_run, &devices[d]) != 0){
+            printf("can't start the thread of device %d, its share goes to the others\n", d);
+            devices[d].status = CL_OUT_OF_HOST_MEMORY;
+            devices[d].thread = pthread_self();
+        }
+    }
+
+    // The host is worker 0. Once the devices are done it also completes the chunks a failing one handed back late
+    gemm_view_square(&g, size, matrix1_in, matrix2_in, matrix_out);
+    host_run(&run, &g);
+    for(d=0; d<hybrid->workers-1; d++){
+        if(pthread_equal(devices[d].thread, pthread_self()))
+            continue;
+        pthread_join(devices[d].thread, NULL);
+        if(devices[d].status != CL_SUCCESS)
+            printf("device %d failed, the others completed its chunks\n", d);
+    }
+    host_run(&run, &g);
+    hybrid->total = omp_get_wtime() - run.time_start;
+    pthread_mutex_destroy(&run.lock);
+    free(run.redo);
+
+    // Only a worker with enough chunks to time gets a new rate, the others keep theirs
+    for(w=0; w<hybrid->workers; w++)
+        if(hybrid->done[w] > 0 && hybrid->busy[w] > 0)
+            hybrid->rates[w] = (double)hybrid->done[w]*hybrid->chunk_rows / hybrid->busy[w];
+    return status;
+}
+
+
+/*****************************************************
+ Share, stolen chunks and rate of every worker in the
+ last multiply, and the combined rate
+ ****************************************************/
+void cl_hybrid_report(const cl_hybrid *hybrid, cl_engine *const *engines, cl_int size){
+    double flops_per_row = 2.0*size*(double)size;
+    int chunks = 0, w;
+
+    for(w=0; w<hybrid->workers; w++)
+        chunks += hybrid->done[w];
+    printf("HYBRID EXECUTION OVER %d CHUNKS OF %d ROWS: %f (sec), %.2f GFLOP/s combined\n",
+           chunks, hybrid->chunk_rows, hybrid->total, flops_per_row*size/hybrid->total*1e-9);
+    for(w=0; w<hybrid->workers; w++){
+        char name[128] = "host threads";
+        if(w > 0){
+            char device[96] = "";
+            clGetDeviceInfo(engines[w-1]->device, CL_DEVICE_NAME, sizeof(device), device, NULL);
+            snprintf(name, sizeof(name), "device %d (%s)", w-1, device);
+        }
+        printf("  %s: %d chunks (%.1f%% of the rows), %d of a share of %d and %d stolen from the others, %.2f GFLOP/s\n",
+               name, hybrid->done[w], 100.0*hybrid->done[w]/chunks, hybrid->done[w] - hybrid->stolen[w],
+               hybrid->owned[w], hybrid->stolen[w], hybrid->rates[w]*flops_per_row*1e-9);
+    }
+}
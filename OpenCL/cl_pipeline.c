@@ -0,0 +1,212 @@
+#include "matrix_cl.h"
+
+/*** TYPEDEFS AND STRUCTS***/
+// Device-side execution interval of one command, in nanoseconds
+typedef struct {
+    cl_ulong start;
+    cl_ulong end;
+} interval;
+
+
+static int compare_intervals(const void *a, const void *b){
+    const interval *x = (const interval *)a, *y = (const interval *)b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/*****************************************************
+ Length of the union of the intervals, i.e. the time
+ during which at least one command was running
+ ****************************************************/
+static cl_ulong busy_union(interval *intervals, int count){
+    cl_ulong total = 0, start, end;
+    int i;
+
+    if(count == 0)
+        return 0;
+    qsort(intervals, count, sizeof(interval), compare_intervals);
+    start = intervals[0].start;
+    end = intervals[0].end;
+    for(i=1; i<count; i++){
+        if(intervals[i].start > end){
+            total += end - start;
+            start = intervals[i].start;
+        }
+        if(intervals[i].end > end)
+            end = intervals[i].end;
+    }
+    return total + (end - start);
+}
+
+static void event_interval(cl_event event, interval *out){
+    out->start = out->end = 0;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &out->start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &out->end, NULL);
+}
+
+
+/*****************************************************
+ Multiplies two size x size matrices with C split in
+ row panels spread round-robin over the pipeline
+ queues. Each panel uploads its rows of A, runs the
+ kernel on them through a global work offset and reads
+ its rows of C back, so the upload of panel k+1 and
+ the readback of panel k-1 run alongside panel k
+ ****************************************************/
+cl_int cl_engine_mul_pipelined(cl_engine *engine, cl_int size, cl_int local_size,
+                               const cl_double *matrix1_in, const cl_double *matrix2_in,
+                               cl_double *matrix_out, cl_engine_times *times){
+    int tiled = (engine->config.kernel == CL_KERNEL_TILED);
+    cl_kernel kernel = tiled ? engine->tiled_kernel : engine->mul_kernel;
+    int queues = engine->config.queues;
+    int panel_rows, panels, p;
+    cl_event b_written;
+    cl_event *events;
+    interval *intervals;
+    cl_ulong copy_ns = 0, kernel_ns = 0, busy_ns;
+    cl_int status;
+    double time_start = omp_get_wtime();
+
+    if(queues == 0){
+        printf("the engine was created without pipeline queues\n");
+        return CL_INVALID_VALUE;
+    }
+    status = cl_engine_require_fp64(engine);
+    if(status != CL_SUCCESS)
+        return status;
+
+    // Panels hold whole tiles of the tiled kernel, whose work-groups cover TS rows
+    panel_rows = (size + engine->config.panels - 1) / engine->config.panels;
+    if(tiled)
+        panel_rows = (panel_rows + engine->config.tile_size - 1) / engine->config.tile_size * engine->config.tile_size;
+    panels = (size + panel_rows - 1) / panel_rows;
+
+    status = cl_engine_buffers(engine, (size_t)size*size);
+    if(status != CL_SUCCESS)
+        return status;
+
+    status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &engine->buffer_in1);
+    status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &engine->buffer_in2);
+    status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &engine->buffer_out);
+    status |= clSetKernelArg(kernel, 3, sizeof(cl_int), &size);
+    if(status != CL_SUCCESS){
+        printf("error in step 8\n");
+        return status;
+    }
+
+    // Every panel needs all of B, which goes first on the first queue, the other queues wait on its event
+    status = clEnqueueWriteBuffer(engine->pipeline_queues[0], engine->buffer_in2, CL_FALSE, 0,
+        (size_t)size*size*sizeof(cl_double), matrix2_in, 0, NULL, &b_written);
+    if(status != CL_SUCCESS){
+        printf("error in step 5, writing data\n");
+        return status;
+    }
+    clFlush(engine->pipeline_queues[0]);
+
+    // Three events per panel: upload of A, kernel and readback of C
+    events = (cl_event *)calloc(3*panels, sizeof(cl_event));
+    intervals = (interval *)malloc((3*panels + 1)*sizeof(interval));
+
+    for(p=0; p<panels && status == CL_SUCCESS; p++){
+        cl_command_queue queue = engine->pipeline_queues[p % queues];
+        size_t row0 = (size_t)p*panel_rows;
+        size_t rows = (row0 + panel_rows > (size_t)size) ? size - row0 : (size_t)panel_rows;
+        size_t offset = row0*size*sizeof(cl_double);
+        size_t bytes = rows*size*sizeof(cl_double);
+        cl_event wait[2];
+        size_t globalOffset[2], globalWorkSize[2], localWorkSize[2];
+        cl_uint workDim;
+
+        status = clEnqueueWriteBuffer(queue, engine->buffer_in1, CL_FALSE, offset, bytes,
+            matrix1_in + row0*size, 0, NULL, &events[3*p]);
+        if(status != CL_SUCCESS){
+            printf("error in step 5, writing panel %d\n", p);
+            break;
+        }
+
+        if(tiled){
+            size_t tiles_n = (size + engine->config.tile_size - 1) / engine->config.tile_size;
+            size_t tiles_m = (rows + engine->config.tile_size - 1) / engine->config.tile_size;
+            size_t item_rows = engine->config.tile_size / engine->config.rows_per_item;
+            workDim = 2;
+            localWorkSize[0] = engine->config.tile_size;
+            localWorkSize[1] = item_rows;
+            globalWorkSize[0] = tiles_n * localWorkSize[0];
+            globalWorkSize[1] = tiles_m * item_rows;
+            globalOffset[0] = 0;
+            globalOffset[1] = row0 / engine->config.tile_size * item_rows;
+        }else{
+            workDim = 1;
+            globalWorkSize[0] = rows*size;
+            globalOffset[0] = row0*size;
+            localWorkSize[0] = local_size;
+        }
+
+        // The kernel waits for its own rows of A and for B, which was written on another queue
+        wait[0] = events[3*p];
+        wait[1] = b_written;
+        status = clEnqueueNDRangeKernel(queue, kernel, workDim, globalOffset, globalWorkSize,
+            (!tiled && globalWorkSize[0] % local_size != 0) ? NULL : localWorkSize,
+            2, wait, &events[3*p + 1]);
+        if(status != CL_SUCCESS){
+            printf("error in clEnqueueNDRangeKernel for panel %d: %s\n", p, getErrorString(status));
+            break;
+        }
+
+        status = clEnqueueReadBuffer(queue, engine->buffer_out, CL_FALSE, offset, bytes,
+            matrix_out + row0*size, 1, &events[3*p + 1], &events[3*p + 2]);
+        if(status != CL_SUCCESS){
+            printf("error in reading panel %d\n", p);
+            break;
+        }
+
+        // Flushing right away lets the device start on this panel while the next ones are still being enqueued
+        clFlush(queue);
+    }
+
+    for(p=0; p<queues; p++)
+        clFinish(engine->pipeline_queues[p]);
+    times->total = omp_get_wtime() - time_start;
+
+    if(status == CL_SUCCESS){
+        int count = 0;
+
+        // The pipeline queues are always profiled, the records are only kept when the engine profiles everything
+        if(engine->config.profiling){
+            cl_profile_add(&engine->profile, b_written, "write", 1, (size_t)size*size*sizeof(cl_double), 0);
+            for(p=0; p<panels; p++){
+                size_t rows = ((size_t)(p+1)*panel_rows > (size_t)size) ? size - (size_t)p*panel_rows : (size_t)panel_rows;
+                cl_profile_add(&engine->profile, events[3*p], "write", 1 + p % queues, rows*size*sizeof(cl_double), 0);
+                cl_profile_add(&engine->profile, events[3*p + 1], "kernel", 1 + p % queues, 0, 2.0*rows*size*(double)size);
+                cl_profile_add(&engine->profile, events[3*p + 2], "read", 1 + p % queues, rows*size*sizeof(cl_double), 0);
+            }
+        }
+
+        event_interval(b_written, &intervals[count]);
+        copy_ns += intervals[count].end - intervals[count].start;
+        count++;
+        for(p=0; p<panels; p++){
+            event_interval(events[3*p], &intervals[count]);
+            copy_ns += intervals[count].end - intervals[count].start;
+            count++;
+            event_interval(events[3*p + 1], &intervals[count]);
+            kernel_ns += intervals[count].end - intervals[count].start;
+            count++;
+            event_interval(events[3*p + 2], &intervals[count]);
+            copy_ns += intervals[count].end - intervals[count].start;
+            count++;
+        }
+        busy_ns = busy_union(intervals, count);
+
+        times->copy = copy_ns * 1e-9;
+        times->kernel = kernel_ns * 1e-9;
+        times->overlap = (copy_ns + kernel_ns > 0) ? 1.0 - (double)busy_ns / (copy_ns + kernel_ns) : 0.0;
+    }
+
+    clReleaseEvent(b_written);
+    for(p=0; p<3*panels; p++)
+        if(events[p] != NULL)
+            clReleaseEvent(events[p]);
+    free(events);
+    free(intervals);
+    return status;
+}
@@ -0,0 +1,124 @@
+#include "matrix_cl.h"
+
+// Largest number of distinct stage names summarized by cl_profile_report
+#define CL_PROFILE_MAX_STAGES 16
+
+
+/*****************************************************
+ Records the device timestamps of a completed command.
+ bytes and flops are the amount of data it moved and
+ of arithmetic it did, used for the rates of the report
+ ****************************************************/
+void cl_profile_add(cl_profile *profile, cl_event event, const char *name, int queue,
+                    size_t bytes, double flops){
+    cl_profile_record *record;
+
+    if(profile->count == profile->capacity){
+        int capacity = profile->capacity ? 2*profile->capacity : 64;
+        cl_profile_record *records = (cl_profile_record *)realloc(profile->records, capacity*sizeof(cl_profile_record));
+        if(records == NULL)
+            return;
+        profile->records = records;
+        profile->capacity = capacity;
+    }
+
+    record = &profile->records[profile->count++];
+    memset(record, 0, sizeof(*record));
+    record->name = name;
+    record->queue = queue;
+    record->bytes = bytes;
+    record->flops = flops;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &record->queued, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &record->submit, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &record->start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &record->end, NULL);
+}
+
+
+/*****************************************************
+ Prints, for every stage (write, kernel, read, ...), the
+ summed device time, the time commands waited between
+ being queued and starting, and the achieved GB/s or
+ GFLOP/s
+ ****************************************************/
+void cl_profile_report(const cl_profile *profile){
+    const char *names[CL_PROFILE_MAX_STAGES];
+    int calls[CL_PROFILE_MAX_STAGES];
+    cl_ulong busy[CL_PROFILE_MAX_STAGES], waiting[CL_PROFILE_MAX_STAGES];
+    double bytes[CL_PROFILE_MAX_STAGES], flops[CL_PROFILE_MAX_STAGES];
+    int stages = 0;
+    int i, s;
+
+    for(i=0; i<profile->count; i++){
+        const cl_profile_record *record = &profile->records[i];
+
+        for(s=0; s<stages && strcmp(names[s], record->name) != 0; s++);
+        if(s == stages){
+            if(stages == CL_PROFILE_MAX_STAGES)
+                continue;
+            names[s] = record->name;
+            calls[s] = 0;
+            busy[s] = waiting[s] = 0;
+            bytes[s] = flops[s] = 0;
+            stages++;
+        }
+        calls[s]++;
+        busy[s] += record->end - record->start;
+        waiting[s] += record->start - record->queued;
+        bytes[s] += record->bytes;
+        flops[s] += record->flops;
+    }
+
+    printf("DEVICE PROFILE (%d commands)\n", profile->count);
+    for(s=0; s<stages; s++){
+        double seconds = busy[s] * 1e-9;
+        printf("  %-8s %5d calls: device %f (sec), queued-to-start %f (sec)", names[s], calls[s],
+               seconds, waiting[s] * 1e-9);
+        if(bytes[s] > 0 && seconds > 0)
+            printf(", %.2f GB/s", bytes[s] / seconds * 1e-9);
+        if(flops[s] > 0 && seconds > 0)
+            printf(", %.2f GFLOP/s", flops[s] / seconds * 1e-9);
+        printf("\n");
+    }
+}
+
+
+/*****************************************************
+ Writes the records in the Trace Event Format read by
+ chrome://tracing and Perfetto, one row per queue
+ ****************************************************/
+int cl_profile_write_trace(const cl_profile *profile, const char *file_name){
+    FILE *file = fopen(file_name, "w");
+    cl_ulong origin = 0;
+    int i;
+
+    if(file == NULL){
+        printf("cannot write the trace file %s\n", file_name);
+        return 0;
+    }
+
+    // Timestamps are made relative to the first command, trace viewers work in microseconds
+    for(i=0; i<profile->count; i++)
+        if(origin == 0 || profile->records[i].queued < origin)
+            origin = profile->records[i].queued;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for(i=0; i<profile->count; i++){
+        const cl_profile_record *record = &profile->records[i];
+        fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                "\"args\":{\"queued_us\":%.3f,\"submit_us\":%.3f,\"bytes\":%zu,\"flops\":%.0f}}",
+                i ? ",\n" : "", record->name, record->queue,
+                (record->start - origin) * 1e-3, (record->end - record->start) * 1e-3,
+                (record->queued - origin) * 1e-3, (record->submit - origin) * 1e-3,
+                record->bytes, record->flops);
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(file);
+    return 1;
+}
+
+
+void cl_profile_free(cl_profile *profile){
+    free(profile->records);
+    memset(profile, 0, sizeof(*profile));
+}
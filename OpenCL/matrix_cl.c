@@ -1,4 +1,10 @@
 #include "matrix_cl.h"
+#include "../common/bench.h"
+#include "../common/verify.h"
+#include "../common/matrix_rng.h"
+#include "../common/arena.h"
+#include "../common/precision.h"
+#include "../common/matrix_io.h"
 
 
 static timestamp_t get_timestamp ()
@@ -123,419 +129,469 @@ void matrix_mult_sq(int size, cl_double *matrix1_in,
 
  ****************************************************/
 void matrix_vector_gen(cl_int size, cl_double *matrix1, cl_double *matrix2){
-  int i;
-    
-  // Changed in order to instead generate two matrixes
-  for(i=0; i<size*size; i++)
-      matrix1[i] = ((double)rand())/65535.0;
-  for(i=0; i<size*size; i++)
-      matrix2[i] = ((double)rand())/5307.0;
+  uint64_t seed = matrix_seed();
+
+  // Changed in order to instead generate two matrixes, the same ones the CPU back ends multiply
+  matrix_random(matrix1, size, size, size, seed, MATRIX_STREAM_A);
+  matrix_random(matrix2, size, size, size, seed, MATRIX_STREAM_B);
+}
+
+
+/*** TYPEDEFS AND STRUCTS***/
+// One multiply of the bench mode
+typedef struct {
+    cl_engine *engine;
+    cl_int size;
+    cl_int local_size;
+    cl_double *matrix1, *matrix2, *result;
+} bench_call;
+
+static void bench_call_sq(void *context){
+    bench_call *call = (bench_call *)context;
+    matrix_mult_sq(call->size, call->matrix1, call->matrix2, call->result);
 }
 
+static void bench_call_cl(void *context){
+    bench_call *call = (bench_call *)context;
+    cl_engine_times times;
+    if(cl_engine_mul(call->engine, call->size, call->local_size, call->matrix1, call->matrix2,
+                     call->result, &times) != CL_SUCCESS)
+        exit(-1);
+}
 
 /*****************************************************
+ bench mode: sweeps sizes and local work-group sizes
+ of the naive kernel, plus the tiled kernel. The engine
+ is set up once, so every trial is transfer + compute
+*****************************************************/
+int bench_main(int argc, char *argv[]){
+    bench_config config;
+    bench_output output;
+    cl_engine_config engine_config;
+    cl_engine engine;
+    char device_setting[256];
+    arena matrices;
+    int s, l, largest = 0;
+
+    if(!bench_parse_args(argc, argv, &config))
+        return 0;
 
- ****************************************************/
-int main(int argc, char *argv[]){
-    if(argc < 3){
-        printf("Usage: %s (matrix/vector_size) (local group size)\n", argv[0]);
+    cl_engine_config_default(&engine_config);
+    if(settings_get("run_settings.ini", "opencl", "device", device_setting, sizeof(device_setting)))
+        engine_config.device = device_setting;
+    if(cl_engine_init(&engine, &engine_config) != CL_SUCCESS){
+        cl_engine_release(&engine);
+        return 0;
+    }
+    // One page-aligned arena sized for the largest matrices is reused by every size of the sweep
+    for(s=0; s<config.num_sizes; s++)
+        if(config.sizes[s] > largest)
+            largest = config.sizes[s];
+    if(!bench_open(&output, &config) || !arena_init(&matrices, 3*arena_matrix_bytes(largest, largest, ARENA_PAGE_ALIGN))){
+        cl_engine_release(&engine);
         return 0;
     }
 
-    cl_int size = atoi(argv[1]);
-    cl_int localSize = atoi(argv[2]);
+    for(s=0; s<config.num_sizes; s++){
+        cl_int size = config.sizes[s];
+        bench_call call = {.engine = &engine, .size = size};
+        bench_result sq = {.backend = "opencl", .kernel = "sq", .size = size, .threads = 1};
+
+        arena_reset(&matrices);
+        call.matrix1 = arena_matrix(&matrices, size, size, ARENA_PAGE_ALIGN);
+        call.matrix2 = arena_matrix(&matrices, size, size, ARENA_PAGE_ALIGN);
+        call.result = arena_matrix(&matrices, size, size, ARENA_PAGE_ALIGN);
+        matrix_vector_gen(size, call.matrix1, call.matrix2);
+
+        // The sequential kernel is the baseline of every speedup, so it always runs
+        bench_measure(bench_call_sq, &call, &config, &sq);
+        sq.speedup = 1.0;
+        if(bench_kernel_enabled(&config, "sq"))
+            bench_emit(&output, &sq);
+
+        // Threads do not apply to the device, they are reported as 0
+        engine.config.kernel = CL_KERNEL_NAIVE;
+        for(l=0; l<config.num_local_sizes && bench_kernel_enabled(&config, "naive"); l++){
+            bench_result r = {.backend = "opencl", .kernel = "naive", .size = size, .local_size = config.local_sizes[l]};
+            if(((size_t)size*size) % config.local_sizes[l] != 0)
+                continue;
+            call.local_size = config.local_sizes[l];
+            bench_measure(bench_call_cl, &call, &config, &r);
+            r.speedup = sq.median / r.median;
+            bench_emit(&output, &r);
+        }
 
-    if((size == 0) || (localSize == 0)){
-        printf("incorrect arguments, make sure both arguments are integers greater than zero\n");
-        exit(-1);
-    }else if((size % localSize) != 0){
-        printf("size should be a multiple of localSize\n");
-        exit(-1);
+        if(bench_kernel_enabled(&config, "tiled")){
+            bench_result r = {.backend = "opencl", .kernel = "tiled", .size = size,
+                              .local_size = engine.config.tile_size*engine.config.tile_size/engine.config.rows_per_item};
+            engine.config.kernel = CL_KERNEL_TILED;
+            bench_measure(bench_call_cl, &call, &config, &r);
+            r.speedup = sq.median / r.median;
+            bench_emit(&output, &r);
+        }
     }
 
-    // Data structures allocated to store the operand and resulting matrixes of size "size*size"
-    cl_double *matrix1 = (double *)malloc(sizeof(cl_double)*size*size);
-    cl_double *matrix2 = (double *)malloc(sizeof(cl_double)*size*size);
-    cl_double *result_sq = (double *)malloc(sizeof(cl_double)*size*size);
-    cl_double *result_pl = (double *)malloc(sizeof(cl_double)*size*size);
-    matrix_vector_gen(size, matrix1, matrix2);
+    arena_release(&matrices);
+    bench_close(&output);
+    cl_engine_release(&engine);
+    return 1;
+}
+
 
+/*****************************************************
+ batch mode: count independent size x size products
+ in one kernel launch, checked against the sequential
+ multiply of every product
+*****************************************************/
+int batch_main(int argc, char *argv[]){
+    cl_int size = (argc > 0) ? atoi(argv[0]) : 0;
+    cl_int count = (argc > 1) ? atoi(argv[1]) : 0;
+    size_t elems = (size_t)size*size;
+    double flops = 2.0*elems*size*count;
+    cl_engine_config config;
+    cl_engine_times times;
+    cl_engine engine;
+    char device_setting[256];
+    arena matrices;
     double time_sq;
-    
-    // Variables used to individually calculate the inititalization, copy and compilation times (that form the overhead) and the kernel runtime
-    double time_opencl, time_opencl_init, time_opencl_comp, time_opencl_cpy;
-    double time1, time2, time3, time4;
+    int i, ok;
+
+    if(size <= 0 || count <= 0){
+        printf("incorrect arguments, expected batch size count with both greater than zero\n");
+        return 0;
+    }
+
+    cl_engine_config_default(&config);
+    if(settings_get("run_settings.ini", "opencl", "device", device_setting, sizeof(device_setting)))
+        config.device = device_setting;
 
-    cl_event mulDone;
+    // The batch of each operand is one count*size x size matrix, product i using its rows [i*size, (i+1)*size)
+    if(!arena_init(&matrices, 4*arena_matrix_bytes(count*size, size, ARENA_PAGE_ALIGN))){
+        printf("can't allocate the required memory for the matrices\n");
+        return 0;
+    }
+    cl_double *matrix1 = arena_matrix(&matrices, count*size, size, ARENA_PAGE_ALIGN);
+    cl_double *matrix2 = arena_matrix(&matrices, count*size, size, ARENA_PAGE_ALIGN);
+    cl_double *result_sq = arena_matrix(&matrices, count*size, size, ARENA_PAGE_ALIGN);
+    cl_double *result_pl = arena_matrix(&matrices, count*size, size, ARENA_PAGE_ALIGN);
+    matrix_random(matrix1, count*size, size, size, matrix_seed(), MATRIX_STREAM_A);
+    matrix_random(matrix2, count*size, size, size, matrix_seed(), MATRIX_STREAM_B);
 
     time_sq = omp_get_wtime();
-    matrix_mult_sq(size, matrix1, matrix2, result_sq);
+    for(i=0; i<count; i++)
+        matrix_mult_sq(size, matrix1 + i*elems, matrix2 + i*elems, result_sq + i*elems);
     time_sq = omp_get_wtime() - time_sq;
 
-    cl_int status;
-    time_opencl = omp_get_wtime();
+    if(cl_engine_init(&engine, &config) != CL_SUCCESS
+       || cl_engine_mul_batched(&engine, size, count, matrix1, matrix2, result_pl, &times) != CL_SUCCESS){
+        cl_engine_release(&engine);
+        arena_release(&matrices);
+        return 0;
+    }
 
+    printf("BATCH OF %d PRODUCTS OF %dx%d MATRICES IN ONE KERNEL LAUNCH\n", count, size, size);
+    printf("SEQUENTIAL EXECUTION: %f (sec), %.2f GFLOP/s\n", time_sq, flops/time_sq*1e-9);
+    printf("BATCHED EXECUTION: %f (sec), %.2f GFLOP/s\nSplit between COPY %f (sec) and KERNEL RUNTIME %f (sec), %.2f GFLOP/s in the kernel and its read\n",
+           times.total, flops/times.total*1e-9, times.copy, times.kernel, flops/times.kernel*1e-9);
+    if(engine.config.profiling)
+        cl_profile_report(&engine.profile);
 
-    //-----------------------------------------------------
-    // STEP 1: Discover and initialize the platforms
-    //-----------------------------------------------------
-    cl_uint numPlatforms = 0;
-    cl_platform_id *platforms = NULL;
-    
-    // Use clGetPlatformIDs() to retrieve the number of 
-    // platforms
-    status = clGetPlatformIDs(0, NULL, &numPlatforms);
-    // Allocate enough space for each platform
-    platforms = (cl_platform_id*)malloc(numPlatforms*sizeof(cl_platform_id));
- 
-    // Fill in platforms with clGetPlatformIDs()
-    status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+    ok = verify_batch(result_sq, result_pl, size, count, "OPENCL BATCHED");
+    if(!ok)
+        printf("wrong result of the batched OpenCL multiply\n");
 
-    if(status != CL_SUCCESS){
-        printf("error in step 1\n");
-        exit(-1);
-    }
+    cl_engine_release(&engine);
+    arena_release(&matrices);
+    return ok;
+}
 
-    //-----------------------------------------------------
-    // STEP 2: Discover and initialize the devices
-    //-----------------------------------------------------
-    cl_uint numDevices = 0;
-    cl_device_id *devices = NULL;
-
-    // Use clGetDeviceIDs() to retrieve the number of 
-    // devices present
-    status = clGetDeviceIDs(
-        platforms[0], 
-        CL_DEVICE_TYPE_GPU,
-        0, 
-        NULL, 
-        &numDevices);
-    // Allocate enough space for each device
-    devices = (cl_device_id*)malloc(numDevices*sizeof(cl_device_id));
-
-    // Fill in devices with clGetDeviceIDs()
-    status |= clGetDeviceIDs(
-        platforms[0], 
-        CL_DEVICE_TYPE_GPU,
-        numDevices, 
-        devices, 
-        NULL);
-    // select the device which will be used
-    int device_id = 0;
-    
-    if((status != CL_SUCCESS) || (device_id >= numDevices)){
-        printf("error in step 2\n");
-        exit(-1);
-    }
 
-    //-----------------------------------------------------
-    // STEP 3: Create a context
-    //-----------------------------------------------------
-    cl_context context = NULL;
-
-    // Create a context using clCreateContext() and 
-    // associate it with the devices
-    context = clCreateContext(
-        NULL, 
-        1, 
-        &devices[device_id], 
-        NULL, 
-        NULL, 
-        &status);
-
-    if(status != CL_SUCCESS){
-        printf("error in step 3\n");
-        exit(-1);
-    }
+/*****************************************************
+ Releases the engine of the first device and the
+ engines of the others, extra_engines[1] up to
+ extra_engines[devices-1]
+ ****************************************************/
+static void release_engines(cl_engine *engine, cl_engine *extra_engines, int devices){
+    int d;
 
-    //-----------------------------------------------------
-    // STEP 4: Create a command queue
-    //-----------------------------------------------------
-    cl_command_queue cmdQueue;
-
-    // Create a command queue using clCreateCommandQueue(),
-    // and associate it with the device you want to execute 
-    // on
-    cmdQueue = clCreateCommandQueue(
-        context, 
-        devices[device_id], 
-        0, 
-        &status);
-
-    if(status != CL_SUCCESS){
-        printf("error in step 4\n");
-        exit(-1);
-    }
+    cl_engine_release(engine);
+    for(d=1; d<devices; d++)
+        cl_engine_release(&extra_engines[d]);
+}
 
-    
-    //-----------------------------------------------------
-    // STEP 5: Create device buffers, images and copy data to buffers
-    //-----------------------------------------------------
-    cl_mem bufferMatrixIn1, bufferMatrixIn2, bufferMatrixOut;
 
-    
-    bufferMatrixIn1 = clCreateBuffer(
-        context, 
-        CL_MEM_READ_ONLY,                         
-        size*size*sizeof(cl_double),
-        NULL, 
-        &status);
-
-    if(status != CL_SUCCESS){
-        printf("error in step 5, creating buffer for bufferA\n");
-        exit(-1);
-    }
+/*****************************************************
 
-    bufferMatrixIn2 = clCreateBuffer(
-        context, 
-        CL_MEM_READ_ONLY,                         
-        size*size*sizeof(cl_double), 
-        NULL, 
-        &status);
+ ****************************************************/
+int main(int argc, char *argv[]){
+    if(argc < 2 || (argc < 3 && strcmp(argv[1], "bench") != 0 && strcmp(argv[1], "batch") != 0)){
+        printf("Usage: %s (matrix/vector_size) (local group size) [repetitions] [--kernel naive|tiled] [--tile TS] [--wpt rows_per_item] [--device auto|gpu|cpu|accelerator|index|name] [--list-devices] [--pipeline queues] [--panels count] [--zero-copy auto|on|off] [--profile] [--trace file.json] [--precision double|float|mixed|refine] [--input A.bin B.bin] [--output C.bin] [--hybrid] [--hybrid-devices device,..]\n", argv[0]);
+        printf("       %s bench [--sizes n,..] [--local-sizes l,..] [--kernels sq,naive,tiled] [--trials n] [--warmup n] [--format csv|json] [--output file] [--append]\n", argv[0]);
+        printf("       %s batch (matrix_size) (count)\n", argv[0]);
+        return 0;
+    }
+    if(strcmp(argv[1], "bench") == 0)
+        return bench_main(argc-2, argv+2) ? EXIT_SUCCESS : EXIT_FAILURE;
+    if(strcmp(argv[1], "batch") == 0)
+        return batch_main(argc-2, argv+2) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-    if(status != CL_SUCCESS){
-        printf("error in step 5, creating buffer for bufferB\n");
-        exit(-1);
+    cl_int size = atoi(argv[1]);
+    cl_int localSize = atoi(argv[2]);
+    // The engine is set up once and then fed this many multiplies, to show the per-call cost without the setup
+    int repetitions = 1;
+    int arg = 3;
+
+    if(arg < argc && strncmp(argv[arg], "--", 2) != 0)
+        repetitions = atoi(argv[arg++]);
+
+    cl_engine_config config;
+    char device_setting[256];
+    cl_engine_config_default(&config);
+    // The [opencl] section of run_settings.ini gives the default device, the command line overrides it
+    if(settings_get("run_settings.ini", "opencl", "device", device_setting, sizeof(device_setting)))
+        config.device = device_setting;
+    // The [profiling] section turns on the device-side profile, and optionally a JSON trace of every command
+    char profiling_setting[16], trace_setting[256];
+    const char *trace_file = NULL;
+    // MATRIX_PRECISION, or --precision, runs the multiply on float operands (see common/precision.h)
+    int precision = precision_mode();
+    // --input multiplies two matrix files (see common/matrix_io.h), a size of 0 takes theirs, and --output writes the result
+    matrix_io_args io = { NULL, NULL, NULL };
+    matrix_file file_a, file_b, file_c;
+    // --hybrid splits the rows of C between the host threads and the device, --hybrid-devices between the host and every device listed
+    int hybrid_on = 0, devices = 1, d;
+    char hybrid_list[256];
+    const char *device_specs[CL_HYBRID_MAX_DEVICES];
+    if(settings_get("run_settings.ini", "profiling", "enable", profiling_setting, sizeof(profiling_setting)))
+        config.profiling = (strcmp(profiling_setting, "yes") == 0);
+    if(settings_get("run_settings.ini", "profiling", "trace_file", trace_setting, sizeof(trace_setting)) && trace_setting[0] != '\0')
+        trace_file = trace_setting;
+    for(; arg < argc; arg++){
+        if(strcmp(argv[arg], "--kernel") == 0 && arg+1 < argc){
+            arg++;
+            if(strcmp(argv[arg], "tiled") == 0) config.kernel = CL_KERNEL_TILED;
+            else if(strcmp(argv[arg], "naive") == 0) config.kernel = CL_KERNEL_NAIVE;
+            else{
+                printf("unknown kernel %s, expected naive or tiled\n", argv[arg]);
+                exit(-1);
+            }
+        }else if(strcmp(argv[arg], "--precision") == 0 && arg+1 < argc){
+            precision = precision_parse(argv[++arg]);
+            if(precision < 0){
+                printf("unknown precision %s, expected double, float, mixed or refine\n", argv[arg]);
+                exit(-1);
+            }
+        }else if(strcmp(argv[arg], "--tile") == 0 && arg+1 < argc){
+            config.tile_size = atoi(argv[++arg]);
+        }else if(strcmp(argv[arg], "--wpt") == 0 && arg+1 < argc){
+            config.rows_per_item = atoi(argv[++arg]);
+        }else if(strcmp(argv[arg], "--profile") == 0){
+            config.profiling = 1;
+        }else if(strcmp(argv[arg], "--trace") == 0 && arg+1 < argc){
+            trace_file = argv[++arg];
+        }else if(strcmp(argv[arg], "--zero-copy") == 0 && arg+1 < argc){
+            arg++;
+            config.zero_copy = (strcmp(argv[arg], "on") == 0) ? 1 : (strcmp(argv[arg], "off") == 0) ? 0 : -1;
+        }else if(strcmp(argv[arg], "--pipeline") == 0 && arg+1 < argc){
+            config.queues = atoi(argv[++arg]);
+        }else if(strcmp(argv[arg], "--panels") == 0 && arg+1 < argc){
+            config.panels = atoi(argv[++arg]);
+        }else if(strcmp(argv[arg], "--device") == 0 && arg+1 < argc){
+            config.device = argv[++arg];
+        }else if(strcmp(argv[arg], "--list-devices") == 0){
+            cl_device_list();
+            return 0;
+        }else if(strcmp(argv[arg], "--hybrid") == 0){
+            hybrid_on = 1;
+        }else if(strcmp(argv[arg], "--hybrid-devices") == 0 && arg+1 < argc){
+            char *spec;
+            hybrid_on = 1;
+            devices = 0;
+            snprintf(hybrid_list, sizeof(hybrid_list), "%s", argv[++arg]);
+            for(spec = strtok(hybrid_list, ","); spec != NULL; spec = strtok(NULL, ",")){
+                if(devices == CL_HYBRID_MAX_DEVICES){
+                    printf("at most %d devices can take part in the hybrid multiply\n", CL_HYBRID_MAX_DEVICES);
+                    exit(-1);
+                }
+                device_specs[devices++] = spec;
+            }
+            if(devices == 0){
+                printf("--hybrid-devices expects a list of devices\n");
+                exit(-1);
+            }
+            config.device = device_specs[0];
+        }else if(matrix_io_option(argc, argv, &arg, &io)){
+            continue;
+        }else{
+            printf("unknown option %s\n", argv[arg]);
+            exit(-1);
+        }
     }
 
-    bufferMatrixOut = clCreateBuffer(
-        context, 
-        CL_MEM_WRITE_ONLY,                         
-        size*size*sizeof(cl_double), 
-        NULL, 
-        &status);
+    // A trace needs the device timestamps
+    if(trace_file != NULL)
+        config.profiling = 1;
 
-    if(status != CL_SUCCESS){
-        printf("error in step 5, creating buffer for bufferC\n");
+    if(!matrix_io_load_inputs(&io, &size, &file_a, &file_b))
         exit(-1);
-    }
 
-    
-    // Timer to calculate the initialization time
-    time_opencl_init = omp_get_wtime();
-    
-    
-    status = clEnqueueWriteBuffer ( 
-        cmdQueue,
-        bufferMatrixIn1,
-        CL_FALSE,
-        0,
-        size*size*sizeof(cl_double),
-        matrix1,
-        0,
-        NULL,
-        NULL);
-
-    status |= clEnqueueWriteBuffer ( 
-        cmdQueue,
-        bufferMatrixIn2,
-        CL_FALSE,
-        0,
-        size*size*sizeof(cl_double),
-        matrix2,
-        0,
-        NULL,
-        NULL);
-
-    if(status != CL_SUCCESS){
-        printf("error in step 5, writing data\n");
+    if((size <= 0) || (localSize <= 0) || (repetitions <= 0)){
+        printf("incorrect arguments, make sure all arguments are integers greater than zero\n");
         exit(-1);
-    }
-    
-    char *mulFileName, *mulBuffer;
-    mulFileName = "vectorMatrixMul.cl";
-    FILE *mulFile;
-    mulFile = fopen(mulFileName, "r");
-    if(mulFile == NULL){
-        printf("cannot open .cl file\n");
-        printf("current path: %s\n", mulFileName);
+    }else if(hybrid_on && (precision != PREC_DOUBLE || config.queues > 0)){
+        printf("the hybrid multiply runs in double precision and without pipeline queues\n");
         exit(-1);
-    }
-    fseek(mulFile, 0, SEEK_END);
-    size_t mulSize = ftell(mulFile);
-    rewind(mulFile);
-
-    // read kernel source into buffer
-    mulBuffer = (char*) malloc(mulSize + 1);
-    mulBuffer[mulSize] = '\0';
-    fread(mulBuffer, sizeof(char), mulSize, mulFile);
-    fclose(mulFile);
-    
-    // Timer to calculate the copytime
-    time_opencl_cpy = omp_get_wtime();
-
-    //-----------------------------------------------------
-    // STEP 6: Create and compile the program
-    //----------------------------------------------------- 
-    cl_program program = clCreateProgramWithSource(
-        context, 
-        1, 
-        (const char**) &mulBuffer,                                 
-        &mulSize, 
-        &status);
-    free(mulBuffer);
-
-
-    // Build (compile) the program for the devices with
-    // clBuildProgram()
-    const char options[] = "-cl-std=CL1.2";
-    status |= clBuildProgram(
-        program, 
-        1, 
-        &devices[device_id], 
-        options, 
-        NULL, 
-        NULL);
-
-    if(status != CL_SUCCESS){
-        printf("error in step 6\n");
+    }else if(((config.kernel == CL_KERNEL_NAIVE && config.queues == 0) || precision != PREC_DOUBLE) && ((size*size) % localSize) != 0){
+        printf("size*size should be a multiple of localSize\n");
         exit(-1);
     }
 
-
-
-    //-----------------------------------------------------
-    // STEP 7: Create the kernel
-    //----------------------------------------------------- 
-    cl_kernel mulKernel = NULL;
-
-    // Use clCreateKernel() to create a kernel from the 
-    mulKernel = clCreateKernel(program, "mul_kernel", &status);
-    if(status != CL_SUCCESS){
-        printf("error in step 7\n");
+    // Data structures allocated to store the operand and resulting matrixes of size "size*size", all in one arena (on huge pages when available). They are page aligned so the zero-copy mode can wrap them
+    arena matrices;
+    if(!arena_init(&matrices, 4*arena_matrix_bytes(size, size, ARENA_PAGE_ALIGN))){
+        printf("can't allocate the required memory for the matrices\n");
         exit(-1);
     }
-
-    //-----------------------------------------------------
-    // STEP 8: Set the kernel arguments
-    //----------------------------------------------------- 
-    // Associate the input and output buffers with the 
-    // kernel 
-    // using clSetKernelArg()
-    status  = clSetKernelArg(
-        mulKernel, 
-        0, 
-        sizeof(cl_mem), 
-        &bufferMatrixIn1);
-    status |= clSetKernelArg(
-        mulKernel, 
-        1, 
-        sizeof(cl_mem), 
-        &bufferMatrixIn2);
-    status |= clSetKernelArg(
-        mulKernel, 
-        2, 
-        sizeof(cl_mem), 
-        &bufferMatrixOut);
-    status |= clSetKernelArg(
-        mulKernel, 
-        3, 
-        sizeof(cl_int), 
-        &size);
-
-
-    if(status != CL_SUCCESS){
-        printf("error in step 8\n");
-        exit(-1);
+    cl_double *matrix1 = arena_matrix(&matrices, size, size, ARENA_PAGE_ALIGN);
+    cl_double *matrix2 = arena_matrix(&matrices, size, size, ARENA_PAGE_ALIGN);
+    cl_double *result_sq = arena_matrix(&matrices, size, size, ARENA_PAGE_ALIGN);
+    cl_double *result_pl = arena_matrix(&matrices, size, size, ARENA_PAGE_ALIGN);
+
+    // The output file is mapped page aligned, so the zero-copy mode reads the result straight into it
+    if(io.output != NULL){
+        result_pl = (cl_double *)matrix_file_create(&file_c, io.output, size, size, MATRIX_DTYPE_FLOAT64,
+                                                    MATRIX_LAYOUT_ROW_MAJOR, 0, ARENA_PAGE_ALIGN);
+        if(result_pl == NULL)
+            exit(-1);
     }
 
-    //-----------------------------------------------------
-    // STEP 9: Configure the work-item structure
-    //----------------------------------------------------- 
-    // Define an index space (global work size) of work 
-    // items for 
-    // execution. A workgroup size (local work size) is not 
-    // required, 
-    // but can be used.
-
-    
-    size_t globalWorkSize[1];
-    globalWorkSize[0] = size*size;
+    // Inputs of doubles in row-major order are sent from their mapping, others are converted into the arena
+    if(io.input_a != NULL){
+        matrix1 = matrix_io_operand(&file_a, io.input_a, matrix1, size);
+        matrix2 = matrix_io_operand(&file_b, io.input_b, matrix2, size);
+    }else{
+        matrix_vector_gen(size, matrix1, matrix2);
+    }
 
-    size_t localWorkSize[1];
-    localWorkSize[0] = localSize;
+    double time_sq;
     
+    // Variables used to individually calculate the inititalization and compilation times (the one-off overhead) and the copy and kernel runtime of every multiply
+    double time_copy = 0, time_kernel = 0, time_total = 0, overlap = 0;
+    int r;
+
+    // The sequential multiply is only needed as the reference of a full check, Freivalds checks large runs without it
+    int verify = verify_method(size);
+    if(verify == VERIFY_FULL){
+        time_sq = omp_get_wtime();
+        matrix_mult_sq(size, matrix1, matrix2, result_sq);
+        time_sq = omp_get_wtime() - time_sq;
+    }
 
-    // Timer to calculate the computation time
-    time_opencl_comp = omp_get_wtime();
-    
-    status |= clEnqueueNDRangeKernel(
-        cmdQueue, 
-        mulKernel, 
-        1, 
-        NULL, 
-        globalWorkSize, 
-        localWorkSize, 
-        0, 
-        NULL, 
-        &mulDone);
-
-    if(status != CL_SUCCESS){
-         clWaitForEvents (1,&mulDone);
-
-        printf("error in clEnqueueNDRangeKernel\n");
+    cl_engine engine;
+    if(cl_engine_init(&engine, &config) != CL_SUCCESS){
+        cl_engine_release(&engine);
         exit(-1);
     }
-    
-    clEnqueueReadBuffer(
-        cmdQueue, 
-        bufferMatrixOut,
-        CL_TRUE, 
-        0, 
-        size*size*sizeof(cl_double),
-        result_pl, 
-        1, 
-        &mulDone, 
-        NULL);
-
-
-    if(status != CL_SUCCESS){
-    printf("error in reading data\n");
-    exit(-1);
+
+    // The other devices of the hybrid multiply get engines of their own, with the same settings
+    cl_engine extra_engines[CL_HYBRID_MAX_DEVICES];
+    cl_engine *hybrid_engines[CL_HYBRID_MAX_DEVICES] = { &engine };
+    cl_hybrid hybrid;
+    for(d=1; d<devices; d++){
+        cl_engine_config device_config = config;
+        device_config.device = device_specs[d];
+        hybrid_engines[d] = &extra_engines[d];
+        if(cl_engine_init(&extra_engines[d], &device_config) != CL_SUCCESS){
+            release_engines(&engine, extra_engines, d+1);
+            exit(-1);
+        }
+    }
+    if(hybrid_on)
+        cl_hybrid_init(&hybrid, devices);
+
+    for(r=0; r<repetitions; r++){
+        cl_engine_times times = { 0, 0, 0, 0 };
+        // The reduced precisions run the naive kernel with regular transfers. Every hybrid multiply rebalances the shares with the rates of the previous one
+        cl_int status = hybrid_on
+            ? cl_hybrid_mul(&hybrid, hybrid_engines, size, localSize, matrix1, matrix2, result_pl)
+            : (precision != PREC_DOUBLE)
+            ? cl_engine_mul_precision(&engine, size, localSize, precision, matrix1, matrix2, result_pl, &times)
+            : (config.queues > 0)
+            ? cl_engine_mul_pipelined(&engine, size, localSize, matrix1, matrix2, result_pl, &times)
+            : cl_engine_mul(&engine, size, localSize, matrix1, matrix2, result_pl, &times);
+        if(status != CL_SUCCESS){
+            release_engines(&engine, extra_engines, devices);
+            exit(-1);
+        }
+        if(hybrid_on)
+            times.total = hybrid.total;
+        time_copy += times.copy;
+        time_kernel += times.kernel;
+        time_total += times.total;
+        overlap += times.overlap;
+    }
+    time_copy /= repetitions;
+    time_kernel /= repetitions;
+    time_total /= repetitions;
+    overlap /= repetitions;
+
+    printf("MATRICES IN A %zu MB ARENA ON %s\n", matrices.capacity >> 20, arena_pages_name(&matrices));
+    if(verify == VERIFY_FULL)
+        printf("SEQUENTIAL EXECUTION: %f (sec)\n", time_sq);
+    else
+        printf("SEQUENTIAL EXECUTION: skipped\n");
+    if(precision != PREC_DOUBLE)
+        printf("%s PRECISION KERNEL (%s)\n", precision_name(precision),
+               (precision == PREC_FLOAT) ? "float operands" : (precision == PREC_MIXED) ? "float operands, double sums"
+               : "float slices, double accuracy");
+    else if(config.kernel == CL_KERNEL_TILED)
+        printf("TILED KERNEL WITH %dx%d TILES AND %d ROWS PER WORK-ITEM\n", config.tile_size, config.tile_size, config.rows_per_item);
+    if(engine.zero_copy && config.queues == 0 && precision == PREC_DOUBLE && !hybrid_on)
+        printf("ZERO-COPY HOST BUFFERS (map/unmap instead of copies)\n");
+    if(config.queues > 0 && precision == PREC_DOUBLE)
+        printf("PIPELINED OVER %d QUEUES AND %d PANELS: device busy COPY %f (sec) and KERNEL %f (sec), %.1f%% of it overlapped\n", config.queues, config.panels, time_copy, time_kernel, 100.0*overlap);
+    if(hybrid_on)
+        cl_hybrid_report(&hybrid, hybrid_engines, size);
+    printf("PARALLEL EXECUTION WITH A LOCAL WORK GROUP SIZE OF %d: %f (sec) per multiply over %d multiplies\nSplit between COPY %f (sec) and KERNEL RUNTIME %f (sec).\nOne-off overhead is composed of Inicialization time: %f (sec) and Compilation time: %f (sec)%s\n ", localSize, time_total, repetitions, time_copy, time_kernel, engine.time_init, engine.time_compile, engine.program_cached ? " (cached binary)" : "");
+
+    // Device timestamps of every write, kernel and read, the host timers above also count the enqueueing and the waits
+    if(engine.config.profiling){
+        cl_profile_report(&engine.profile);
+        if(trace_file != NULL && cl_profile_write_trace(&engine.profile, trace_file))
+            printf("trace of %d commands written to %s\n", engine.profile.count, trace_file);
     }
 
-    // Computation time
-    time1 = omp_get_wtime() - time_opencl_comp;
-    // Inicialization time
-    time2 = time_opencl_init - time_opencl;
-    // Copytime
-    time3 = time_opencl_cpy - time_opencl_init;
-    // Compilation time
-    time4 = time_opencl_comp - time_opencl_cpy;
+    //check, the whole matrix against the sequential result or the Freivalds check, see MATRIX_VERIFY
+    if(!verify_square_tol(verify, size, matrix1, matrix2, result_sq, result_pl, precision_tol(precision, size), "OPENCL")){
+        printf("wrong result of the OpenCL multiply\n");
+        release_engines(&engine, extra_engines, devices);
+        // The output file is closed without being sealed, so no reader takes the wrong result
+        if(io.output != NULL)
+            matrix_file_close(&file_c);
+        if(io.input_a != NULL){
+            matrix_file_close(&file_a);
+            matrix_file_close(&file_b);
+        }
+        arena_release(&matrices);
+        exit(EXIT_FAILURE);
+    }
 
-    
-    printf("SEQUENTIAL EXECUTION: %f (sec)\n", time_sq);
-    printf("PARALLEL EXECUTION WITH A LOCAL WORK GROUP SIZE OF %d: %f (sec)\nSplit between OVERHEAD %f (sec) and KERNEL RUNTIME %f (sec).\nOverhead is composed of Inicialization time: %f (sec), Copy time: %f (sec) and Compilation time: %f (sec)\n ", localSize, time1+time2+time3+time4, time2+time3+time4 ,time1, time2, time3, time4 );
+    release_engines(&engine, extra_engines, devices);
 
-    //check
-    int i;
-    for(i=0; i<size; i++){
-        if((int) result_sq[i] != (int) result_pl[i]){
-            printf("wrong at position %d\n", i);
-            return 0;
-        }
+    // Only a checked result is sealed, an unsealed output file is rejected by the readers
+    if(io.output != NULL){
+        if(!matrix_file_commit(&file_c))
+            exit(-1);
+        printf("OUTPUT %s: %dx%d float64 row-major, %.1f MB\n", io.output, size, size, file_c.bytes/1048576.0);
+        matrix_file_close(&file_c);
     }
-     
-    
-    //-----------------------------------------------------
-    // STEP 10: Release OpenCL resources
-    //----------------------------------------------------- 
-    
-    // Free OpenCL resources
-    clReleaseKernel(mulKernel);
-    clReleaseProgram(program);
-    clReleaseCommandQueue(cmdQueue);
-    clReleaseMemObject(bufferMatrixIn1);
-    clReleaseMemObject(bufferMatrixIn2);
-    clReleaseMemObject(bufferMatrixOut);
-    clReleaseContext(context);
 
     //Free up memory and close files
-    free(matrix1);
-    free(matrix2);
-    free(result_sq);
-    free(result_pl);
+    if(io.input_a != NULL){
+        matrix_file_close(&file_a);
+        matrix_file_close(&file_b);
+    }
+    arena_release(&matrices);
 
     return EXIT_SUCCESS;
 }
-
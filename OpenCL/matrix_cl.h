@@ -23,8 +23,9 @@
 #ifndef MAIN_H_
 #define MAIN_H_
 #include <stdio.h>
-//#include <stdlib.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 //#include <math.h>
 #include <sys/time.h>
 #include <time.h>
@@ -47,6 +48,153 @@
 /*** TYPEDEFS AND STRUCTS***/
 typedef unsigned long long timestamp_t;
 
+// Alignment of the host matrices, a whole page so the zero-copy buffers can wrap them directly
+#define CL_HOST_ALIGNMENT 4096
+
+// Largest number of command queues used by the pipelined multiply
+#define CL_MAX_QUEUES 8
+
+// Devices the hybrid multiply feeds next to the host threads, and rows of C per chunk it deals out (MATRIX_HYBRID_CHUNK)
+#define CL_HYBRID_MAX_DEVICES 4
+#define CL_HYBRID_CHUNK 64
+
+// Kernels the engine can run
+#define CL_KERNEL_NAIVE 0
+#define CL_KERNEL_TILED 1
+
+// Engine settings, filled from run_settings.ini and the command line. device is a
+// cl_device_select specification (auto, gpu, cpu, accelerator, an index or a name). tile_size and rows_per_item are the TS and WPT
+// compile-time options of mul_kernel_tiled, so they are fixed for the lifetime of the engine
+typedef struct {
+  const char *kernel_file;
+  const char *device;
+  int kernel;
+  int tile_size;
+  int rows_per_item;
+  // Pipelined multiply: number of in-order queues (0 disables it) and of row panels C is split in
+  int queues;
+  int panels;
+  // Zero-copy host buffers: 1 on, 0 off, -1 when the device reports CL_DEVICE_HOST_UNIFIED_MEMORY
+  int zero_copy;
+  // Device-side profiling of every command ([profiling] enable in run_settings.ini)
+  int profiling;
+} cl_engine_config;
+
+// Device timestamps (ns) of one profiled command
+typedef struct {
+  const char *name;
+  int queue;
+  size_t bytes;
+  double flops;
+  cl_ulong queued, submit, start, end;
+} cl_profile_record;
+
+// Every command profiled since the engine was created
+typedef struct {
+  cl_profile_record *records;
+  int count;
+  int capacity;
+} cl_profile;
+
+// Long-lived OpenCL state. Platform, context, queue, program and kernel are set up once by
+// cl_engine_init, and the device buffers are kept between multiplies and only grown when a
+// larger problem comes in, so each cl_engine_mul only pays for the transfers and the kernel
+typedef struct {
+  cl_platform_id platform;
+  cl_device_id device;
+  cl_context context;
+  cl_command_queue queue;
+  cl_command_queue pipeline_queues[CL_MAX_QUEUES];
+  cl_program program;
+  cl_kernel mul_kernel;
+  cl_kernel tiled_kernel;
+  cl_kernel batched_kernel;
+  cl_kernel batched_local_kernel;
+  // Reduced precision kernels, indexed by the PREC_ constant of common/precision.h
+  cl_kernel precision_kernels[4];
+  cl_engine_config config;
+  cl_mem buffer_in1, buffer_in2, buffer_out;
+  size_t buffer_elems;
+  // Zero-copy mode and the buffers wrapping the host matrices of the last multiply
+  int zero_copy;
+  cl_mem zc_in1, zc_in2, zc_out;
+  const void *host_in1, *host_in2, *host_out;
+  size_t host_bytes;
+  cl_profile profile;
+  // One-off setup costs, in seconds
+  double time_init;
+  double time_compile;
+  // Whether the program came from the on-disk binary cache
+  int program_cached;
+  // Whether the device does double precision, without it only the float and refine kernels exist
+  int fp64;
+} cl_engine;
+
+// Per-multiply costs, in seconds. For the pipelined multiply copy and kernel are the summed
+// device busy times of every panel, total the elapsed time and overlap the fraction of
+// copy+kernel that was hidden by running transfers and kernels of different panels at once
+typedef struct {
+  double copy;
+  double kernel;
+  double total;
+  double overlap;
+} cl_engine_times;
+
+// Hybrid multiply: the rows of C are cut in chunks dealt out to workers, worker 0 being the host
+// threads (the OpenMP blocked kernel) and worker 1+d the engine of device d. Every worker starts with
+// a share of the chunks in proportion to the rate it reached in the previous multiply, takes them from
+// the front of its share, and once out of work steals from the back of the largest share left
+typedef struct {
+  int workers;
+  int chunk_rows;
+  // Rows per second of every worker in the last multiply, 0 until it was measured
+  double rates[1 + CL_HYBRID_MAX_DEVICES];
+  // Outcome of the last multiply: chunks given at the start, done and stolen from others, time
+  // until the last chunk of the worker was done, and elapsed time of the whole multiply
+  int owned[1 + CL_HYBRID_MAX_DEVICES];
+  int done[1 + CL_HYBRID_MAX_DEVICES];
+  int stolen[1 + CL_HYBRID_MAX_DEVICES];
+  double busy[1 + CL_HYBRID_MAX_DEVICES];
+  double total;
+} cl_hybrid;
+
+const char *getErrorString(cl_int error);
+void cl_engine_config_default(cl_engine_config *config);
+cl_int cl_engine_init(cl_engine *engine, const cl_engine_config *config);
+cl_int cl_engine_require_fp64(const cl_engine *engine);
+cl_int cl_engine_mul(cl_engine *engine, cl_int size, cl_int local_size,
+                     const cl_double *matrix1_in, const cl_double *matrix2_in,
+                     cl_double *matrix_out, cl_engine_times *times);
+cl_int cl_engine_mul_pipelined(cl_engine *engine, cl_int size, cl_int local_size,
+                               const cl_double *matrix1_in, const cl_double *matrix2_in,
+                               cl_double *matrix_out, cl_engine_times *times);
+cl_int cl_engine_mul_batched(cl_engine *engine, cl_int size, cl_int count,
+                             const cl_double *matrix1_in, const cl_double *matrix2_in,
+                             cl_double *matrix_out, cl_engine_times *times);
+cl_int cl_engine_mul_precision(cl_engine *engine, cl_int size, cl_int local_size, int precision,
+                               const cl_double *matrix1_in, const cl_double *matrix2_in,
+                               cl_double *matrix_out, cl_engine_times *times);
+cl_int cl_engine_buffers(cl_engine *engine, size_t elems);
+void cl_hybrid_init(cl_hybrid *hybrid, int devices);
+cl_int cl_hybrid_mul(cl_hybrid *hybrid, cl_engine *const *engines, cl_int size, cl_int local_size,
+                     const cl_double *matrix1_in, const cl_double *matrix2_in,
+                     cl_double *matrix_out);
+void cl_hybrid_report(const cl_hybrid *hybrid, cl_engine *const *engines, cl_int size);
+void *cl_engine_host_alloc(size_t bytes);
+void cl_engine_release(cl_engine *engine);
+int settings_get(const char *file_name, const char *section, const char *key,
+                 char *value, size_t value_size);
+void cl_device_list(void);
+cl_int cl_device_select(const char *spec, cl_platform_id *platform, cl_device_id *device);
+void cl_profile_add(cl_profile *profile, cl_event event, const char *name, int queue,
+                    size_t bytes, double flops);
+void cl_profile_report(const cl_profile *profile);
+int cl_profile_write_trace(const cl_profile *profile, const char *file_name);
+void cl_profile_free(cl_profile *profile);
+cl_program cl_cache_build_program(cl_context context, cl_platform_id platform, cl_device_id device,
+                                  const char *source, size_t length, const char *options,
+                                  int *from_cache, cl_int *status);
+
 
 
 #endif /* MAIN_H_ */
@@ -0,0 +1,58 @@
+#include <ctype.h>
+#include "matrix_cl.h"
+
+
+/*****************************************************
+ Strips leading and trailing blanks in place
+ ****************************************************/
+static char *trim(char *text){
+    char *end;
+
+    while(isspace((unsigned char)*text))
+        text++;
+    end = text + strlen(text);
+    while(end > text && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return text;
+}
+
+
+/*****************************************************
+ Reads "key = value" from the given [section] of an
+ ini file such as run_settings.ini. Returns 1 and fills
+ value when the key is present, 0 otherwise
+ ****************************************************/
+int settings_get(const char *file_name, const char *section, const char *key,
+                 char *value, size_t value_size){
+    FILE *file = fopen(file_name, "r");
+    char line[512], current[128] = "";
+    int found = 0;
+
+    if(file == NULL)
+        return 0;
+
+    while(!found && fgets(line, sizeof(line), file) != NULL){
+        char *text = trim(line);
+        char *equal;
+
+        if(text[0] == '\0' || text[0] == '#' || text[0] == ';')
+            continue;
+        if(text[0] == '['){
+            char *close = strchr(text, ']');
+            if(close != NULL){
+                *close = '\0';
+                snprintf(current, sizeof(current), "%s", trim(text+1));
+            }
+            continue;
+        }
+        if(strcmp(current, section) != 0 || (equal = strchr(text, '=')) == NULL)
+            continue;
+        *equal = '\0';
+        if(strcmp(trim(text), key) == 0){
+            snprintf(value, value_size, "%s", trim(equal+1));
+            found = 1;
+        }
+    }
+    fclose(file);
+    return found;
+}
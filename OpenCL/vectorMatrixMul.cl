@@ -1,3 +1,7 @@
+// Everything but mul_kernel_float and mul_kernel_refine needs double precision, which the device compiler announces with cl_khr_fp64. Without it only those two are built, and the host only creates them
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
 __kernel void mul_kernel(global double *matrix1_in, global double *matrix2_in, global double *matrix_out, int size){
     
   // The kernel was changed to allow for a more parallelizable implementation, where each entry of the resulting matrix is calculated by a single kernel
@@ -14,3 +18,166 @@ __kernel void mul_kernel(global double *matrix1_in, global double *matrix2_in, g
 
     matrix_out[id] = value;
 }
+
+
+// Tile edge (TS) and number of result rows per work-item (WPT) of the tiled kernel, passed as -D build options by the host
+#ifndef TS
+#define TS 16
+#endif
+#ifndef WPT
+#define WPT 4
+#endif
+#define RTS (TS/WPT)
+
+__kernel __attribute__((reqd_work_group_size(TS, RTS, 1)))
+void mul_kernel_tiled(global const double *matrix1_in, global const double *matrix2_in, global double *matrix_out, int size){
+
+  // 2D NDRange: a work-group computes a TS x TS tile of the result, each of its TS x RTS work-items owning one column and WPT rows of it, spaced RTS apart
+  // The tile row is derived from the global id rather than the group id, so the host can launch a panel of rows through a global work offset
+  const int col = get_local_id(0);
+  const int row = get_local_id(1);
+  const int tile_row = TS*((get_global_id(1) - row)/RTS);
+  const int global_col = TS*get_group_id(0) + col;
+  const int global_row = tile_row + row;
+
+  // Tiles of both operands are staged in local memory, so every element loaded from global memory is reused TS times
+  local double tile1[TS][TS];
+  local double tile2[TS][TS];
+
+  double acc[WPT];
+  int t, k, w;
+
+  for(w = 0; w < WPT; w++)
+    acc[w] = 0;
+
+  for(t = 0; t < size; t += TS){
+    // Each work-item loads WPT elements of each tile, padding with zeros past the matrix edge so any size works
+    for(w = 0; w < WPT; w++){
+      int r = row + w*RTS;
+      int a_row = tile_row + r;
+      int b_row = t + r;
+      tile1[r][col] = (a_row < size && t + col < size) ? matrix1_in[a_row*size + t + col] : 0;
+      tile2[r][col] = (b_row < size && global_col < size) ? matrix2_in[b_row*size + global_col] : 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // The column of tile2 is read once per k and reused for the WPT rows kept in registers
+    for(k = 0; k < TS; k++){
+      double b = tile2[k][col];
+      for(w = 0; w < WPT; w++)
+        acc[w] += tile1[row + w*RTS][k] * b;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  for(w = 0; w < WPT; w++)
+    if(global_row + w*RTS < size && global_col < size)
+      matrix_out[(global_row + w*RTS)*size + global_col] = acc[w];
+}
+
+
+__kernel void mul_kernel_batched(global const double *matrix1_in, global const double *matrix2_in, global double *matrix_out, int size, int count){
+
+  // 2D NDRange over a whole batch of size x size products stored one after the other: dimension 0 is the entry of the result, dimension 1 the product it belongs to
+  const int id = get_global_id(0);
+  const int batch = get_global_id(1);
+  const int row = id/size;
+  const int col = id%size;
+  const long offset = (long)batch*size*size;
+  double value = 0;
+  int k;
+
+  if(id >= size*size || batch >= count)
+    return;
+  for(k = 0; k < size; k++)
+    value += matrix1_in[offset + row*size + k] * matrix2_in[offset + k*size + col];
+  matrix_out[offset + id] = value;
+}
+
+
+__kernel void mul_kernel_batched_local(global const double *matrix1_in, global const double *matrix2_in, global double *matrix_out, int size, int count,
+                                       local double *tile1, local double *tile2){
+
+  // Same index space, with one work-group per product: each work-item stages one element of both operands in local memory, so every element is read from global memory once instead of size times
+  const int id = get_local_id(0);
+  const int batch = get_group_id(1);
+  const int row = id/size;
+  const int col = id%size;
+  const long offset = (long)batch*size*size;
+  double value = 0;
+  int k;
+
+  tile1[id] = matrix1_in[offset + id];
+  tile2[id] = matrix2_in[offset + id];
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(k = 0; k < size; k++)
+    value += tile1[row*size + k] * tile2[k*size + col];
+  matrix_out[offset + id] = value;
+}
+
+#endif /* cl_khr_fp64 */
+
+
+__kernel void mul_kernel_float(global const float *matrix1_in, global const float *matrix2_in, global float *matrix_out, int size){
+
+  // mul_kernel in single precision: half the bytes moved and the full float rate of devices with slow fp64. It is outside the cl_khr_fp64 guards, so it also builds and runs on devices without any
+  int id = get_global_id(0);
+  int row = id/size;
+  int col = id%size;
+  float value = 0;
+  int k;
+
+  for(k = 0; k < size; k++)
+    value += matrix1_in[row*size + k] * matrix2_in[k*size + col];
+  matrix_out[id] = value;
+}
+
+
+__kernel void mul_kernel_refine(global const float *matrix1_in, global const float *matrix2_in, global float *matrix_out, int size){
+
+  // Double accuracy out of float arithmetic alone, so it also runs without fp64. The operands come as REFINE_SLICES slices (see precision_slices in common/precision.c) whose products are exact in float over panels of REFINE_PANEL. Every exact panel sum of the slice products Ap*Bq with p+q < REFINE_SLICES is added into a head and tail pair of floats by an error-free two-sum, and the host adds the pair up in double
+  const long elems = (long)size*size;
+  int id = get_global_id(0);
+  int row = id/size;
+  int col = id%size;
+  float head = 0, tail = 0;
+  int k0, t, p, k;
+
+  for(k0 = 0; k0 < size; k0 += REFINE_PANEL){
+    int end = min(k0 + REFINE_PANEL, size);
+    for(t = 0; t < REFINE_SLICES; t++)
+      for(p = 0; p <= t; p++){
+        global const float *a = matrix1_in + p*elems + row*size;
+        global const float *b = matrix2_in + (t-p)*elems + col;
+        float panel = 0, sum, part;
+        for(k = k0; k < end; k++)
+          panel += a[k] * b[k*size];
+        sum = head + panel;
+        part = sum - head;
+        tail += (head - (sum - part)) + (panel - part);
+        head = sum;
+      }
+  }
+  matrix_out[id] = head;
+  matrix_out[elems + id] = tail;
+}
+
+
+#ifdef cl_khr_fp64
+
+__kernel void mul_kernel_mixed(global const float *matrix1_in, global const float *matrix2_in, global double *matrix_out, int size){
+
+  // Float operands with the sums in double, the product of two floats being exact in double
+  int id = get_global_id(0);
+  int row = id/size;
+  int col = id%size;
+  double value = 0;
+  int k;
+
+  for(k = 0; k < size; k++)
+    value += (double)matrix1_in[row*size + k] * (double)matrix2_in[k*size + col];
+  matrix_out[id] = value;
+}
+
+#endif /* cl_khr_fp64 */
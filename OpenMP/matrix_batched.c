@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include "matrix_batched.h"
+
+/*****************************************************
+ Size-specialized kernel of the N x N x N product of
+ untransposed operands. The trip counts are constants,
+ so the compiler unrolls the p and j loops (completely
+ up to N = 16) and keeps a row of C in registers
+ ****************************************************/
+#define BATCH_KERNEL(N)							\
+static void batch_kernel_##N(const gemm_view *g){			\
+  const double *a = g->a, *b = g->b;					\
+  double *c = g->c;							\
+  int i, j, p;								\
+									\
+  for(i=0; i<N; i++){							\
+    double acc[N];							\
+    _Pragma("GCC unroll 16")						\
+    for(j=0; j<N; j++)							\
+      acc[j] = 0.0;							\
+    _Pragma("GCC unroll 16")						\
+    for(p=0; p<N; p++){							\
+      double a_ip = a[(long)i*g->lda + p];				\
+      _Pragma("GCC unroll 16")						\
+      for(j=0; j<N; j++)						\
+        acc[j] += a_ip * b[(long)p*g->ldb + j];				\
+    }									\
+    for(j=0; j<N; j++)							\
+      c[(long)i*g->ldc + j] = (g->beta == 0.0) ? g->alpha*acc[j]	\
+        : g->alpha*acc[j] + g->beta*c[(long)i*g->ldc + j];		\
+  }									\
+}
+
+BATCH_KERNEL(2)
+BATCH_KERNEL(3)
+BATCH_KERNEL(4)
+BATCH_KERNEL(8)
+BATCH_KERNEL(16)
+BATCH_KERNEL(32)
+BATCH_KERNEL(64)
+
+/*****************************************************
+ Any other shape: one row of op(B) at a time is added
+ into a row of C, contiguous unless B is transposed
+ ****************************************************/
+static void batch_kernel_any(const gemm_view *g){
+  int a_rs, a_cs, b_rs, b_cs;
+  int i, j, p;
+
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+  for(i=0; i<g->m; i++){
+    double *c_row = g->c + (long)i*g->ldc;
+    for(j=0; j<g->n; j++)
+      c_row[j] = (g->beta == 0.0) ? 0.0 : g->beta*c_row[j];
+    for(p=0; p<g->k; p++){
+      const double *b_row = g->b + (long)p*b_rs;
+      double a_ip = g->alpha * g->a[(long)i*a_rs + (long)p*a_cs];
+#     pragma omp simd
+      for(j=0; j<g->n; j++)
+        c_row[j] += a_ip * b_row[(long)j*b_cs];
+    }
+  }
+}
+
+/*****************************************************
+ Picks the kernel for the shape shared by the batch
+ ****************************************************/
+static void (*batch_kernel(const gemm_view *shape))(const gemm_view *g){
+  if(shape->m != shape->n || shape->n != shape->k || shape->trans_a || shape->trans_b)
+    return batch_kernel_any;
+  switch(shape->m){
+    case 2: return batch_kernel_2;
+    case 3: return batch_kernel_3;
+    case 4: return batch_kernel_4;
+    case 8: return batch_kernel_8;
+    case 16: return batch_kernel_16;
+    case 32: return batch_kernel_32;
+    case 64: return batch_kernel_64;
+    default: return batch_kernel_any;
+  }
+}
+
+static int batch_parallel(const gemm_view *shape, int count){
+  return 2.0*shape->m*shape->n*(double)shape->k*count >= BATCH_PARALLEL_FLOPS;
+}
+
+/*****************************************************
+ count independent products C[i] = alpha*op(A[i])*op(B[i])
+ + beta*C[i] of the shape given by "shape" (its pointers
+ are not used). The whole batch is shared out in a single
+ parallel region, one product per iteration
+ ****************************************************/
+void matrix_gemm_batched(const gemm_view *shape, const double *const *a,
+			 const double *const *b, double *const *c, int count){
+  void (*kernel)(const gemm_view *g) = batch_kernel(shape);
+  int i;
+
+# pragma omp parallel for schedule(static) if(batch_parallel(shape, count))
+  for(i=0; i<count; i++){
+    gemm_view g = *shape;
+    g.a = a[i];
+    g.b = b[i];
+    g.c = c[i];
+    kernel(&g);
+  }
+}
+
+/*****************************************************
+ Strided batch: product i reads shape->a + i*stride_a
+ and shape->b + i*stride_b, and writes shape->c +
+ i*stride_c (strides in elements). A stride of zero
+ shares one operand across the whole batch
+ ****************************************************/
+void matrix_gemm_batched_strided(const gemm_view *shape, long stride_a,
+				 long stride_b, long stride_c, int count){
+  void (*kernel)(const gemm_view *g) = batch_kernel(shape);
+  int i;
+
+# pragma omp parallel for schedule(static) if(batch_parallel(shape, count))
+  for(i=0; i<count; i++){
+    gemm_view g = *shape;
+    g.a = shape->a + i*stride_a;
+    g.b = shape->b + i*stride_b;
+    g.c = shape->c + i*stride_c;
+    kernel(&g);
+  }
+}
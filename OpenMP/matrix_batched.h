@@ -0,0 +1,14 @@
+#ifndef MATRIX_BATCHED_H_
+#define MATRIX_BATCHED_H_
+
+#include "../common/matrix_view.h"
+
+// Batches with fewer flops than this run on the calling thread, a parallel region costs more than the work
+#define BATCH_PARALLEL_FLOPS 200000
+
+void matrix_gemm_batched(const gemm_view *shape, const double *const *a,
+			 const double *const *b, double *const *c, int count);
+void matrix_gemm_batched_strided(const gemm_view *shape, long stride_a,
+				 long stride_b, long stride_c, int count);
+
+#endif /* MATRIX_BATCHED_H_ */
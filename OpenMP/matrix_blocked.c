@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+#include "matrix_blocked.h"
+
+/*****************************************************
+ Returns the size in bytes of the data (or unified) cache
+ of the given level, or -1 when it cannot be detected
+ ****************************************************/
+static long cache_size(int level){
+  long bytes = -1;
+  int index;
+
+  // glibc exposes the cache geometry through sysconf, which is the cheapest source when available
+  switch(level){
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    case 1: bytes = sysconf(_SC_LEVEL1_DCACHE_SIZE); break;
+    case 2: bytes = sysconf(_SC_LEVEL2_CACHE_SIZE); break;
+    case 3: bytes = sysconf(_SC_LEVEL3_CACHE_SIZE); break;
+#endif
+    default: break;
+  }
+  if(bytes > 0)
+    return bytes;
+
+  // Otherwise walk the sysfs cache description of the first cpu, skipping instruction caches
+  for(index=0; index<8; index++){
+    char path[128], type[32];
+    int lvl = 0;
+    long size = 0;
+    char unit = 0;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+    if((f = fopen(path, "r")) == NULL)
+      break;
+    if(fscanf(f, "%d", &lvl) != 1) lvl = 0;
+    fclose(f);
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+    if((f = fopen(path, "r")) == NULL)
+      continue;
+    if(fscanf(f, "%31s", type) != 1) type[0] = '\0';
+    fclose(f);
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+    if((f = fopen(path, "r")) == NULL)
+      continue;
+    if(fscanf(f, "%ld%c", &size, &unit) < 1) size = 0;
+    fclose(f);
+
+    if(lvl == level && strcmp(type, "Instruction") != 0 && size > 0){
+      if(unit == 'K') size *= 1024;
+      else if(unit == 'M') size *= 1024*1024;
+      return size;
+    }
+  }
+  return -1;
+}
+
+/*****************************************************
+ Picks the L1/L2/L3 tile sizes from the detected caches
+ ****************************************************/
+void blk_params_detect(blk_params *params){
+  long l1 = cache_size(1);
+  long l2 = cache_size(2);
+  long l3 = cache_size(3);
+
+  // Conservative defaults for machines that report nothing
+  if(l1 <= 0) l1 = 32*1024;
+  if(l2 <= 0) l2 = 256*1024;
+  if(l3 <= 0) l3 = 8*1024*1024;
+
+  // Half of each level is targeted, leaving the other half for the C tile and for the data streaming through
+  params->kc = (int)((l1/2) / ((BLK_MR + BLK_NR)*sizeof(double)));
+  params->kc -= params->kc % 8;
+  if(params->kc < 32) params->kc = 32;
+  if(params->kc > 512) params->kc = 512;
+
+  params->mc = (int)((l2/2) / (params->kc*sizeof(double)));
+  params->mc -= params->mc % BLK_MR;
+  if(params->mc < BLK_MR) params->mc = BLK_MR;
+  if(params->mc > 1024) params->mc = 1024;
+
+  // L3 is shared, so each thread only gets its share of it for its own B panel
+  params->nc = (int)((l3/2/omp_get_max_threads()) / (params->kc*sizeof(double)));
+  params->nc -= params->nc % BLK_NR;
+  if(params->nc < BLK_NR) params->nc = BLK_NR;
+  if(params->nc > 4096) params->nc = 4096;
+}
+
+/*****************************************************
+ Copies a mc x kc block of op(A) into MR-row slivers, each
+ stored column by column and zero padded to MR rows. The
+ strides absorb the transposition, so it costs nothing extra
+ ****************************************************/
+static void pack_a(int mc, int kc, const double *a, int rs, int cs, double *buf){
+  int ir, i, p;
+
+  for(ir=0; ir<mc; ir+=BLK_MR){
+    for(p=0; p<kc; p++){
+      for(i=0; i<BLK_MR; i++)
+        buf[p*BLK_MR + i] = (ir+i < mc) ? a[(long)(ir+i)*rs + (long)p*cs] : 0.0;
+    }
+    buf += BLK_MR*kc;
+  }
+}
+
+/*****************************************************
+ Copies a kc x nc block of op(B) into NR-column slivers,
+ each stored row by row and zero padded to NR columns
+ ****************************************************/
+static void pack_b(int kc, int nc, const double *b, int rs, int cs, double *buf){
+  int jr, j, p;
+
+  for(jr=0; jr<nc; jr+=BLK_NR){
+    for(p=0; p<kc; p++){
+      for(j=0; j<BLK_NR; j++)
+        buf[p*BLK_NR + j] = (jr+j < nc) ? b[(long)p*rs + (long)(jr+j)*cs] : 0.0;
+    }
+    buf += BLK_NR*kc;
+  }
+}
+
+/*****************************************************
+ Register-blocked micro-kernel: C[mr x nr] = alpha*Apanel*Bpanel
+ + beta*C, beta being 1 for every panel after the first
+ ****************************************************/
+static void micro_kernel(int kc, const double *a, const double *b,
+			 double *c, int ldc, int mr, int nr, double alpha, double beta){
+  double acc[BLK_MR][BLK_NR];
+  int i, j, p;
+
+  for(i=0; i<BLK_MR; i++)
+    for(j=0; j<BLK_NR; j++)
+      acc[i][j] = 0.0;
+
+  // Each step is a rank-1 update of the MR x NR register tile, the inner j loop being contiguous in the packed B sliver so the compiler turns it into vector FMAs
+  for(p=0; p<kc; p++){
+    for(i=0; i<BLK_MR; i++){
+      double a_ip = a[p*BLK_MR + i];
+      for(j=0; j<BLK_NR; j++)
+        acc[i][j] += a_ip * b[p*BLK_NR + j];
+    }
+  }
+
+  // Only the valid part of the tile is written back, padding rows/columns of the packed panels are dropped here
+  for(i=0; i<mr; i++){
+    for(j=0; j<nr; j++){
+      if(beta == 0.0) c[(long)i*ldc + j] = alpha*acc[i][j];
+      else if(beta == 1.0) c[(long)i*ldc + j] += alpha*acc[i][j];
+      else c[(long)i*ldc + j] = alpha*acc[i][j] + beta*c[(long)i*ldc + j];
+    }
+  }
+}
+
+/*****************************************************
+ Blocked multiplication of any view. The result is split
+ in mc x nc macro-tiles, each owned by a single thread
+ ****************************************************/
+void matrix_gemm_blk(const gemm_view *g){
+  blk_params params;
+  int tiles_m, tiles_n, nthreads;
+  int a_rs, a_cs, b_rs, b_cs;
+
+  blk_params_detect(&params);
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+
+  // Shrink the macro-tiles until every thread has at least one of them to work on. Called from inside a parallel region (e.g. a Strassen task) the kernel runs on the calling thread alone
+  nthreads = omp_in_parallel() ? 1 : omp_get_max_threads();
+  tiles_m = (g->m + params.mc - 1) / params.mc;
+  tiles_n = (g->n + params.nc - 1) / params.nc;
+  while(tiles_m*tiles_n < nthreads && (params.nc > BLK_NR || params.mc > BLK_MR)){
+    if(params.nc >= params.mc && params.nc > BLK_NR){
+      params.nc /= 2;
+      params.nc += (BLK_NR - params.nc % BLK_NR) % BLK_NR;
+    }else{
+      params.mc /= 2;
+      params.mc += (BLK_MR - params.mc % BLK_MR) % BLK_MR;
+    }
+    tiles_m = (g->m + params.mc - 1) / params.mc;
+    tiles_n = (g->n + params.nc - 1) / params.nc;
+  }
+
+# pragma omp parallel if(nthreads > 1) \
+    shared(g, params, tiles_m, tiles_n, a_rs, a_cs, b_rs, b_cs)
+  {
+    // Packing buffers are private to every thread, sized for a full (padded) block
+    double *a_pack = (double *)aligned_alloc(64, sizeof(double)*params.kc*(params.mc + BLK_MR));
+    double *b_pack = (double *)aligned_alloc(64, sizeof(double)*params.kc*(params.nc + BLK_NR));
+    int tile;
+
+    if(a_pack == NULL || b_pack == NULL){
+      printf("can't allocate the packing buffers of the blocked kernel\n");
+      exit(-1);
+    }
+
+    // Macro-tiles of C are dealt out dynamically, so a thread always writes whole tiles and no two threads ever touch the same element of C
+#   pragma omp for schedule(dynamic, 1)
+    for(tile=0; tile<tiles_m*tiles_n; tile++){
+      int ic = (tile / tiles_n) * params.mc;
+      int jc = (tile % tiles_n) * params.nc;
+      int mc = (g->m - ic < params.mc) ? g->m - ic : params.mc;
+      int nc = (g->n - jc < params.nc) ? g->n - jc : params.nc;
+      int pc, ir, jr;
+
+      // An empty inner dimension still has to apply beta to the tile, beta == 0 storing 0 over a NaN or Inf in C
+      if(g->k == 0){
+        for(ir=0; ir<mc; ir++)
+          for(jr=0; jr<nc; jr++)
+            g->c[(long)(ic+ir)*g->ldc + jc + jr] = (g->beta == 0.0) ? 0.0 : g->beta*g->c[(long)(ic+ir)*g->ldc + jc + jr];
+        continue;
+      }
+
+      for(pc=0; pc<g->k; pc+=params.kc){
+        int kc = (g->k - pc < params.kc) ? g->k - pc : params.kc;
+
+        pack_b(kc, nc, &g->b[(long)pc*b_rs + (long)jc*b_cs], b_rs, b_cs, b_pack);
+        pack_a(mc, kc, &g->a[(long)ic*a_rs + (long)pc*a_cs], a_rs, a_cs, a_pack);
+
+        for(jr=0; jr<nc; jr+=BLK_NR){
+          int nr = (nc - jr < BLK_NR) ? nc - jr : BLK_NR;
+          for(ir=0; ir<mc; ir+=BLK_MR){
+            int mr = (mc - ir < BLK_MR) ? mc - ir : BLK_MR;
+            micro_kernel(kc, &a_pack[ir*kc], &b_pack[jr*kc],
+                         &g->c[(long)(ic+ir)*g->ldc + jc + jr], g->ldc, mr, nr,
+                         g->alpha, (pc > 0) ? 1.0 : g->beta);
+          }
+        }
+      }
+    }
+
+    free(a_pack);
+    free(b_pack);
+  }
+}
+
+/*****************************************************
+ Blocked multiplication of a square matrix
+ ****************************************************/
+void matrix_mult_blk(int size, double *matrix1_in,
+		       double *matrix2_in, double *matrix_out){
+  gemm_view g;
+
+  gemm_view_square(&g, size, matrix1_in, matrix2_in, matrix_out);
+  matrix_gemm_blk(&g);
+}
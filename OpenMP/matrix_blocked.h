@@ -0,0 +1,23 @@
+#ifndef MATRIX_BLOCKED_H_
+#define MATRIX_BLOCKED_H_
+
+#include "../common/matrix_view.h"
+
+// Register tile computed by the micro-kernel: MR rows of A times NR columns of B are kept in registers for a whole KC-deep rank update
+#define BLK_MR 4
+#define BLK_NR 8
+
+/*** TYPEDEFS AND STRUCTS***/
+// Tile sizes of the blocked engine. kc is chosen so a packed A sliver and B sliver stay in L1, mc so the packed A block stays in L2 and nc so the packed B panel fits in the share of L3 owned by one thread
+typedef struct {
+  int mc;
+  int kc;
+  int nc;
+} blk_params;
+
+void blk_params_detect(blk_params *params);
+void matrix_gemm_blk(const gemm_view *g);
+void matrix_mult_blk(int size, double *matrix1_in,
+		       double *matrix2_in, double *matrix_out);
+
+#endif /* MATRIX_BLOCKED_H_ */
@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <omp.h>
+#include "matrix_numa.h"
+
+// Pages are queried from the kernel in batches of this many
+#define NUMA_QUERY_BATCH 1024
+
+static const char *mode_names[] = { "off", "first-touch", "interleave", "replicate" };
+
+
+/*****************************************************
+ Placement mode from the MATRIX_NUMA environment
+ variable (off, first-touch, interleave or replicate)
+ ****************************************************/
+int numa_mode(void){
+  const char *value = getenv("MATRIX_NUMA");
+  int mode;
+
+  if(value == NULL)
+    return NUMA_OFF;
+  for(mode=NUMA_OFF; mode<=NUMA_REPLICATE; mode++)
+    if(strcmp(value, mode_names[mode]) == 0)
+      return mode;
+  printf("unknown MATRIX_NUMA value %s, expected off, first-touch, interleave or replicate\n", value);
+  return NUMA_OFF;
+}
+
+
+/*****************************************************
+ Parses a sysfs list such as "0-3,8-11", calling back
+ for every number in it. Returns the largest one
+ ****************************************************/
+static int parse_sysfs_list(const char *path, void (*add)(int value, void *context), void *context){
+  char line[4096], *item, *save;
+  int largest = -1;
+  FILE *file = fopen(path, "r");
+
+  if(file == NULL)
+    return -1;
+  if(fgets(line, sizeof(line), file) == NULL){
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+
+  // strtok_r, the threads parse their node's cpu list at the same time
+  for(item=strtok_r(line, ",\n", &save); item != NULL; item=strtok_r(NULL, ",\n", &save)){
+    int first, last, value;
+    if(sscanf(item, "%d-%d", &first, &last) != 2)
+      last = first = atoi(item);
+    for(value=first; value<=last; value++)
+      if(add != NULL)
+        add(value, context);
+    if(last > largest)
+      largest = last;
+  }
+  return largest;
+}
+
+static void add_cpu(int cpu, void *context){
+  CPU_SET(cpu, (cpu_set_t *)context);
+}
+
+static int current_node(void){
+  unsigned int cpu = 0, node = 0;
+  if(syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+    return 0;
+  return (int)node;
+}
+
+static unsigned long all_nodes_mask(const numa_config *numa){
+  return (numa->nodes >= (int)(8*sizeof(unsigned long))) ? ~0UL : (1UL << numa->nodes) - 1;
+}
+
+
+/*****************************************************
+ Finds the nodes and pins the threads. When OMP_PROC_BIND
+ (and OMP_PLACES) already bind the team the runtime's
+ placement is kept, otherwise thread t is pinned to the
+ cpus of node t*nodes/threads, so the contiguous row
+ chunks of the static schedule go to the nodes in order
+ ****************************************************/
+void numa_setup(numa_config *numa, int mode){
+  memset(numa, 0, sizeof(*numa));
+  numa->mode = mode;
+  numa->nodes = parse_sysfs_list("/sys/devices/system/node/online", NULL, NULL) + 1;
+  if(numa->nodes <= 0)
+    numa->nodes = 1;
+  if(numa->nodes > NUMA_MAX_NODES)
+    numa->nodes = NUMA_MAX_NODES;
+  if(mode == NUMA_OFF)
+    return;
+
+  if(omp_get_proc_bind() != omp_proc_bind_false){
+    printf("NUMA %s over %d nodes, threads bound by OMP_PROC_BIND over %d places\n",
+           mode_names[mode], numa->nodes, omp_get_num_places());
+    return;
+  }
+  if(numa->nodes == 1){
+    printf("NUMA %s on a single node, every page is local\n", mode_names[mode]);
+    return;
+  }
+# pragma omp parallel shared(numa)
+  {
+    char path[128];
+    cpu_set_t cpus;
+    int node = omp_get_thread_num() * numa->nodes / omp_get_num_threads();
+
+    CPU_ZERO(&cpus);
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if(parse_sysfs_list(path, add_cpu, &cpus) >= 0 && sched_setaffinity(0, sizeof(cpus), &cpus) == 0){
+#     pragma omp atomic
+      numa->pinned++;
+    }
+  }
+  printf("NUMA %s over %d nodes, %d threads pinned to their node's cpus (set OMP_PROC_BIND/OMP_PLACES to choose the places)\n",
+         mode_names[mode], numa->nodes, numa->pinned);
+}
+
+
+/*****************************************************
+ Allocates a replica of B, page aligned and untouched
+ so mbind decides where its pages go
+ ****************************************************/
+static double *numa_alloc(size_t elems){
+  void *memory;
+
+  if(posix_memalign(&memory, sysconf(_SC_PAGESIZE), sizeof(double)*elems) != 0)
+    return NULL;
+  return (double *)memory;
+}
+
+
+/*****************************************************
+ Zeroes a size x size matrix with the same static
+ schedule of the flattened m*n loop as matrix_gemm_pl,
+ so the pages of each row chunk land on the node of
+ the thread that later reads A or writes C there
+ ****************************************************/
+void numa_first_touch(const numa_config *numa, double *matrix, int size){
+  long i;
+
+  if(numa->mode == NUMA_OFF)
+    return;
+# pragma omp parallel for schedule(static)
+  for(i=0; i<(long)size*size; i++)
+    matrix[i] = 0.0;
+}
+
+
+/*****************************************************
+ Places B, which every thread reads whole: first touched
+ like A, or interleaved page by page over all nodes
+ ****************************************************/
+void numa_place_shared(const numa_config *numa, double *matrix, int size){
+  if(numa->mode == NUMA_INTERLEAVE && numa->nodes > 1){
+    unsigned long mask = all_nodes_mask(numa);
+    size_t bytes = sizeof(double)*(size_t)size*size;
+    if(syscall(SYS_mbind, matrix, bytes, MPOL_INTERLEAVE, &mask, 8*sizeof(unsigned long), 0) != 0)
+      printf("mbind(MPOL_INTERLEAVE) failed: %s, B is first touched instead\n", strerror(errno));
+  }
+  numa_first_touch(numa, matrix, size);
+}
+
+
+/*****************************************************
+ In the replicate mode, copies B once per node, each
+ copy bound to its node, once B holds its values
+ ****************************************************/
+void numa_replicate(numa_config *numa, const double *matrix, int size){
+  size_t bytes = sizeof(double)*(size_t)size*size;
+  int node;
+
+  // A single node reads the original
+  if(numa->mode != NUMA_REPLICATE || numa->nodes == 1)
+    return;
+  for(node=0; node<numa->nodes; node++){
+    unsigned long mask = 1UL << node;
+    double *replica = numa_alloc((size_t)size*size);
+    if(replica == NULL){
+      printf("can't allocate the replica of B for node %d\n", node);
+      continue;
+    }
+    if(numa->nodes > 1 && syscall(SYS_mbind, replica, bytes, MPOL_BIND, &mask, 8*sizeof(unsigned long), 0) != 0)
+      printf("mbind(MPOL_BIND) to node %d failed: %s\n", node, strerror(errno));
+    memcpy(replica, matrix, bytes);
+    numa->b_replicas[node] = replica;
+  }
+}
+
+
+/*****************************************************
+ The copy of B on the calling thread's node, or B itself
+ when there is none
+ ****************************************************/
+const double *numa_local_replica(const numa_config *numa, const double *matrix){
+  int node = current_node();
+
+  if(numa->mode != NUMA_REPLICATE || node >= NUMA_MAX_NODES || numa->b_replicas[node] == NULL)
+    return matrix;
+  return numa->b_replicas[node];
+}
+
+
+/*****************************************************
+ Adds up, for the pages spanned by [start, start+bytes),
+ how many are on node (counts[0]), on another node
+ (counts[1]) or not placed yet (counts[2])
+ ****************************************************/
+static void count_pages(const void *start, size_t bytes, int node, long counts[3]){
+  long page_size = sysconf(_SC_PAGESIZE);
+  char *first = (char *)((unsigned long)start & ~(unsigned long)(page_size-1));
+  char *end = (char *)start + bytes;
+  void *pages[NUMA_QUERY_BATCH];
+  int status[NUMA_QUERY_BATCH];
+
+  while(first < end){
+    int count = 0, p;
+    for(; count < NUMA_QUERY_BATCH && first < end; count++, first += page_size)
+      pages[count] = first;
+    // With no target nodes move_pages only reports where each page is
+    if(syscall(SYS_move_pages, 0, count, pages, NULL, status, 0) != 0){
+      counts[2] += count;
+      continue;
+    }
+    for(p=0; p<count; p++)
+      counts[(status[p] == node) ? 0 : (status[p] >= 0) ? 1 : 2]++;
+  }
+}
+
+
+/*****************************************************
+ For every thread, the pages of the A rows it reads, of
+ the C rows it writes (its chunk of the static schedule
+ of matrix_gemm_pl) and of the B it reads, split into
+ local and remote to the node it runs on
+ ****************************************************/
+void numa_report(const numa_config *numa, const gemm_view *g, const char *kernel){
+  long totals[3][3];
+
+  if(numa->mode == NUMA_OFF)
+    return;
+  memset(totals, 0, sizeof(totals));
+  printf("NUMA PLACEMENT OF %s (pages local/remote/unplaced)\n", kernel);
+
+# pragma omp parallel shared(totals)
+  {
+    long counts[3][3];
+    long i, first = -1, last = -1;
+    int node = current_node();
+    int o, s;
+    const double *b = numa_local_replica(numa, g->b);
+
+    // The chunk of the flattened loop this thread gets from the static schedule
+#   pragma omp for schedule(static) nowait
+    for(i=0; i<(long)g->m*g->n; i++){
+      if(first < 0)
+        first = i;
+      last = i;
+    }
+
+    memset(counts, 0, sizeof(counts));
+    if(first >= 0){
+      long row_begin = first / g->n, row_end = last / g->n + 1;
+      count_pages(g->a + row_begin*g->lda, sizeof(double)*(row_end-row_begin)*g->lda, node, counts[0]);
+      count_pages(b, sizeof(double)*(size_t)g->k*g->ldb, node, counts[1]);
+      count_pages(g->c + row_begin*g->ldc, sizeof(double)*(row_end-row_begin)*g->ldc, node, counts[2]);
+    }
+
+#   pragma omp critical
+    {
+      printf("  thread %3d on node %d: A %ld/%ld/%ld, B %ld/%ld/%ld, C %ld/%ld/%ld\n",
+             omp_get_thread_num(), node, counts[0][0], counts[0][1], counts[0][2],
+             counts[1][0], counts[1][1], counts[1][2], counts[2][0], counts[2][1], counts[2][2]);
+      for(o=0; o<3; o++)
+        for(s=0; s<3; s++)
+          totals[o][s] += counts[o][s];
+    }
+  }
+
+  printf("  total: %ld local and %ld remote pages (A %ld/%ld, B %ld/%ld, C %ld/%ld)\n",
+         totals[0][0] + totals[1][0] + totals[2][0], totals[0][1] + totals[1][1] + totals[2][1],
+         totals[0][0], totals[0][1], totals[1][0], totals[1][1], totals[2][0], totals[2][1]);
+}
+
+
+void numa_release(numa_config *numa){
+  int node;
+
+  for(node=0; node<NUMA_MAX_NODES; node++){
+    free(numa->b_replicas[node]);
+    numa->b_replicas[node] = NULL;
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef MATRIX_NUMA_H_
+#define MATRIX_NUMA_H_
+
+#include <stddef.h>
+#include "../common/matrix_view.h"
+
+// Page placement modes, picked through the MATRIX_NUMA environment variable
+#define NUMA_OFF         0
+#define NUMA_FIRST_TOUCH 1
+#define NUMA_INTERLEAVE  2
+#define NUMA_REPLICATE   3
+
+// Largest node id handled, node masks being a single unsigned long
+#define NUMA_MAX_NODES 64
+
+/*** TYPEDEFS AND STRUCTS***/
+// Placement of the operands. In every mode but off, A and C are first touched by the threads that
+// compute their rows; B, read by all threads, is first touched the same way, interleaved page by
+// page over the nodes, or copied once per node (b_replicas, indexed by node id)
+typedef struct {
+  int mode;
+  int nodes;
+  int pinned;
+  double *b_replicas[NUMA_MAX_NODES];
+} numa_config;
+
+int numa_mode(void);
+void numa_setup(numa_config *numa, int mode);
+void numa_first_touch(const numa_config *numa, double *matrix, int size);
+void numa_place_shared(const numa_config *numa, double *matrix, int size);
+void numa_replicate(numa_config *numa, const double *matrix, int size);
+const double *numa_local_replica(const numa_config *numa, const double *matrix);
+void numa_report(const numa_config *numa, const gemm_view *g, const char *kernel);
+void numa_release(numa_config *numa);
+
+#endif /* MATRIX_NUMA_H_ */
@@ -1,109 +1,703 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <omp.h>
+#include "../common/matrix_view.h"
+#include "../common/bench.h"
+#include "../common/perf_counters.h"
+#include "../common/verify.h"
+#include "../common/matrix_rng.h"
+#include "../common/arena.h"
+#include "../common/precision.h"
+#include "../common/matrix_io.h"
+#include "matrix_blocked.h"
+#include "matrix_numa.h"
+#include "matrix_strassen.h"
+#include "matrix_recursive.h"
+#include "matrix_batched.h"
+#include "matrix_ooc.h"
 
 /*****************************************************
 the following function generates a "size"-element vector
-and a "size x size" matrix
+and a "size x size" matrix from its stream of the
+counter-based generator (see matrix_rng.h), in parallel
+and identical for any thread count
  ****************************************************/
-void matrix_gen(int size, double *matrix){
-  int i;
-  for(i=0; i<size*size; i++)
-      matrix[i] = ((double)rand())/5307.0;
+void matrix_gen(int size, double *matrix, int stream){
+  matrix_random(matrix, size, size, size, matrix_seed(), stream);
 }
 
 /****************************************************
-
+ Sequential reference on any view, the square driver
+ case being the dense size x size product
  ***************************************************/
 void matrix_mult_sq(int size, double *matrix1_in,
 		       double *matrix2_in, double *matrix_out){
-  int rows, cols;
-  int j;
-
-  // For cycle added to implement a sequential, matrix by matrix, multiplication that repeats the code given for the vector by matrix multipication for every row of the first operand's matrix
-  for(rows=0; rows<size; rows++){
-    for(cols=0; cols<size; cols++){
-      matrix_out[rows*size + cols] = 0.0;
-      for(j=0; j<size; j++)
-        matrix_out[rows*size + cols] += matrix1_in[ rows*size + j ] * matrix2_in[j*size+ cols];
-    }
-  }
+  gemm_view g;
+
+  gemm_view_square(&g, size, matrix1_in, matrix2_in, matrix_out);
+  matrix_gemm_ref(&g);
 }
 
 /****************************************************
-
+ Parallel version of the reference, one result entry
+ per iteration of the flattened m*n loop
  ***************************************************/
-void matrix_mult_pl(int size, double *matrix1_in,
-		       double *matrix2_in, double *matrix_out){
+void matrix_gemm_pl(const gemm_view *g){
+  int a_rs, a_cs, b_rs, b_cs;
   int row, col;
   int j, i;
-    
+
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+
 // Changes the for loop behavior to a more (the most) parallelizable implementation, where each entry of the resulting matrix is calculated by a single thread.
 # pragma omp parallel				\
-    shared(size, matrix1_in, matrix2_in, matrix_out, i)	\
+    shared(g, a_rs, a_cs, b_rs, b_cs)	\
     private(row, col, j)
 # pragma omp for
     // Each thread is assigned a row of the first operand and a column of the second operand, that is computes (multiplying its entries and adding them together) to achieve the final result for that specific entry in the resulting matrix
-    for(i=0; i<size*size; i++){
-        row= (i/size);
-        col= (i%size);
-        matrix_out[i] = 0.0;
-        for(j=0; j<size; j++){
-            matrix_out[i] += matrix1_in[ (row*size)+j ] * matrix2_in[ col+ (j*size) ];
+    for(i=0; i<g->m*g->n; i++){
+        double value = 0.0;
+        row= (i/g->n);
+        col= (i%g->n);
+        for(j=0; j<g->k; j++){
+            value += g->a[ (long)row*a_rs + (long)j*a_cs ] * g->b[ (long)col*b_cs + (long)j*b_rs ];
         }
+        if(g->beta == 0.0)
+            g->c[ (long)row*g->ldc + col ] = g->alpha*value;
+        else
+            g->c[ (long)row*g->ldc + col ] = g->alpha*value + g->beta*g->c[ (long)row*g->ldc + col ];
+    }
+}
+
+/****************************************************
+ matrix_gemm_pl for the replicate NUMA mode, each thread
+ reading B from the copy on its own node. The loop and
+ its schedule are the ones of matrix_gemm_pl, so the
+ result is the same
+ ***************************************************/
+void matrix_gemm_pl_numa(const gemm_view *g, const numa_config *numa){
+  int a_rs, a_cs, b_rs, b_cs;
+  int i;
+
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+
+# pragma omp parallel shared(g, numa, a_rs, a_cs, b_rs, b_cs)
+  {
+    const double *b = numa_local_replica(numa, g->b);
+    int row, col, j;
+
+#   pragma omp for
+    for(i=0; i<g->m*g->n; i++){
+        double value = 0.0;
+        row= (i/g->n);
+        col= (i%g->n);
+        for(j=0; j<g->k; j++){
+            value += g->a[ (long)row*a_rs + (long)j*a_cs ] * b[ (long)col*b_cs + (long)j*b_rs ];
+        }
+        if(g->beta == 0.0)
+            g->c[ (long)row*g->ldc + col ] = g->alpha*value;
+        else
+            g->c[ (long)row*g->ldc + col ] = g->alpha*value + g->beta*g->c[ (long)row*g->ldc + col ];
+    }
+  }
+}
+
+/****************************************************
+
+ ***************************************************/
+void matrix_mult_pl(int size, double *matrix1_in,
+		       double *matrix2_in, double *matrix_out){
+  gemm_view g;
+
+  gemm_view_square(&g, size, matrix1_in, matrix2_in, matrix_out);
+  matrix_gemm_pl(&g);
+}
+
+
+/****************************************************
+ Recursive multiplication of any view with the leaf
+ size of MATRIX_REC_LEAF, the signature of the others
+ ***************************************************/
+static void matrix_gemm_rec_default(const gemm_view *g){
+  matrix_gemm_rec(g, rec_leaf_size());
+}
+
+/****************************************************
+ Times the static parallel kernel and the task-based
+ recursive one on 1, 2, 4, ... threads up to the
+ current maximum, with their speedups over one thread
+ ***************************************************/
+void scaling_report(int size, double *matrix1, double *matrix2, double *result){
+  int max_threads = omp_get_max_threads();
+  double time_pl_1 = 0, time_rec_1 = 0;
+  gemm_view g;
+  int threads;
+
+  gemm_view_square(&g, size, matrix1, matrix2, result);
+  printf("SCALING OF THE STATIC AND TASK-BASED KERNELS (leaf %d)\n", rec_leaf_size());
+  printf("  threads   static (sec) speedup efficiency    tasks (sec) speedup efficiency\n");
+  for(threads=1; ; threads = (2*threads < max_threads) ? 2*threads : max_threads){
+    double time_pl, time_rec;
+
+    omp_set_num_threads(threads);
+    time_pl = omp_get_wtime();
+    matrix_gemm_pl(&g);
+    time_pl = omp_get_wtime() - time_pl;
+    time_rec = omp_get_wtime();
+    matrix_gemm_rec_default(&g);
+    time_rec = omp_get_wtime() - time_rec;
+    if(threads == 1){
+      time_pl_1 = time_pl;
+      time_rec_1 = time_rec;
+    }
+    printf("  %7d %14f %7.2f %9.1f%% %14f %7.2f %9.1f%%\n", threads,
+	   time_pl, time_pl_1/time_pl, 100.0*time_pl_1/time_pl/threads,
+	   time_rec, time_rec_1/time_rec, 100.0*time_rec_1/time_rec/threads);
+    if(threads == max_threads)
+      break;
+  }
+  omp_set_num_threads(max_threads);
+}
+
+
+/****************************************************
+ Runs the multiply in every precision (the blocked
+ kernel for double, the float row kernels for the
+ others) and reports time, rate and, when the
+ sequential result is there, the normwise error
+ ***************************************************/
+int precision_report(int size, double *matrix1, double *matrix2, double *reference,
+		     double *result, int verify){
+  precision_kernels kernels = { matrix_gemm_blk, NULL, NULL };
+  double flops = 2.0*size*(double)size*size;
+  gemm_view g;
+  double time_double = 0;
+  int precision, ok = 1;
+
+  gemm_view_square(&g, size, matrix1, matrix2, result);
+  for(precision=PREC_DOUBLE; precision<=PREC_REFINE; precision++){
+    char kernel[32];
+    double time = omp_get_wtime();
+    matrix_gemm_precision(&g, precision, &kernels);
+    time = omp_get_wtime() - time;
+    if(precision == PREC_DOUBLE)
+      time_double = time;
+
+    // The rate next to double's, refine included, which pays 21 float products per panel for its double accuracy
+    printf("PRECISION %s WITH %d (threads): %f (sec), %.2f GFLOP/s, %.2fx the double rate", precision_name(precision),
+	   omp_get_max_threads(), time, flops/time*1e-9, time_double/time);
+    if(verify == VERIFY_FULL)
+      printf(", normwise error %.3e\n", matrix_normwise_error(&g, reference));
+    else
+      printf("\n");
+    snprintf(kernel, sizeof(kernel), "PRECISION %s", precision_name(precision));
+    ok &= verify_square_tol(verify, size, matrix1, matrix2, reference, result,
+			    precision_tol(precision, size), kernel);
+  }
+  return ok;
+}
+
+
+/*** TYPEDEFS AND STRUCTS***/
+// One kernel call of the bench mode
+typedef struct {
+  void (*kernel)(const gemm_view *g);
+  gemm_view g;
+} bench_call;
+
+static void bench_call_run(void *context){
+  bench_call *call = (bench_call *)context;
+  call->kernel(&call->g);
+}
+
+/****************************************************
+ bench mode: sweeps sizes and thread counts over the
+ sequential, parallel, blocked and recursive kernels
+ ***************************************************/
+int bench_main(int argc, char *argv[]){
+  const char *names[] = {"pl", "blk", "rec"};
+  void (*kernels[])(const gemm_view *g) = {matrix_gemm_pl, matrix_gemm_blk, matrix_gemm_rec_default};
+  bench_config config;
+  bench_output output;
+  arena matrices;
+  int s, t, k, largest = 0;
+
+  if(!bench_parse_args(argc, argv, &config) || !bench_open(&output, &config))
+    return 0;
+
+  // One arena sized for the largest matrices is reused by every size of the sweep
+  for(s=0; s<config.num_sizes; s++)
+    if(config.sizes[s] > largest)
+      largest = config.sizes[s];
+  if(!arena_init(&matrices, 3*arena_matrix_bytes(largest, largest, ARENA_ALIGN)))
+    return 0;
+
+  for(s=0; s<config.num_sizes; s++){
+    int size = config.sizes[s];
+    double *matrix1, *matrix2, *result;
+    bench_result sq = {.backend = "omp", .kernel = "sq", .size = size, .threads = 1};
+    bench_call call;
+
+    arena_reset(&matrices);
+    matrix1 = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+    matrix2 = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+    result = arena_matrix(&matrices, size, size, ARENA_ALIGN);
+    matrix_gen(size, matrix1, MATRIX_STREAM_A);
+    matrix_gen(size, matrix2, MATRIX_STREAM_B);
+    gemm_view_square(&call.g, size, matrix1, matrix2, result);
+
+    // The sequential kernel is the baseline of every speedup, so it always runs
+    call.kernel = matrix_gemm_ref;
+    bench_measure(bench_call_run, &call, &config, &sq);
+    sq.speedup = 1.0;
+    if(bench_kernel_enabled(&config, "sq"))
+      bench_emit(&output, &sq);
+
+    for(t=0; t<config.num_threads; t++){
+      omp_set_num_threads(config.threads[t]);
+      for(k=0; k<3; k++){
+        bench_result r = {.backend = "omp", .kernel = names[k], .size = size, .threads = config.threads[t]};
+        if(!bench_kernel_enabled(&config, names[k]))
+          continue;
+        call.kernel = kernels[k];
+        bench_measure(bench_call_run, &call, &config, &r);
+        r.speedup = sq.median / r.median;
+        bench_emit(&output, &r);
+      }
     }
+  }
+  arena_release(&matrices);
+  bench_close(&output);
+  return 1;
+}
+
+
+/****************************************************
+ Fills the n values of c with NaN, so a multiply that
+ leaves any of them unwritten fails its check
+ ***************************************************/
+static void batch_poison(double *c, long n){
+  long i;
+
+  for(i=0; i<n; i++)
+    c[i] = NAN;
+}
+
+
+/****************************************************
+ batch mode: count independent size x size products,
+ one matrix_gemm_pl per pair against the batched
+ interfaces (pointer arrays and strided), all checked
+ against the sequential kernel
+ ***************************************************/
+int batch_main(int argc, char *argv[]){
+  int size = (argc > 0) ? atoi(argv[0]) : 0;
+  int count = (argc > 1) ? atoi(argv[1]) : 0;
+  long elems = (long)size*size;
+  double flops = 2.0*elems*size*count;
+  double time_sq, time_pl, time_ptr, time_str;
+  const double **a_ptr, **b_ptr;
+  double **c_ptr;
+  double *a, *b, *c, *reference;
+  arena matrices;
+  gemm_view g;
+  int i, ok;
+
+  if(size <= 0 || count <= 0){
+    printf("incorrect arguments, expected batch size count with both greater than zero\n");
+    return 0;
+  }
+  // The batch of each operand is one count*size x size matrix, product i using its rows [i*size, (i+1)*size)
+  if(!arena_init(&matrices, 4*arena_matrix_bytes(count*size, size, ARENA_ALIGN))){
+    printf("can't allocate the required memory for the matrices\n");
+    return 0;
+  }
+  a = arena_matrix(&matrices, count*size, size, ARENA_ALIGN);
+  b = arena_matrix(&matrices, count*size, size, ARENA_ALIGN);
+  c = arena_matrix(&matrices, count*size, size, ARENA_ALIGN);
+  reference = arena_matrix(&matrices, count*size, size, ARENA_ALIGN);
+  matrix_random(a, count*size, size, size, matrix_seed(), MATRIX_STREAM_A);
+  matrix_random(b, count*size, size, size, matrix_seed(), MATRIX_STREAM_B);
+
+  a_ptr = (const double **)malloc(sizeof(double *)*count);
+  b_ptr = (const double **)malloc(sizeof(double *)*count);
+  c_ptr = (double **)malloc(sizeof(double *)*count);
+  if(a_ptr == NULL || b_ptr == NULL || c_ptr == NULL){
+    printf("can't allocate the pointer arrays of the batch\n");
+    return 0;
+  }
+  for(i=0; i<count; i++){
+    a_ptr[i] = a + i*elems;
+    b_ptr[i] = b + i*elems;
+    c_ptr[i] = c + i*elems;
+  }
+
+  time_sq = omp_get_wtime();
+  for(i=0; i<count; i++)
+    matrix_mult_sq(size, a + i*elems, b + i*elems, reference + i*elems);
+  time_sq = omp_get_wtime() - time_sq;
+
+  // One parallel region per product, the way a caller without a batched interface does it
+  // c is refilled with NaN before each run, so each check only sees what that run wrote
+  batch_poison(c, count*elems);
+  time_pl = omp_get_wtime();
+  for(i=0; i<count; i++)
+    matrix_mult_pl(size, a + i*elems, b + i*elems, c + i*elems);
+  time_pl = omp_get_wtime() - time_pl;
+  ok = verify_batch(reference, c, size, count, "PARALLEL PER PRODUCT");
+
+  batch_poison(c, count*elems);
+  gemm_view_square(&g, size, NULL, NULL, NULL);
+  time_ptr = omp_get_wtime();
+  matrix_gemm_batched(&g, a_ptr, b_ptr, c_ptr, count);
+  time_ptr = omp_get_wtime() - time_ptr;
+  ok &= verify_batch(reference, c, size, count, "BATCHED (POINTER ARRAYS)");
+
+  batch_poison(c, count*elems);
+  gemm_view_square(&g, size, a, b, c);
+  time_str = omp_get_wtime();
+  matrix_gemm_batched_strided(&g, elems, elems, elems, count);
+  time_str = omp_get_wtime() - time_str;
+  ok &= verify_batch(reference, c, size, count, "BATCHED (STRIDED)");
+
+  printf("BATCH OF %d PRODUCTS OF %dx%d MATRICES WITH %d (threads)\n", count, size, size, omp_get_max_threads());
+  printf("SEQUENTIAL EXECUTION: %f (sec), %.2f GFLOP/s\n", time_sq, flops/time_sq*1e-9);
+  printf("PARALLEL EXECUTION PER PRODUCT: %f (sec), %.2f GFLOP/s\n", time_pl, flops/time_pl*1e-9);
+  printf("BATCHED EXECUTION (POINTER ARRAYS): %f (sec), %.2f GFLOP/s\n", time_ptr, flops/time_ptr*1e-9);
+  printf("BATCHED EXECUTION (STRIDED): %f (sec), %.2f GFLOP/s\n", time_str, flops/time_str*1e-9);
+
+  free(a_ptr);
+  free(b_ptr);
+  free(c_ptr);
+  arena_release(&matrices);
+  if(!ok)
+    printf("wrong result of a batched multiply\n");
+  return ok;
 }
 
 
 
+/****************************************************
+ ooc mode: A, B and C live in files of the given
+ directory, in tiles, and the multiply streams their
+ panels through a bounded working set
+ ***************************************************/
+int ooc_main(int argc, char *argv[]){
+  int size = (argc > 0) ? atoi(argv[0]) : 0;
+  const char *directory = (argc > 1) ? argv[1] : ".";
+  size_t memory = ooc_memory();
+  char path_a[4096], path_b[4096], path_c[4096];
+  ooc_matrix a, b, c;
+  ooc_stats stats;
+  double time_gen, flops = 2.0*size*(double)size*size;
+  int tile, ok;
+
+  if(size <= 0){
+    printf("incorrect arguments, expected ooc size [directory] with a size greater than zero\n");
+    return 0;
+  }
+  tile = ooc_tile_size(size, memory);
+  snprintf(path_a, sizeof(path_a), "%s/matrix_ooc_a.bin", directory);
+  snprintf(path_b, sizeof(path_b), "%s/matrix_ooc_b.bin", directory);
+  snprintf(path_c, sizeof(path_c), "%s/matrix_ooc_c.bin", directory);
+  if(!ooc_create(&a, path_a, size, tile) || !ooc_create(&b, path_b, size, tile) || !ooc_create(&c, path_c, size, tile))
+    return 0;
+
+  // The operands are the ones of the in-memory runs, generated straight into the files
+  time_gen = omp_get_wtime();
+  ooc_generate(&a, matrix_seed(), MATRIX_STREAM_A);
+  ooc_generate(&b, matrix_seed(), MATRIX_STREAM_B);
+  time_gen = omp_get_wtime() - time_gen;
+
+  matrix_gemm_ooc(&a, &b, &c, &stats);
+
+  printf("OUT-OF-CORE MATRICES OF %dx%d IN %s: %dx%d TILES OF %dx%d, %zu MB FILES, %.1f MB WORKING SET (MATRIX_OOC_MEMORY %zu MB)\n",
+	 size, size, directory, a.tiles, a.tiles, tile, tile, a.bytes >> 20,
+	 ooc_working_set(size, tile)/1048576.0, memory >> 20);
+  printf("GENERATION: %f (sec), %.2f GB/s written\n", time_gen, 2.0*a.bytes/time_gen*1e-9);
+  printf("OUT-OF-CORE EXECUTION WITH %d (threads): %f (sec), %.2f GFLOP/s overall\n",
+	 omp_get_max_threads(), stats.total, flops/stats.total*1e-9);
+  printf("  compute %f (sec), %.2f GFLOP/s\n", stats.compute, flops/stats.compute*1e-9);
+  printf("  I/O %f (sec), %.2f GB read at %.2f GB/s, %.2f GB written\n", stats.io,
+	 stats.bytes_read*1e-9, (stats.io > 0) ? stats.bytes_read/stats.io*1e-9 : 0.0, stats.bytes_written*1e-9);
+  printf("  stalled on I/O %f (sec), %.1f%% of the I/O overlapped with the compute\n", stats.stall,
+	 (stats.io > 0) ? 100.0*(1.0 - stats.stall/stats.io) : 100.0);
+
+  ok = ooc_check(&a, &b, &c, OOC_CHECK_SAMPLES);
+  ooc_close(&a, path_a);
+  ooc_close(&b, path_b);
+  ooc_close(&c, path_c);
+  if(!ok)
+    printf("wrong result of the out-of-core multiply\n");
+  return ok;
+}
+
+
 /****************************************************
  main
  ***************************************************/
 int main(int argc, char *argv[]){
   if(argc < 2){
-    printf("Usage: %s matrix/vector_size\n", argv[0]);
+    printf("Usage: %s matrix/vector_size [pl|blk|rec|strassen|prec|all] [--input A.bin B.bin] [--output C.bin]\n", argv[0]);
+    printf("       %s bench [--sizes n,..] [--threads t,..] [--kernels sq,pl,blk,rec] [--trials n] [--warmup n] [--format csv|json] [--output file] [--append]\n", argv[0]);
+    printf("       %s batch matrix_size count\n", argv[0]);
+    printf("       %s ooc matrix_size [directory]\n", argv[0]);
     return 0;
   }
+  if(strcmp(argv[1], "bench") == 0)
+    return bench_main(argc-2, argv+2);
+  if(strcmp(argv[1], "batch") == 0)
+    return batch_main(argc-2, argv+2);
+  if(strcmp(argv[1], "ooc") == 0)
+    return ooc_main(argc-2, argv+2);
 
   int m, n;
   int size = atoi(argv[1]);
+  int arg = 2;
+
+  // Optional second argument selects which parallel variant is timed against the sequential one, by default all of them are
+  const char *mode = (arg < argc && strncmp(argv[arg], "--", 2) != 0) ? argv[arg++] : "all";
+  int run_pl = (strcmp(mode, "pl") == 0 || strcmp(mode, "all") == 0);
+  int run_blk = (strcmp(mode, "blk") == 0 || strcmp(mode, "all") == 0);
+  // The recursive task-based kernel also reports its scaling against the static one, which runs it several times
+  int run_rec = (strcmp(mode, "rec") == 0);
+  // Every precision of matrix_gemm_precision, side by side
+  int run_prec = (strcmp(mode, "prec") == 0);
+  // Strassen-Winograd is opt-in, it trades some accuracy for fewer flops
+  int run_str = (strcmp(mode, "strassen") == 0);
+  if(!run_pl && !run_blk && !run_rec && !run_str && !run_prec){
+    printf("unknown mode %s, expected pl, blk, rec, strassen, prec or all\n", mode);
+    return 0;
+  }
+
+  // --input multiplies two matrix files (see common/matrix_io.h) instead of generated operands, a size of 0 takes
+  // theirs. --output writes the result of the mode's kernel, the blocked one for all
+  matrix_io_args io = { NULL, NULL, NULL };
+  matrix_file file_a, file_b, file_c;
+  for(; arg < argc; arg++){
+    if(!matrix_io_option(argc, argv, &arg, &io)){
+      printf("unknown option %s\n", argv[arg]);
+      return 0;
+    }
+  }
+  if(io.output != NULL && run_prec){
+    printf("--output needs a single result, the prec mode has one per precision\n");
+    return 0;
+  }
+  if(!matrix_io_load_inputs(&io, &size, &file_a, &file_b))
+    return 0;
+  if(size <= 0){
+    printf("incorrect arguments, the size should be greater than zero\n");
+    return 0;
+  }
     
+  // MATRIX_NUMA places the pages of the operands on the nodes of the threads using them, see matrix_numa.h
+  numa_config numa;
+  numa_setup(&numa, numa_mode());
+
   // Allocates two vectors of size*size dimention, that will serve as the matrix data types for the computation. Same for the vectors that will hold the result.
-  double *matrix1 = (double *)malloc(sizeof(double)*size*size);
-  double *matrix2 = (double *)malloc(sizeof(double)*size*size);
+  // All seven come from one untouched mapping (on huge pages when available), page aligned when NUMA placement has to move whole pages.
+  // NUMA placement keeps 4 KiB pages, the granularity it places at, a huge page would sit whole on one node
+  size_t align = (numa.mode == NUMA_OFF) ? ARENA_ALIGN : ARENA_PAGE_ALIGN;
+  arena matrices;
+  if(!arena_init_pages(&matrices, 7*arena_matrix_bytes(size, size, align), numa.mode == NUMA_OFF)){
+    printf("can't allocate the required memory for the matrices\n");
+    return 0;
+  }
+  double *matrix1 = arena_matrix(&matrices, size, size, align);
+  double *matrix2 = arena_matrix(&matrices, size, size, align);
     
-  double *result_sq = (double *)malloc(sizeof(double)*size*size);
-  double *result_pl = (double *)malloc(sizeof(double)*size*size);
+  double *result_sq = arena_matrix(&matrices, size, size, align);
+  double *result_pl = arena_matrix(&matrices, size, size, align);
+  double *result_blk = arena_matrix(&matrices, size, size, align);
+  double *result_rec = arena_matrix(&matrices, size, size, align);
+  double *result_str = arena_matrix(&matrices, size, size, align);
+  // The scaling report reruns the recursive kernel, into the arena even when its result goes to the output
+  double *result_scaling = result_rec;
+
+  // The result written out is computed straight into the mapping of the output file
+  if(io.output != NULL){
+    double *output = (double *)matrix_file_create(&file_c, io.output, size, size, MATRIX_DTYPE_FLOAT64,
+						  MATRIX_LAYOUT_ROW_MAJOR, 0, align);
+    if(output == NULL)
+      return 0;
+    if(run_blk) result_blk = output;
+    else if(run_pl) result_pl = output;
+    else if(run_rec) result_rec = output;
+    else result_str = output;
+  }
+
+  // Pages go where they are first written, so the touch with the kernel's partition comes before the generation of the values
+  numa_first_touch(&numa, matrix1, size);
+  numa_place_shared(&numa, matrix2, size);
+  numa_first_touch(&numa, result_pl, size);
+  numa_first_touch(&numa, result_blk, size);
+  numa_first_touch(&numa, result_rec, size);
     
-  matrix_gen(size, matrix1);
-  matrix_gen(size, matrix2);
+  // Inputs of doubles in row-major order are multiplied in place, in the page cache, where the first touch doesn't apply
+  if(io.input_a != NULL){
+    matrix1 = matrix_io_operand(&file_a, io.input_a, matrix1, size);
+    matrix2 = matrix_io_operand(&file_b, io.input_b, matrix2, size);
+  }else{
+    matrix_gen(size, matrix1, MATRIX_STREAM_A);
+    matrix_gen(size, matrix2, MATRIX_STREAM_B);
+  }
+  numa_replicate(&numa, matrix2, size);
     
   double time_sq = 0;
   double time_pl = 0;
-    
-  time_sq = omp_get_wtime();
-  matrix_mult_sq(size, matrix1, matrix2, result_sq);
-  time_sq = omp_get_wtime() - time_sq;
+  double time_blk = 0;
+  double time_rec = 0;
+  double time_str = 0;
+  double flops = 2.0*size*(double)size*size;
 
-  time_pl = omp_get_wtime();
-  matrix_mult_pl(size, matrix1, matrix2, result_pl);
-  time_pl = omp_get_wtime() - time_pl;
+  // With MATRIX_PERF=1 every kernel runs between hardware counters, opened outside of the timed region
+  perf_session perf_sq, perf_pl, perf_blk, perf_rec, perf_str;
 
-  printf("SEQUENTIAL EXECUTION: %f (sec)\n", time_sq);
-  printf("PARALLEL EXECUTION WITH %d (threads) ON %d (processors): %f (sec)\n",
-	 omp_get_max_threads(), omp_get_num_procs(), time_pl);
+  // The sequential multiply is only needed as the reference of a full check, Freivalds checks large runs without it
+  int verify = verify_method(size);
+  int run_sq = (verify == VERIFY_FULL);
 
-  //check
-  int i;
-  for(i=0; i<size; i++)
-    if(result_sq[i] != result_pl[i]){
-      printf("wrong at position %d\n", i);
-      return 0;
+  if(run_sq){
+    perf_begin(&perf_sq);
+    time_sq = omp_get_wtime();
+    matrix_mult_sq(size, matrix1, matrix2, result_sq);
+    time_sq = omp_get_wtime() - time_sq;
+    perf_end(&perf_sq);
+  }
+
+  if(run_pl){
+    perf_begin(&perf_pl);
+    time_pl = omp_get_wtime();
+    if(numa.mode == NUMA_REPLICATE){
+      gemm_view g;
+      gemm_view_square(&g, size, matrix1, matrix2, result_pl);
+      matrix_gemm_pl_numa(&g, &numa);
+    }else{
+      matrix_mult_pl(size, matrix1, matrix2, result_pl);
     }
+    time_pl = omp_get_wtime() - time_pl;
+    perf_end(&perf_pl);
+  }
 
-  free(matrix1);
-  free(matrix2);
-  free(result_sq);
-  free(result_pl);
+  if(run_blk){
+    perf_begin(&perf_blk);
+    time_blk = omp_get_wtime();
+    matrix_mult_blk(size, matrix1, matrix2, result_blk);
+    time_blk = omp_get_wtime() - time_blk;
+    perf_end(&perf_blk);
+  }
+
+  if(run_rec){
+    perf_begin(&perf_rec);
+    time_rec = omp_get_wtime();
+    matrix_mult_rec(size, matrix1, matrix2, result_rec);
+    time_rec = omp_get_wtime() - time_rec;
+    perf_end(&perf_rec);
+  }
+
+  strassen_plan plan;
+  gemm_view g_str;
+  gemm_view_square(&g_str, size, matrix1, matrix2, result_str);
+  if(run_str){
+    perf_begin(&perf_str);
+    time_str = omp_get_wtime();
+    matrix_gemm_strassen(&g_str, strassen_cutoff(), &plan);
+    time_str = omp_get_wtime() - time_str;
+    perf_end(&perf_str);
+  }
+
+  printf("MATRICES IN A %zu MB ARENA ON %s\n", matrices.capacity >> 20, arena_pages_name(&matrices));
+  if(run_sq)
+    printf("SEQUENTIAL EXECUTION: %f (sec)\n", time_sq);
+  else
+    printf("SEQUENTIAL EXECUTION: skipped\n");
+  if(run_pl)
+    printf("PARALLEL EXECUTION WITH %d (threads) ON %d (processors): %f (sec)\n",
+	   omp_get_max_threads(), omp_get_num_procs(), time_pl);
+  if(run_blk)
+    printf("BLOCKED PARALLEL EXECUTION WITH %d (threads) ON %d (processors): %f (sec)\n",
+	   omp_get_max_threads(), omp_get_num_procs(), time_blk);
+  if(run_rec)
+    printf("RECURSIVE TASK EXECUTION WITH %d (threads) ON %d (processors): %f (sec), leaf %d\n",
+	   omp_get_max_threads(), omp_get_num_procs(), time_rec, rec_leaf_size());
+  if(run_str)
+    printf("STRASSEN-WINOGRAD EXECUTION WITH %d (threads): %f (sec), %d levels above cutoff %d, %d as tasks, %.1f MB workspace, %.1f%% of the classical flops\n",
+	   omp_get_max_threads(), time_str, plan.levels, plan.cutoff, plan.task_depth,
+	   plan.workspace*sizeof(double)/1048576.0, 100.0*plan.flops/flops);
+
+  if(run_pl){
+    gemm_view g;
+    gemm_view_square(&g, size, matrix1, matrix2, result_pl);
+    numa_report(&numa, &g, "PARALLEL");
+  }
+
+  if(run_sq)
+    perf_report(&perf_sq, "SEQUENTIAL", flops);
+  if(run_pl)
+    perf_report(&perf_pl, "PARALLEL", flops);
+  if(run_blk)
+    perf_report(&perf_blk, "BLOCKED PARALLEL", flops);
+  if(run_rec)
+    perf_report(&perf_rec, "RECURSIVE TASK", flops);
+  if(run_str)
+    perf_report(&perf_str, "STRASSEN-WINOGRAD", plan.flops);
+
+  // Error growth of the fast multiply, normwise against the sequential result, next to the one of the classical blocked kernel
+  if(run_str && run_sq){
+    gemm_view g_blk;
+    gemm_view_square(&g_blk, size, matrix1, matrix2, result_blk);
+    matrix_mult_blk(size, matrix1, matrix2, result_blk);
+    printf("NORMWISE ERROR AGAINST THE SEQUENTIAL RESULT: strassen %.3e, blocked %.3e (max|C-R| / (n*max|A|*max|B|))\n",
+	   matrix_normwise_error(&g_str, result_sq), matrix_normwise_error(&g_blk, result_sq));
+  }else if(run_str){
+    printf("NORMWISE ERROR: skipped, MATRIX_VERIFY=full runs the sequential reference\n");
+  }
+
+  //check, the whole matrix against the sequential result or the Freivalds check, see MATRIX_VERIFY
+  if(run_pl && !verify_square(verify, size, matrix1, matrix2, result_sq, result_pl, "PARALLEL")){
+    printf("wrong result of the parallel multiply\n");
+    return 0;
+  }
+  // The blocked kernel adds the products in a different order, the tolerance covers the rounding differences
+  if(run_blk && !verify_square(verify, size, matrix1, matrix2, result_sq, result_blk, "BLOCKED PARALLEL")){
+    printf("wrong result of the blocked multiply\n");
+    return 0;
+  }
+  if(run_rec && !verify_square(verify, size, matrix1, matrix2, result_sq, result_rec, "RECURSIVE TASK")){
+    printf("wrong result of the recursive multiply\n");
+    return 0;
+  }
+  if(run_str && !verify_square(verify, size, matrix1, matrix2, result_sq, result_str, "STRASSEN-WINOGRAD")){
+    printf("wrong result of the Strassen-Winograd multiply\n");
+    return 0;
+  }
+
+  if(run_prec && !precision_report(size, matrix1, matrix2, result_sq, result_pl, verify)){
+    printf("wrong result of a reduced precision multiply\n");
+    return 0;
+  }
+
+  // Only a checked result is sealed, an unsealed output file is rejected by the readers
+  if(io.output != NULL){
+    if(!matrix_file_commit(&file_c))
+      return 0;
+    printf("OUTPUT %s: %dx%d float64 row-major, %.1f MB\n", io.output, size, size, file_c.bytes/1048576.0);
+  }
+
+  // Last, as it overwrites the result of the recursive multiply
+  if(run_rec)
+    scaling_report(size, matrix1, matrix2, result_scaling);
+
+  if(io.output != NULL)
+    matrix_file_close(&file_c);
+  if(io.input_a != NULL){
+    matrix_file_close(&file_a);
+    matrix_file_close(&file_b);
+  }
+  arena_release(&matrices);
+  numa_release(&numa);
   return 1;
 }
@@ -0,0 +1,326 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <omp.h>
+#include "../common/matrix_view.h"
+#include "../common/matrix_rng.h"
+#include "../common/verify.h"
+#include "matrix_blocked.h"
+#include "matrix_ooc.h"
+
+// Tiles are a multiple of this on a side, which keeps every tile of the file page aligned
+#define OOC_TILE_STEP 64
+
+/*** TYPEDEFS AND STRUCTS***/
+// Panels of one step brought in by the prefetch thread: tile (ti,tk) of A and row panel tk of B
+typedef struct {
+  const ooc_matrix *a, *b;
+  int ti, tk;
+  double busy;
+  pthread_t thread;
+} ooc_prefetch;
+
+
+/*****************************************************
+ Working-set budget from MATRIX_OOC_MEMORY (MB), or
+ the default one
+ ****************************************************/
+size_t ooc_memory(void){
+  const char *value = getenv("MATRIX_OOC_MEMORY");
+  long mb = (value != NULL) ? atol(value) : 0;
+  return (size_t)((mb > 0) ? mb : OOC_MEMORY_MB) << 20;
+}
+
+/*****************************************************
+ Bytes resident during the multiply: the row panel of
+ C being computed, plus the A tile and the B panel of
+ the current step and of the one being prefetched
+ ****************************************************/
+size_t ooc_working_set(int size, int tile){
+  size_t tiles = (size + tile - 1) / tile;
+  size_t panel = (size_t)tile*tile*tiles;
+  return sizeof(double)*(panel + 2*((size_t)tile*tile + panel));
+}
+
+/*****************************************************
+ Largest tile whose working set fits the budget, or
+ MATRIX_OOC_TILE (rounded up to OOC_TILE_STEP)
+ ****************************************************/
+int ooc_tile_size(int size, size_t memory){
+  const char *value = getenv("MATRIX_OOC_TILE");
+  int tile = (value != NULL) ? atoi(value) : 0;
+
+  if(tile > 0)
+    return (tile + OOC_TILE_STEP - 1) / OOC_TILE_STEP * OOC_TILE_STEP;
+  tile = (size + OOC_TILE_STEP - 1) / OOC_TILE_STEP * OOC_TILE_STEP;
+  while(tile > OOC_TILE_STEP && ooc_working_set(size, tile) > memory)
+    tile -= OOC_TILE_STEP;
+  return tile;
+}
+
+
+static double *tile_at(const ooc_matrix *x, int ti, int tj){
+  return x->map + ((size_t)ti*x->tiles + tj)*x->tile*x->tile;
+}
+
+static size_t tile_bytes(const ooc_matrix *x){
+  return sizeof(double)*x->tile*x->tile;
+}
+
+static double element_at(const ooc_matrix *x, int i, int j){
+  return tile_at(x, i / x->tile, j / x->tile)[(i % x->tile)*x->tile + j % x->tile];
+}
+
+
+/*****************************************************
+ Creates the file of a size x size matrix in tiles of
+ tile x tile and maps it shared. Returns 0 on failure
+ ****************************************************/
+int ooc_create(ooc_matrix *x, const char *path, int size, int tile){
+  memset(x, 0, sizeof(*x));
+  x->size = size;
+  x->tile = tile;
+  x->tiles = (size + tile - 1) / tile;
+  x->bytes = (size_t)x->tiles*x->tiles*tile_bytes(x);
+
+  x->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(x->fd < 0){
+    printf("can't create %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  if(ftruncate(x->fd, x->bytes) != 0){
+    printf("can't size %s to %zu MB: %s\n", path, x->bytes >> 20, strerror(errno));
+    close(x->fd);
+    x->fd = -1;
+    return 0;
+  }
+  x->map = (double *)mmap(NULL, x->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, x->fd, 0);
+  if(x->map == MAP_FAILED){
+    printf("can't map %s: %s\n", path, strerror(errno));
+    x->map = NULL;
+    close(x->fd);
+    x->fd = -1;
+    return 0;
+  }
+  return 1;
+}
+
+
+/*****************************************************
+ Lets go of a range of the mapping once it is done
+ with: written pages are queued for writeback, and the
+ pages leave the process and, when clean, the page
+ cache too, so the resident set stays bounded
+ ****************************************************/
+static void release_range(const ooc_matrix *x, const double *start, size_t bytes, int written){
+  off_t offset = (const char *)start - (const char *)x->map;
+
+  if(written)
+    sync_file_range(x->fd, offset, bytes, SYNC_FILE_RANGE_WRITE);
+  madvise((void *)start, bytes, MADV_DONTNEED);
+  if(!written)
+    posix_fadvise(x->fd, offset, bytes, POSIX_FADV_DONTNEED);
+}
+
+
+/*****************************************************
+ Fills the matrix with the values of matrix_random for
+ the same seed and stream, tile by tile, each tile
+ written back and released once generated
+ ****************************************************/
+void ooc_generate(ooc_matrix *x, uint64_t seed, uint64_t stream){
+  uint64_t key = matrix_rng_key(seed, stream);
+  int ti, tj, r;
+
+  for(ti=0; ti<x->tiles; ti++){
+    for(tj=0; tj<x->tiles; tj++){
+      double *tile = tile_at(x, ti, tj);
+#     pragma omp parallel for schedule(static)
+      for(r=0; r<x->tile; r++){
+        long i = (long)ti*x->tile + r;
+        int c;
+        for(c=0; c<x->tile; c++){
+          long j = (long)tj*x->tile + c;
+          tile[(long)r*x->tile + c] = (i < x->size && j < x->size)
+            ? rng_uniform(rng_counter(key, (uint64_t)i*x->size + j)) : 0.0;
+        }
+      }
+      release_range(x, tile, tile_bytes(x), 1);
+    }
+  }
+}
+
+
+/*****************************************************
+ Brings a range in: the readahead hint first, so the
+ kernel reads it in large requests, then one read per
+ page, so it is resident when the compute gets to it
+ ****************************************************/
+static void touch_range(const double *start, size_t bytes){
+  const volatile char *bytes_in = (const volatile char *)start;
+  long page = sysconf(_SC_PAGESIZE);
+  size_t offset;
+  char sink = 0;
+
+  madvise((void *)start, bytes, MADV_WILLNEED);
+  for(offset=0; offset<bytes; offset+=page)
+    sink ^= bytes_in[offset];
+  (void)sink;
+}
+
+static void *prefetch_run(void *context){
+  ooc_prefetch *f = (ooc_prefetch *)context;
+  double start = omp_get_wtime();
+
+  touch_range(tile_at(f->a, f->ti, f->tk), tile_bytes(f->a));
+  touch_range(tile_at(f->b, f->tk, 0), f->b->tiles*tile_bytes(f->b));
+  f->busy = omp_get_wtime() - start;
+  return NULL;
+}
+
+static void prefetch_start(ooc_prefetch *f, const ooc_matrix *a, const ooc_matrix *b, int step){
+  f->a = a;
+  f->b = b;
+  f->ti = step / a->tiles;
+  f->tk = step % a->tiles;
+  f->busy = 0;
+  if(pthread_create(&f->thread, NULL, prefetch_run, f) != 0){
+    // Without a thread the panels are read in place, which is still correct, only not overlapped
+    prefetch_run(f);
+    f->thread = pthread_self();
+  }
+}
+
+static void prefetch_wait(ooc_prefetch *f){
+  if(!pthread_equal(f->thread, pthread_self()))
+    pthread_join(f->thread, NULL);
+}
+
+
+/*****************************************************
+ C = A*B over the files. Step s = (I,K) adds tile (I,K)
+ of A times row panel K of B into row panel I of C,
+ with the blocked kernel on every tile. While it runs
+ a thread prefetches the panels of step s+1, and each
+ panel is released as soon as it is done with, so only
+ ooc_working_set bytes are ever resident
+ ****************************************************/
+void matrix_gemm_ooc(const ooc_matrix *a, const ooc_matrix *b, ooc_matrix *c, ooc_stats *stats){
+  int tiles = a->tiles, ts = a->tile;
+  int steps = tiles*tiles;
+  size_t panel_bytes = tiles*tile_bytes(a);
+  ooc_prefetch prefetch[2];
+  double start = omp_get_wtime();
+  int s, j;
+
+  memset(stats, 0, sizeof(*stats));
+  prefetch_start(&prefetch[0], a, b, 0);
+  for(s=0; s<steps; s++){
+    ooc_prefetch *current = &prefetch[s % 2];
+    int ti = s / tiles, tk = s % tiles;
+    double time = omp_get_wtime();
+
+    prefetch_wait(current);
+    stats->stall += omp_get_wtime() - time;
+    stats->io += current->busy;
+    stats->bytes_read += tile_bytes(a) + panel_bytes;
+    if(s+1 < steps)
+      prefetch_start(&prefetch[(s+1) % 2], a, b, s+1);
+
+    time = omp_get_wtime();
+    for(j=0; j<tiles; j++){
+      gemm_view g = { ts, ts, ts, 1.0, (tk == 0) ? 0.0 : 1.0,
+                      tile_at(a, ti, tk), ts, MV_NOTRANS,
+                      tile_at(b, tk, j), ts, MV_NOTRANS,
+                      tile_at(c, ti, j), ts };
+      matrix_gemm_blk(&g);
+    }
+    stats->compute += omp_get_wtime() - time;
+
+    // With a single tile every step reads the same panels, which are then kept
+    if(tiles > 1){
+      release_range(a, tile_at(a, ti, tk), tile_bytes(a), 0);
+      release_range(b, tile_at(b, tk, 0), panel_bytes, 0);
+    }
+    if(tk == tiles-1){
+      release_range(c, tile_at(c, ti, 0), panel_bytes, 1);
+      stats->bytes_written += panel_bytes;
+    }
+  }
+  stats->total = omp_get_wtime() - start;
+}
+
+
+/*****************************************************
+ Recomputes samples entries of C, spread by the
+ counter-based generator, from the rows of A and the
+ columns of B in the files. Prints the report and
+ returns 1 when they are all within tolerance
+ ****************************************************/
+int ooc_check(const ooc_matrix *a, const ooc_matrix *b, const ooc_matrix *c, int samples){
+  uint64_t key = matrix_rng_key(matrix_seed(), MATRIX_STREAM_B + 1);
+  double *expected = (double *)malloc(2*sizeof(double)*samples);
+  double *actual = expected + samples;
+  // Row and column of every sample, the comparison only sees them as a row of samples
+  int *where = (int *)malloc(2*sizeof(int)*samples);
+  verify_report report;
+  char kernel[64];
+  int s, ok;
+
+  if(expected == NULL || where == NULL){
+    printf("can't allocate the samples of the check\n");
+    free(expected);
+    free(where);
+    return 0;
+  }
+# pragma omp parallel for schedule(dynamic)
+  for(s=0; s<samples; s++){
+    uint64_t bits = rng_counter(key, s);
+    int i = (int)((bits & 0xFFFFFFFFu) % c->size);
+    int j = (int)((bits >> 32) % c->size);
+    double value = 0.0;
+    int p;
+    for(p=0; p<a->size; p++)
+      value += element_at(a, i, p) * element_at(b, p, j);
+    expected[s] = value;
+    actual[s] = element_at(c, i, j);
+    where[2*s] = i;
+    where[2*s+1] = j;
+  }
+
+  ok = verify_compare(expected, samples, actual, samples, 1, samples,
+                      verify_default_tol(a->size), VERIFY_ULP_TOL, &report);
+  report.method = "sampled";
+  if(report.worst_col >= 0){
+    s = report.worst_col;
+    report.worst_row = where[2*s];
+    report.worst_col = where[2*s+1];
+  }
+  snprintf(kernel, sizeof(kernel), "OUT-OF-CORE (%d entries)", samples);
+  verify_print(&report, kernel);
+  free(expected);
+  free(where);
+  return ok;
+}
+
+
+/*****************************************************
+ Unmaps and closes the file, removing it when a path
+ is given
+ ****************************************************/
+void ooc_close(ooc_matrix *x, const char *path){
+  if(x->map != NULL)
+    munmap(x->map, x->bytes);
+  if(x->fd >= 0)
+    close(x->fd);
+  if(path != NULL)
+    unlink(path);
+  x->map = NULL;
+  x->fd = -1;
+}
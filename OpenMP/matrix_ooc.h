@@ -0,0 +1,47 @@
+#ifndef MATRIX_OOC_H_
+#define MATRIX_OOC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Memory the out-of-core multiply may keep resident, in MB, MATRIX_OOC_MEMORY overrides it
+#define OOC_MEMORY_MB 1024
+
+// Entries of C recomputed from A and B to check an out-of-core result
+#define OOC_CHECK_SAMPLES 256
+
+/*** TYPEDEFS AND STRUCTS***/
+// Square matrix in a file, mapped shared. It is stored as tiles x tiles square tiles of tile x tile
+// doubles, each tile contiguous and the tiles in row-major order, so a tile of A, a row panel of B
+// (the tiles of one tile row) and a row panel of C are each one contiguous range of the file.
+// The last tile row and column are padded with zeros
+typedef struct {
+  int fd;
+  double *map;
+  size_t bytes;
+  int size;
+  int tile;
+  int tiles;
+} ooc_matrix;
+
+// Costs of one out-of-core multiply. io is the time the prefetcher spent bringing panels in,
+// stall the part of it the compute had to wait for, the rest being overlapped with the compute
+typedef struct {
+  double compute;
+  double io;
+  double stall;
+  double total;
+  size_t bytes_read;
+  size_t bytes_written;
+} ooc_stats;
+
+size_t ooc_memory(void);
+int ooc_tile_size(int size, size_t memory);
+size_t ooc_working_set(int size, int tile);
+int ooc_create(ooc_matrix *x, const char *path, int size, int tile);
+void ooc_generate(ooc_matrix *x, uint64_t seed, uint64_t stream);
+void matrix_gemm_ooc(const ooc_matrix *a, const ooc_matrix *b, ooc_matrix *c, ooc_stats *stats);
+int ooc_check(const ooc_matrix *a, const ooc_matrix *b, const ooc_matrix *c, int samples);
+void ooc_close(ooc_matrix *x, const char *path);
+
+#endif /* MATRIX_OOC_H_ */
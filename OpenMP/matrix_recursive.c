@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include "matrix_recursive.h"
+
+
+/*****************************************************
+ Leaf size from MATRIX_REC_LEAF, or the default
+ ****************************************************/
+int rec_leaf_size(void){
+  const char *value = getenv("MATRIX_REC_LEAF");
+  int leaf = (value != NULL) ? atoi(value) : 0;
+  return (leaf > 0) ? leaf : REC_LEAF;
+}
+
+/*****************************************************
+ Direct multiplication of a leaf. Rows of C are updated
+ with one row of op(B) at a time, so the inner loop is
+ contiguous (and vectorized) unless B is transposed
+ ****************************************************/
+static void rec_leaf(const gemm_view *g){
+  int a_rs, a_cs, b_rs, b_cs;
+  int i, j, p;
+
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+  for(i=0; i<g->m; i++){
+    double *c_row = g->c + (long)i*g->ldc;
+    for(j=0; j<g->n; j++)
+      c_row[j] = (g->beta == 0.0) ? 0.0 : g->beta*c_row[j];
+    for(p=0; p<g->k; p++){
+      const double *b_row = g->b + (long)p*b_rs;
+      double a_ip = g->alpha * g->a[(long)i*a_rs + (long)p*a_cs];
+#     pragma omp simd
+      for(j=0; j<g->n; j++)
+        c_row[j] += a_ip * b_row[(long)j*b_cs];
+    }
+  }
+}
+
+/*****************************************************
+ Halves the largest of m, n and k until the leaf size.
+ The two halves of m or n write disjoint parts of C, so
+ one of them becomes a task any idle thread can take; the
+ halves of k add into the same C and run one after the
+ other, the second one accumulating (beta = 1)
+ ****************************************************/
+static void rec_split(const gemm_view *g, int leaf){
+  gemm_view first, second;
+
+  if(g->m <= leaf && g->n <= leaf && g->k <= leaf){
+    rec_leaf(g);
+    return;
+  }
+
+  if(g->m >= g->n && g->m >= g->k){
+    int half = g->m / 2;
+    gemm_view_block(g, 0, 0, 0, half, g->n, g->k, &first);
+    gemm_view_block(g, half, 0, 0, g->m - half, g->n, g->k, &second);
+  }else if(g->n >= g->k){
+    int half = g->n / 2;
+    gemm_view_block(g, 0, 0, 0, g->m, half, g->k, &first);
+    gemm_view_block(g, 0, half, 0, g->m, g->n - half, g->k, &second);
+  }else{
+    int half = g->k / 2;
+    gemm_view_block(g, 0, 0, 0, g->m, g->n, half, &first);
+    gemm_view_block(g, 0, 0, half, g->m, g->n, g->k - half, &second);
+    second.beta = 1.0;
+    rec_split(&first, leaf);
+    rec_split(&second, leaf);
+    return;
+  }
+
+# pragma omp task firstprivate(first)
+  rec_split(&first, leaf);
+  rec_split(&second, leaf);
+# pragma omp taskwait
+}
+
+/*****************************************************
+ Cache-oblivious multiplication of any view: the
+ recursion reaches blocks that fit every cache level
+ without knowing their sizes, and the load is balanced
+ by the threads picking up tasks as they get idle,
+ instead of a static split of the rows
+ ****************************************************/
+void matrix_gemm_rec(const gemm_view *g, int leaf){
+  if(leaf < 1)
+    leaf = 1;
+# pragma omp parallel
+# pragma omp single
+  rec_split(g, leaf);
+}
+
+/*****************************************************
+ Recursive multiplication of a square matrix
+ ****************************************************/
+void matrix_mult_rec(int size, double *matrix1_in,
+		     double *matrix2_in, double *matrix_out){
+  gemm_view g;
+
+  gemm_view_square(&g, size, matrix1_in, matrix2_in, matrix_out);
+  matrix_gemm_rec(&g, rec_leaf_size());
+}
@@ -0,0 +1,15 @@
+#ifndef MATRIX_RECURSIVE_H_
+#define MATRIX_RECURSIVE_H_
+
+#include "../common/matrix_view.h"
+
+// Sub-problems with every dimension at or below the leaf size are multiplied directly, MATRIX_REC_LEAF overrides it.
+// Three 64 x 64 blocks of doubles take 96 KB, so a leaf runs out of L2 whatever the cache sizes are
+#define REC_LEAF 64
+
+int rec_leaf_size(void);
+void matrix_gemm_rec(const gemm_view *g, int leaf);
+void matrix_mult_rec(int size, double *matrix1_in,
+		     double *matrix2_in, double *matrix_out);
+
+#endif /* MATRIX_RECURSIVE_H_ */
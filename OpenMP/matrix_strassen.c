@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+#include "matrix_strassen.h"
+#include "matrix_blocked.h"
+
+// Sums of fewer elements than this are not worth a parallel region
+#define STRASSEN_PARALLEL_ADD 65536
+// Elements of one task of a sum split by a taskloop, inside the task levels
+#define STRASSEN_TASK_ADD 16384
+
+/*** TYPEDEFS AND STRUCTS***/
+// Operand of the recursion: element (i,j) is p[i*rs + j*cs], so quadrants of op(A) and op(B) are
+// addressed in place whatever their transposition. Temporaries and C are row-major (cs = 1)
+typedef struct {
+  double *p;
+  long rs, cs;
+} strided;
+
+
+/*****************************************************
+ Cutoff from MATRIX_STRASSEN_CUTOFF, or the default
+ ****************************************************/
+int strassen_cutoff(void){
+  const char *value = getenv("MATRIX_STRASSEN_CUTOFF");
+  int cutoff = (value != NULL) ? atoi(value) : 0;
+  return (cutoff > 1) ? cutoff : STRASSEN_CUTOFF;
+}
+
+
+static strided quadrant(strided x, int row, int col){
+  strided q = { x.p + row*x.rs + col*x.cs, x.rs, x.cs };
+  return q;
+}
+
+static strided temporary(double **work, int rows, int cols){
+  strided t = { *work, cols, 1 };
+  *work += (size_t)rows*cols;
+  return t;
+}
+
+/*****************************************************
+ dst = x + sign*y, all rows x cols. Sums on large blocks
+ outside of any parallel region get one of their own,
+ inside one (the task levels run in a single) they are
+ split over the team by a taskloop
+ ****************************************************/
+static void combine(strided dst, strided x, strided y, double sign, int rows, int cols){
+  int i, j;
+
+  if((long)rows*cols >= STRASSEN_PARALLEL_ADD && omp_in_parallel()){
+    int grain = (cols < STRASSEN_TASK_ADD) ? STRASSEN_TASK_ADD / cols : 1;
+#   pragma omp taskloop private(j) grainsize(grain)
+    for(i=0; i<rows; i++)
+      for(j=0; j<cols; j++)
+        dst.p[i*dst.rs + j*dst.cs] = x.p[i*x.rs + j*x.cs] + sign*y.p[i*y.rs + j*y.cs];
+    return;
+  }
+
+# pragma omp parallel for private(j) schedule(static) \
+    if((long)rows*cols >= STRASSEN_PARALLEL_ADD)
+  for(i=0; i<rows; i++)
+    for(j=0; j<cols; j++)
+      dst.p[i*dst.rs + j*dst.cs] = x.p[i*x.rs + j*x.cs] + sign*y.p[i*y.rs + j*y.cs];
+}
+
+/*****************************************************
+ View of c = a*b for the classical kernels
+ ****************************************************/
+static void product_view(gemm_view *g, int m, int n, int k, strided a, strided b,
+			 strided c, double beta){
+  g->m = m; g->n = n; g->k = k;
+  g->alpha = 1.0; g->beta = beta;
+  g->a = a.p; g->trans_a = (a.cs != 1); g->lda = (int)((a.cs != 1) ? a.cs : a.rs);
+  g->b = b.p; g->trans_b = (b.cs != 1); g->ldb = (int)((b.cs != 1) ? b.cs : b.rs);
+  g->c = c.p; g->ldc = (int)c.rs;
+}
+
+static int is_leaf(int m, int n, int k, int cutoff){
+  return m <= cutoff || n <= cutoff || k <= cutoff;
+}
+
+
+/*****************************************************
+ Walks the recursion without computing anything, adding
+ the flops of weight copies of an m x n x k product to
+ plan->flops and returning the workspace it needs, so
+ the workspace is allocated once up front
+ ****************************************************/
+static size_t plan_level(int m, int n, int k, int depth, int task_depth, double weight,
+			 strassen_plan *plan){
+  int hm = m/2, hn = n/2, hk = k/2;
+  size_t child;
+
+  if(is_leaf(m, n, k, plan->cutoff)){
+    plan->flops += weight * 2.0*m*(double)n*k;
+    return 0;
+  }
+  if(depth + 1 > plan->levels)
+    plan->levels = depth + 1;
+
+  // The odd row, column or inner index peeled off an odd dimension costs as much as in the classical product
+  plan->flops += weight * (2.0*m*(double)n*k - 2.0*(2*hm)*(double)(2*hn)*(2*hk));
+  // 8 sums forming the operands and 7 combining the products
+  plan->flops += weight * (4.0*hm*hk + 4.0*hk*hn + 7.0*hm*hn);
+  child = plan_level(hm, hn, hk, depth+1, task_depth, 7*weight, plan);
+
+  if(depth < task_depth)
+    return 4*(size_t)hm*hk + 4*(size_t)hk*hn + 3*(size_t)hm*hn + 7*child;
+  return (size_t)hm*hk + (size_t)hk*hn + (size_t)hm*hn + child;
+}
+
+
+static void strassen_level(int m, int n, int k, strided a, strided b, strided c,
+			   double *work, int depth, int task_depth, int cutoff, size_t child_work);
+
+/*****************************************************
+ c = a*b on the even part of the dimensions, the odd
+ row, column and inner index being added classically
+ ****************************************************/
+static void strassen_rec(int m, int n, int k, strided a, strided b, strided c,
+			 double *work, int depth, int task_depth, int cutoff){
+  int m2 = m & ~1, n2 = n & ~1, k2 = k & ~1;
+  strassen_plan child = { cutoff, 0, 0, 0, 0 };
+  gemm_view g;
+
+  if(is_leaf(m, n, k, cutoff)){
+    product_view(&g, m, n, k, a, b, c, 0.0);
+    matrix_gemm_blk(&g);
+    return;
+  }
+
+  strassen_level(m2, n2, k2, a, b, c, work, depth, task_depth, cutoff,
+                 plan_level(m2/2, n2/2, k2/2, depth+1, task_depth, 0, &child));
+
+  // Odd inner index: rank-1 update of the even part
+  if(k2 < k){
+    product_view(&g, m2, n2, 1, quadrant(a, 0, k2), quadrant(b, k2, 0), c, 1.0);
+    matrix_gemm_ref(&g);
+  }
+  // Odd column and odd row of C, over the whole inner dimension
+  if(n2 < n){
+    product_view(&g, m2, 1, k, a, quadrant(b, 0, n2), quadrant(c, 0, n2), 0.0);
+    matrix_gemm_ref(&g);
+  }
+  if(m2 < m){
+    product_view(&g, 1, n, k, quadrant(a, m2, 0), b, quadrant(c, m2, 0), 0.0);
+    matrix_gemm_ref(&g);
+  }
+}
+
+
+/*****************************************************
+ One Winograd step on even m, n, k:
+   S1 = A21 + A22   T1 = B12 - B11   P1 = A11*B11  P5 = S1*T1
+   S2 = S1 - A11    T2 = B22 - T1    P2 = A12*B21  P6 = S2*T2
+   S3 = A11 - A21   T3 = B22 - B12   P3 = S4*B22   P7 = S3*T3
+   S4 = A12 - S2    T4 = T2 - B21    P4 = A22*T4
+   C11 = P1 + P2          C12 = P1 + P6 + P5 + P3
+   C21 = P1 + P6 + P7 - P4   C22 = P1 + P6 + P7 + P5
+ 7 products and 15 sums instead of 8 products
+ ****************************************************/
+static void strassen_level(int m, int n, int k, strided a, strided b, strided c,
+			   double *work, int depth, int task_depth, int cutoff, size_t child_work){
+  int hm = m/2, hn = n/2, hk = k/2;
+  strided a11 = quadrant(a, 0, 0), a12 = quadrant(a, 0, hk), a21 = quadrant(a, hm, 0), a22 = quadrant(a, hm, hk);
+  strided b11 = quadrant(b, 0, 0), b12 = quadrant(b, 0, hn), b21 = quadrant(b, hk, 0), b22 = quadrant(b, hk, hn);
+  strided c11 = quadrant(c, 0, 0), c12 = quadrant(c, 0, hn), c21 = quadrant(c, hm, 0), c22 = quadrant(c, hm, hn);
+
+  if(depth < task_depth){
+    // Every product gets its own operands, result and workspace, so the seven run as independent tasks
+    strided s1 = temporary(&work, hm, hk), s2 = temporary(&work, hm, hk);
+    strided s3 = temporary(&work, hm, hk), s4 = temporary(&work, hm, hk);
+    strided t1 = temporary(&work, hk, hn), t2 = temporary(&work, hk, hn);
+    strided t3 = temporary(&work, hk, hn), t4 = temporary(&work, hk, hn);
+    strided p2 = temporary(&work, hm, hn), p3 = temporary(&work, hm, hn), p4 = temporary(&work, hm, hn);
+
+    combine(s1, a21, a22, 1.0, hm, hk);
+    combine(s2, s1, a11, -1.0, hm, hk);
+    combine(s3, a11, a21, -1.0, hm, hk);
+    combine(s4, a12, s2, -1.0, hm, hk);
+    combine(t1, b12, b11, -1.0, hk, hn);
+    combine(t2, b22, t1, -1.0, hk, hn);
+    combine(t3, b22, b12, -1.0, hk, hn);
+    combine(t4, t2, b21, -1.0, hk, hn);
+
+#   pragma omp taskgroup
+    {
+#     pragma omp task
+      strassen_rec(hm, hn, hk, a11, b11, c11, work + 0*child_work, depth+1, task_depth, cutoff);
+#     pragma omp task
+      strassen_rec(hm, hn, hk, a12, b21, p2, work + 1*child_work, depth+1, task_depth, cutoff);
+#     pragma omp task
+      strassen_rec(hm, hn, hk, s4, b22, p3, work + 2*child_work, depth+1, task_depth, cutoff);
+#     pragma omp task
+      strassen_rec(hm, hn, hk, a22, t4, p4, work + 3*child_work, depth+1, task_depth, cutoff);
+#     pragma omp task
+      strassen_rec(hm, hn, hk, s1, t1, c22, work + 4*child_work, depth+1, task_depth, cutoff);
+#     pragma omp task
+      strassen_rec(hm, hn, hk, s2, t2, c12, work + 5*child_work, depth+1, task_depth, cutoff);
+#     pragma omp task
+      strassen_rec(hm, hn, hk, s3, t3, c21, work + 6*child_work, depth+1, task_depth, cutoff);
+    }
+
+    // C11 = P1, C12 = P6, C21 = P7 and C22 = P5 at this point
+    combine(c12, c12, c11, 1.0, hm, hn);
+    combine(c21, c21, c12, 1.0, hm, hn);
+    combine(c12, c12, c22, 1.0, hm, hn);
+    combine(c22, c22, c21, 1.0, hm, hn);
+    combine(c12, c12, p3, 1.0, hm, hn);
+    combine(c21, c21, p4, -1.0, hm, hn);
+    combine(c11, c11, p2, 1.0, hm, hn);
+  }else{
+    // One product at a time: X holds the S operands, Y the T operands, Z the products that have no quadrant of C to live in
+    strided x = temporary(&work, hm, hk), y = temporary(&work, hk, hn), z = temporary(&work, hm, hn);
+
+    combine(x, a11, a21, -1.0, hm, hk);
+    combine(y, b22, b12, -1.0, hk, hn);
+    strassen_rec(hm, hn, hk, x, y, c21, work, depth+1, task_depth, cutoff);
+    combine(x, a21, a22, 1.0, hm, hk);
+    combine(y, b12, b11, -1.0, hk, hn);
+    strassen_rec(hm, hn, hk, x, y, c22, work, depth+1, task_depth, cutoff);
+    combine(x, x, a11, -1.0, hm, hk);
+    combine(y, b22, y, -1.0, hk, hn);
+    strassen_rec(hm, hn, hk, x, y, c12, work, depth+1, task_depth, cutoff);
+    combine(x, a12, x, -1.0, hm, hk);
+    strassen_rec(hm, hn, hk, x, b22, z, work, depth+1, task_depth, cutoff);
+    strassen_rec(hm, hn, hk, a11, b11, c11, work, depth+1, task_depth, cutoff);
+
+    // C11 = P1, C12 = P6, C21 = P7, C22 = P5, Z = P3 and Y still holds T2
+    combine(c12, c12, c11, 1.0, hm, hn);
+    combine(c21, c21, c12, 1.0, hm, hn);
+    combine(c12, c12, c22, 1.0, hm, hn);
+    combine(c22, c22, c21, 1.0, hm, hn);
+    combine(c12, c12, z, 1.0, hm, hn);
+    combine(y, y, b21, -1.0, hk, hn);
+    strassen_rec(hm, hn, hk, a22, y, z, work, depth+1, task_depth, cutoff);
+    combine(c21, c21, z, -1.0, hm, hn);
+    strassen_rec(hm, hn, hk, a12, b21, z, work, depth+1, task_depth, cutoff);
+    combine(c11, c11, z, 1.0, hm, hn);
+  }
+}
+
+
+/*****************************************************
+ C = alpha*op(A)*op(B) + beta*C with Strassen-Winograd
+ recursion down to cutoff, the small products running
+ on the blocked kernel. With more than one thread the
+ top levels run their products as OpenMP tasks, enough
+ levels for every thread to get one (7^depth >= threads).
+ A product already at the cutoff goes straight to the
+ blocked kernel
+ ****************************************************/
+void matrix_gemm_strassen(const gemm_view *g, int cutoff, strassen_plan *plan){
+  int a_rs, a_cs, b_rs, b_cs;
+  int threads = omp_get_max_threads();
+  int direct = (g->alpha == 1.0 && g->beta == 0.0);
+  long tasks;
+  double *work;
+  strided a, b, c;
+  int i, j;
+
+  plan->cutoff = cutoff;
+  plan->levels = 0;
+  plan->flops = 0;
+  plan->task_depth = 0;
+  // Too small to recurse: no tasks either, the blocked kernel runs the whole product (alpha and beta included) with every thread
+  if(is_leaf(g->m, g->n, g->k, cutoff)){
+    plan->workspace = plan_level(g->m, g->n, g->k, 0, 0, 1.0, plan);
+    matrix_gemm_blk(g);
+    return;
+  }
+  for(tasks=1; tasks < threads && plan->task_depth < STRASSEN_MAX_TASK_DEPTH; tasks*=7)
+    plan->task_depth++;
+  plan->workspace = plan_level(g->m, g->n, g->k, 0, plan->task_depth, 1.0, plan);
+  // alpha and beta are applied to the product afterwards, which then needs a place of its own
+  if(!direct)
+    plan->workspace += (size_t)g->m*g->n;
+
+  work = (double *)malloc(sizeof(double)*(plan->workspace > 0 ? plan->workspace : 1));
+  if(work == NULL){
+    printf("can't allocate the %zu MB workspace of the Strassen multiply\n", (plan->workspace*sizeof(double)) >> 20);
+    exit(-1);
+  }
+
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+  a.p = (double *)g->a; a.rs = a_rs; a.cs = a_cs;
+  b.p = (double *)g->b; b.rs = b_rs; b.cs = b_cs;
+  if(direct){
+    c.p = g->c; c.rs = g->ldc; c.cs = 1;
+  }else{
+    c.p = work + plan->workspace - (size_t)g->m*g->n; c.rs = g->n; c.cs = 1;
+  }
+
+  if(plan->task_depth == 0){
+    strassen_rec(g->m, g->n, g->k, a, b, c, work, 0, 0, cutoff);
+  }else{
+#   pragma omp parallel
+#   pragma omp single
+    strassen_rec(g->m, g->n, g->k, a, b, c, work, 0, plan->task_depth, cutoff);
+  }
+
+  if(!direct){
+#   pragma omp parallel for private(j) schedule(static)
+    for(i=0; i<g->m; i++)
+      for(j=0; j<g->n; j++)
+        g->c[(long)i*g->ldc + j] = g->alpha*c.p[(long)i*c.rs + j]
+                                 + (g->beta == 0.0 ? 0.0 : g->beta*g->c[(long)i*g->ldc + j]);
+  }
+  free(work);
+}
+
+/*****************************************************
+ Strassen-Winograd multiplication of a square matrix
+ ****************************************************/
+void matrix_mult_strassen(int size, double *matrix1_in,
+			  double *matrix2_in, double *matrix_out){
+  strassen_plan plan;
+  gemm_view g;
+
+  gemm_view_square(&g, size, matrix1_in, matrix2_in, matrix_out);
+  matrix_gemm_strassen(&g, strassen_cutoff(), &plan);
+}
+
+
+/*****************************************************
+ Normwise error of the product in g->c against a
+ reference: max|C - R| / (k * max|op(A)| * max|op(B)|).
+ Strassen only bounds the error of the whole matrix
+ (it grows as about n^log2(12)*eps in this norm),
+ where the classical product bounds every element
+ ****************************************************/
+double matrix_normwise_error(const gemm_view *g, const double *reference){
+  int a_rs, a_cs, b_rs, b_cs;
+  double max_a = 0, max_b = 0, max_diff = 0;
+  int i, j;
+
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+# pragma omp parallel private(j)
+  {
+#   pragma omp for reduction(max:max_a) nowait
+    for(i=0; i<g->m; i++)
+      for(j=0; j<g->k; j++)
+        max_a = fmax(max_a, fabs(g->a[(long)i*a_rs + (long)j*a_cs]));
+#   pragma omp for reduction(max:max_b) nowait
+    for(i=0; i<g->k; i++)
+      for(j=0; j<g->n; j++)
+        max_b = fmax(max_b, fabs(g->b[(long)i*b_rs + (long)j*b_cs]));
+#   pragma omp for reduction(max:max_diff)
+    for(i=0; i<g->m; i++)
+      for(j=0; j<g->n; j++)
+        max_diff = fmax(max_diff, fabs(g->c[(long)i*g->ldc + j] - reference[(long)i*g->n + j]));
+  }
+  if(max_a == 0 || max_b == 0)
+    return max_diff;
+  return max_diff / (g->k * max_a * max_b);
+}
@@ -0,0 +1,30 @@
+#ifndef MATRIX_STRASSEN_H_
+#define MATRIX_STRASSEN_H_
+
+#include "../common/matrix_view.h"
+
+// Products with a dimension at or below the cutoff go to the blocked kernel, MATRIX_STRASSEN_CUTOFF overrides it
+#define STRASSEN_CUTOFF 256
+
+// Deepest recursion level whose seven products still run as separate OpenMP tasks
+#define STRASSEN_MAX_TASK_DEPTH 3
+
+/*** TYPEDEFS AND STRUCTS***/
+// Shape of one Strassen-Winograd multiply, filled in before it runs. The top task_depth levels spawn
+// their seven products as tasks, each with temporaries of its own; the levels below run them one after
+// the other with three temporaries (and C itself) as workspace, about (m*k + k*n + m*n)/3 elements in all
+typedef struct {
+  int cutoff;
+  int levels;
+  int task_depth;
+  size_t workspace;
+  double flops;
+} strassen_plan;
+
+int strassen_cutoff(void);
+void matrix_gemm_strassen(const gemm_view *g, int cutoff, strassen_plan *plan);
+void matrix_mult_strassen(int size, double *matrix1_in,
+			  double *matrix2_in, double *matrix_out);
+double matrix_normwise_error(const gemm_view *g, const double *reference);
+
+#endif /* MATRIX_STRASSEN_H_ */
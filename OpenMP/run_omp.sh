@@ -2,15 +2,24 @@
 
 thread_num=$1
 matrix_size=$2
+mode=$3
+numa=$4
 
 echo "compile application"
 
-gcc -g -fopenmp -lm matrix_omp.c -o matrix_omp.exe
+gcc -g -O3 -fopenmp matrix_omp.c matrix_blocked.c matrix_numa.c matrix_strassen.c matrix_recursive.c matrix_batched.c matrix_ooc.c ../common/matrix_view.c ../common/bench.c ../common/perf_counters.c ../common/verify.c ../common/matrix_rng.c ../common/arena.c ../common/precision.c ../common/matrix_io.c -o matrix_omp.exe -lm
 
 echo "setting up number of threads value"
 export OMP_NUM_THREADS=$thread_num
 
+# Optional page placement (first-touch, interleave or replicate), threads are spread over the cores of every node
+if [ -n "$numa" ]; then
+  export MATRIX_NUMA=$numa
+  export OMP_PROC_BIND=${OMP_PROC_BIND:-spread}
+  export OMP_PLACES=${OMP_PLACES:-cores}
+fi
+
 echo "executing the application"
-./matrix_omp.exe $matrix_size
+./matrix_omp.exe $matrix_size $mode
 
 rm -fr *~ matrix_omp.exe
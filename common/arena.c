@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+static const char *pages_names[] = { "4 KiB pages", "hugetlbfs pages", "transparent huge pages" };
+
+
+/*****************************************************
+ Room taken in an arena by a rows x cols matrix of
+ doubles, including the worst-case alignment padding,
+ to size an arena before carving matrices out of it
+ ****************************************************/
+size_t arena_matrix_bytes(int rows, int cols, size_t align){
+  return sizeof(double)*(size_t)rows*cols + align;
+}
+
+
+/*****************************************************
+ Whether the kernel hands out transparent huge pages
+ to a madvise'd mapping: its mode (the bracketed one
+ of always, madvise and never) is not never. madvise
+ succeeds either way, so it can't tell
+ ****************************************************/
+static int thp_enabled(void){
+  char mode[64] = "";
+  FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+
+  if(f == NULL)
+    return 0;
+  if(fgets(mode, sizeof(mode), f) == NULL)
+    mode[0] = '\0';
+  fclose(f);
+  return mode[0] != '\0' && strstr(mode, "[never]") == NULL;
+}
+
+
+/*****************************************************
+ Maps an arena of at least bytes. Explicit huge pages
+ (MAP_HUGETLB) are tried first, they only exist when
+ the administrator reserved some, then a normal mapping
+ that madvise asks to back with transparent huge pages,
+ only reported as such when THP is not disabled.
+ MATRIX_HUGEPAGES=off keeps 4 KiB pages. The memory is
+ left untouched, so first-touch placement still works.
+ Returns 0 when no mapping could be made
+ ****************************************************/
+int arena_init(arena *a, size_t bytes){
+  return arena_init_pages(a, bytes, 1);
+}
+
+/*****************************************************
+ Same as arena_init, huge pages only being tried when
+ huge is set (and MATRIX_HUGEPAGES allows them).
+ Callers placing the matrices page by page on NUMA
+ nodes pass 0: a 2 MiB page lives on a single node, so
+ it would put several page-aligned matrices (or the
+ row slices of one) on whichever thread touched it
+ first
+ ****************************************************/
+int arena_init_pages(arena *a, size_t bytes, int huge){
+  const char *setting = getenv("MATRIX_HUGEPAGES");
+  void *base = MAP_FAILED;
+
+  if(setting != NULL && strcmp(setting, "off") == 0)
+    huge = 0;
+
+  memset(a, 0, sizeof(*a));
+  // Whole huge pages, MAP_HUGETLB needs a multiple of their size
+  a->capacity = (bytes + ARENA_HUGE_PAGE - 1) / ARENA_HUGE_PAGE * ARENA_HUGE_PAGE;
+
+#ifdef MAP_HUGETLB
+  if(huge){
+    base = mmap(NULL, a->capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(base != MAP_FAILED)
+      a->pages = ARENA_PAGES_HUGETLB;
+  }
+#endif
+  if(base == MAP_FAILED){
+    base = mmap(NULL, a->capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED){
+      printf("can't map an arena of %zu bytes\n", a->capacity);
+      a->capacity = 0;
+      return 0;
+    }
+    a->pages = ARENA_PAGES_SMALL;
+#ifdef MADV_HUGEPAGE
+    if(huge && madvise(base, a->capacity, MADV_HUGEPAGE) == 0 && thp_enabled())
+      a->pages = ARENA_PAGES_THP;
+#endif
+  }
+  a->base = (char *)base;
+  return 1;
+}
+
+
+/*****************************************************
+ Carves bytes aligned to align (a power of two) out of
+ the arena, NULL when it is full
+ ****************************************************/
+void *arena_alloc(arena *a, size_t bytes, size_t align){
+  size_t start = (a->used + align - 1) & ~(align - 1);
+
+  if(a->base == NULL || start + bytes > a->capacity)
+    return NULL;
+  a->used = start + bytes;
+  return a->base + start;
+}
+
+double *arena_matrix(arena *a, int rows, int cols, size_t align){
+  return (double *)arena_alloc(a, sizeof(double)*(size_t)rows*cols, align);
+}
+
+
+/*****************************************************
+ Gives every allocation back at once, the mapping (and
+ its already faulted pages) being kept for the next
+ multiply
+ ****************************************************/
+void arena_reset(arena *a){
+  a->used = 0;
+}
+
+
+void arena_release(arena *a){
+  if(a->base != NULL)
+    munmap(a->base, a->capacity);
+  memset(a, 0, sizeof(*a));
+}
+
+
+const char *arena_pages_name(const arena *a){
+  return pages_names[a->pages];
+}
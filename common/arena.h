@@ -0,0 +1,38 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+// Alignments of the matrices: a cache line (and AVX-512 vector), or a page for buffers the OpenCL
+// runtime wraps in place and for NUMA placement
+#define ARENA_ALIGN      64
+#define ARENA_PAGE_ALIGN 4096
+
+// Size of the huge pages asked for, the x86-64 default
+#define ARENA_HUGE_PAGE (2UL << 20)
+
+// Pages backing an arena
+#define ARENA_PAGES_SMALL  0
+#define ARENA_PAGES_HUGETLB 1
+#define ARENA_PAGES_THP    2
+
+/*** TYPEDEFS AND STRUCTS***/
+// One mapping out of which all the matrices of a run are carved. Allocations only bump used,
+// arena_reset gives the whole mapping back for the next multiply and arena_release unmaps it
+typedef struct {
+  char *base;
+  size_t capacity;
+  size_t used;
+  int pages;
+} arena;
+
+size_t arena_matrix_bytes(int rows, int cols, size_t align);
+int arena_init(arena *a, size_t bytes);
+int arena_init_pages(arena *a, size_t bytes, int huge);
+void *arena_alloc(arena *a, size_t bytes, size_t align);
+double *arena_matrix(arena *a, int rows, int cols, size_t align);
+void arena_reset(arena *a);
+void arena_release(arena *a);
+const char *arena_pages_name(const arena *a);
+
+#endif /* ARENA_H_ */
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "bench.h"
+
+
+/*****************************************************
+ Parses a comma-separated list of positive integers.
+ Returns -1 on a bad value or when the list has more
+ than max_values of them
+ ****************************************************/
+static int parse_list(const char *text, int *values, int max_values){
+  int count = 0;
+
+  while(*text != '\0' && count < max_values){
+    char *end;
+    long value = strtol(text, &end, 10);
+    if(end == text || value <= 0)
+      return -1;
+    values[count++] = (int)value;
+    text = (*end == ',') ? end+1 : end;
+    if(*end != ',' && *end != '\0')
+      return -1;
+  }
+  return (*text == '\0') ? count : -1;
+}
+
+
+/*****************************************************
+ Reads the bench options following the "bench" word of
+ a driver's command line. Returns 0 on a bad option
+ ****************************************************/
+int bench_parse_args(int argc, char *argv[], bench_config *config){
+  int arg;
+
+  memset(config, 0, sizeof(*config));
+  config->sizes[0] = 256; config->sizes[1] = 512;
+  config->num_sizes = 2;
+  config->threads[0] = omp_get_max_threads();
+  config->num_threads = 1;
+  config->local_sizes[0] = 64;
+  config->num_local_sizes = 1;
+  config->warmup = 1;
+  config->trials = 5;
+
+  for(arg=0; arg<argc; arg++){
+    const char *value = (arg+1 < argc) ? argv[arg+1] : NULL;
+
+    if(strcmp(argv[arg], "--append") == 0){
+      config->append = 1;
+      continue;
+    }
+    if(value == NULL){
+      printf("missing value for %s\n", argv[arg]);
+      return 0;
+    }
+    if(strcmp(argv[arg], "--sizes") == 0)
+      config->num_sizes = parse_list(value, config->sizes, BENCH_MAX_VALUES);
+    else if(strcmp(argv[arg], "--threads") == 0)
+      config->num_threads = parse_list(value, config->threads, BENCH_MAX_VALUES);
+    else if(strcmp(argv[arg], "--local-sizes") == 0)
+      config->num_local_sizes = parse_list(value, config->local_sizes, BENCH_MAX_VALUES);
+    else if(strcmp(argv[arg], "--warmup") == 0)
+      config->warmup = atoi(value);
+    else if(strcmp(argv[arg], "--trials") == 0)
+      config->trials = atoi(value);
+    else if(strcmp(argv[arg], "--format") == 0){
+      if(strcmp(value, "json") != 0 && strcmp(value, "csv") != 0){
+        printf("unknown format %s, expected csv or json\n", value);
+        return 0;
+      }
+      config->json = (strcmp(value, "json") == 0);
+    }
+    else if(strcmp(argv[arg], "--output") == 0)
+      config->output = value;
+    else if(strcmp(argv[arg], "--kernels") == 0)
+      config->kernels = value;
+    else{
+      printf("unknown bench option %s\n", argv[arg]);
+      return 0;
+    }
+    arg++;
+  }
+
+  if(config->num_sizes <= 0 || config->num_threads <= 0 || config->num_local_sizes <= 0
+     || config->trials <= 0 || config->warmup < 0){
+    printf("bench lists take up to %d positive integers, e.g. --sizes 256,512 --threads 1,2,4\n", BENCH_MAX_VALUES);
+    return 0;
+  }
+  return 1;
+}
+
+
+/*****************************************************
+ Whether a kernel is part of the --kernels list (all
+ of them when no list was given)
+ ****************************************************/
+int bench_kernel_enabled(const bench_config *config, const char *kernel){
+  size_t length = strlen(kernel);
+  const char *item = config->kernels;
+
+  if(item == NULL)
+    return 1;
+  while(*item != '\0'){
+    if(strncmp(item, kernel, length) == 0 && (item[length] == ',' || item[length] == '\0'))
+      return 1;
+    item = strchr(item, ',');
+    if(item == NULL)
+      break;
+    item++;
+  }
+  return 0;
+}
+
+
+static int compare_doubles(const void *a, const void *b){
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/*****************************************************
+ Runs fn for the warm-up and the timed trials and fills
+ the statistics of result, whose size must be set
+ ****************************************************/
+void bench_measure(bench_fn fn, void *context, const bench_config *config, bench_result *result){
+  double *times = (double *)malloc(sizeof(double)*config->trials);
+  int t, p95;
+
+  for(t=0; t<config->warmup; t++)
+    fn(context);
+  for(t=0; t<config->trials; t++){
+    double start = omp_get_wtime();
+    fn(context);
+    times[t] = omp_get_wtime() - start;
+  }
+
+  qsort(times, config->trials, sizeof(double), compare_doubles);
+  // Nearest-rank percentiles
+  p95 = (int)(0.95*config->trials + 0.999999) - 1;
+  result->trials = config->trials;
+  result->min = times[0];
+  result->median = (config->trials % 2) ? times[config->trials/2]
+                 : 0.5*(times[config->trials/2 - 1] + times[config->trials/2]);
+  result->p95 = times[p95 < 0 ? 0 : p95];
+  result->gflops = 2.0*result->size*(double)result->size*result->size / result->median * 1e-9;
+  free(times);
+}
+
+
+int bench_open(bench_output *output, const bench_config *config){
+  output->json = config->json;
+  if(config->output == NULL){
+    output->file = stdout;
+  }else if((output->file = fopen(config->output, config->append ? "a" : "w")) == NULL){
+    printf("cannot open %s\n", config->output);
+    return 0;
+  }
+  // Appending runs of several back ends to one CSV only needs the header once
+  if(!output->json && !config->append)
+    fprintf(output->file, "backend,kernel,size,threads,local_size,trials,median_s,p95_s,min_s,gflops,speedup\n");
+  return 1;
+}
+
+
+void bench_emit(bench_output *output, const bench_result *r){
+  if(output->json)
+    fprintf(output->file, "{\"backend\":\"%s\",\"kernel\":\"%s\",\"size\":%d,\"threads\":%d,\"local_size\":%d,"
+            "\"trials\":%d,\"median_s\":%.9f,\"p95_s\":%.9f,\"min_s\":%.9f,\"gflops\":%.4f,\"speedup\":%.4f}\n",
+            r->backend, r->kernel, r->size, r->threads, r->local_size, r->trials,
+            r->median, r->p95, r->min, r->gflops, r->speedup);
+  else
+    fprintf(output->file, "%s,%s,%d,%d,%d,%d,%.9f,%.9f,%.9f,%.4f,%.4f\n",
+            r->backend, r->kernel, r->size, r->threads, r->local_size, r->trials,
+            r->median, r->p95, r->min, r->gflops, r->speedup);
+  fflush(output->file);
+}
+
+
+void bench_close(bench_output *output){
+  if(output->file != NULL && output->file != stdout)
+    fclose(output->file);
+  output->file = NULL;
+}
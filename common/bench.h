@@ -0,0 +1,57 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdio.h>
+
+// Longest sweep accepted for each of the swept parameters
+#define BENCH_MAX_VALUES 32
+
+/*** TYPEDEFS AND STRUCTS***/
+// Sweep and output settings shared by the three drivers' bench mode. Each list is given as a
+// comma-separated value on the command line, e.g. --sizes 256,512,1024 --threads 1,2,4
+typedef struct {
+  int sizes[BENCH_MAX_VALUES];
+  int num_sizes;
+  int threads[BENCH_MAX_VALUES];
+  int num_threads;
+  int local_sizes[BENCH_MAX_VALUES];
+  int num_local_sizes;
+  int warmup;
+  int trials;
+  int json;
+  int append;
+  const char *output;
+  const char *kernels;
+} bench_config;
+
+// Outcome of one configuration. Times are in seconds, speedup is relative to matrix_mult_sq
+typedef struct {
+  const char *backend;
+  const char *kernel;
+  int size;
+  int threads;
+  int local_size;
+  int trials;
+  double median;
+  double p95;
+  double min;
+  double gflops;
+  double speedup;
+} bench_result;
+
+// Open output stream, CSV gets its header once, JSON is written as one object per line
+typedef struct {
+  FILE *file;
+  int json;
+} bench_output;
+
+typedef void (*bench_fn)(void *context);
+
+int bench_parse_args(int argc, char *argv[], bench_config *config);
+int bench_kernel_enabled(const bench_config *config, const char *kernel);
+void bench_measure(bench_fn fn, void *context, const bench_config *config, bench_result *result);
+int bench_open(bench_output *output, const bench_config *config);
+void bench_emit(bench_output *output, const bench_result *result);
+void bench_close(bench_output *output);
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "matrix_rng.h"
+#include "matrix_io.h"
+
+static const char *dtype_names[] = { "float64", "float32" };
+static const char *layout_names[] = { "row-major", "col-major", "tiled" };
+
+const char *matrix_dtype_name(int dtype){
+  return (dtype >= 0 && dtype <= MATRIX_DTYPE_FLOAT32) ? dtype_names[dtype] : "unknown";
+}
+
+const char *matrix_layout_name(int layout){
+  return (layout >= 0 && layout <= MATRIX_LAYOUT_TILED) ? layout_names[layout] : "unknown";
+}
+
+static size_t element_size(int dtype){
+  return (dtype == MATRIX_DTYPE_FLOAT32) ? sizeof(float) : sizeof(double);
+}
+
+
+/*****************************************************
+ Bytes of the payload a header describes: all the
+ elements (whole tiles in the tiled layout), rounded
+ up to whole 8-byte words for the checksum. Returns 0
+ when there are no elements or they don't fit in a
+ size_t
+ ****************************************************/
+size_t matrix_file_payload_bytes(const matrix_file_header *h){
+  uint64_t rows = h->rows, cols = h->cols;
+  size_t esize = element_size(h->dtype);
+
+  if(h->layout == MATRIX_LAYOUT_TILED){
+    if(h->tile == 0)
+      return 0;
+    // Counted in tiles first, so rounding up can't wrap around
+    rows = rows / h->tile + (rows % h->tile != 0);
+    cols = cols / h->tile + (cols % h->tile != 0);
+    if(rows > SIZE_MAX / h->tile || cols > SIZE_MAX / h->tile)
+      return 0;
+    rows *= h->tile;
+    cols *= h->tile;
+  }
+  if(rows == 0 || cols == 0 || rows > SIZE_MAX || cols > (SIZE_MAX - 7) / esize / rows)
+    return 0;
+  return ((size_t)rows*(size_t)cols*esize + 7) & ~(size_t)7;
+}
+
+
+/*****************************************************
+ Checksum of a payload of whole 8-byte words: the sum
+ of every word mixed with its position through the
+ counter-based generator, so swapped or shifted words
+ change it, and the words can be summed in any order,
+ in parallel
+ ****************************************************/
+uint64_t matrix_checksum(const void *payload, size_t bytes){
+  const uint64_t *words = (const uint64_t *)payload;
+  long count = bytes / sizeof(uint64_t), i;
+  uint64_t sum = 0;
+
+# pragma omp parallel for reduction(+:sum) schedule(static)
+  for(i=0; i<count; i++)
+    sum += rng_counter(words[i], i);
+  return sum;
+}
+
+
+/*****************************************************
+ Checks a header read from a file of file_bytes bytes,
+ printing what is wrong with it. Returns 1 when valid
+ ****************************************************/
+static int header_valid(const matrix_file_header *h, size_t file_bytes, const char *path){
+  size_t payload_bytes;
+
+  if(memcmp(h->magic, MATRIX_FILE_MAGIC, sizeof(h->magic)) != 0){
+    printf("%s is not a matrix file (or was not completely written)\n", path);
+    return 0;
+  }
+  if(h->version != MATRIX_FILE_VERSION){
+    printf("%s has version %u, expected %d\n", path, h->version, MATRIX_FILE_VERSION);
+    return 0;
+  }
+  if(h->dtype > MATRIX_DTYPE_FLOAT32 || h->layout > MATRIX_LAYOUT_TILED){
+    printf("%s has an unknown element type %u or layout %u\n", path, h->dtype, h->layout);
+    return 0;
+  }
+  if(h->rows == 0 || h->cols == 0 || h->rows > INT_MAX || h->cols > INT_MAX
+     || (h->layout == MATRIX_LAYOUT_TILED && (h->tile == 0 || h->tile > INT_MAX))){
+    printf("%s has invalid dimensions %llux%llu (tile %u)\n", path,
+	   (unsigned long long)h->rows, (unsigned long long)h->cols, h->tile);
+    return 0;
+  }
+  if(h->alignment < sizeof(uint64_t) || (h->alignment & (h->alignment - 1)) != 0
+     || h->payload_offset < sizeof(*h) || h->payload_offset % h->alignment != 0){
+    printf("%s has a payload at offset %llu, not a multiple of its alignment %u\n", path,
+	   (unsigned long long)h->payload_offset, h->alignment);
+    return 0;
+  }
+  payload_bytes = matrix_file_payload_bytes(h);
+  if(payload_bytes == 0){
+    printf("%s has a payload of %llux%llu elements too large to address\n", path,
+	   (unsigned long long)h->rows, (unsigned long long)h->cols);
+    return 0;
+  }
+  // Compared without adding the two, which could wrap around
+  if(payload_bytes > file_bytes || h->payload_offset > file_bytes - payload_bytes){
+    printf("%s is truncated, %zu bytes for a payload of %zu bytes at offset %llu\n", path, file_bytes,
+	   payload_bytes, (unsigned long long)h->payload_offset);
+    return 0;
+  }
+  return 1;
+}
+
+
+/*****************************************************
+ Maps a matrix file for reading, without copying it:
+ the payload is used in place through a private
+ mapping, read in by the checksum pass. Returns 0, with
+ the reason printed, when the file can't be used
+ ****************************************************/
+int matrix_file_open(matrix_file *f, const char *path){
+  struct stat st;
+  uint64_t checksum;
+
+  memset(f, 0, sizeof(*f));
+  f->fd = open(path, O_RDONLY);
+  if(f->fd < 0){
+    printf("can't open %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  if(fstat(f->fd, &st) != 0 || (size_t)st.st_size < sizeof(matrix_file_header)){
+    printf("%s is too short to be a matrix file\n", path);
+    matrix_file_close(f);
+    return 0;
+  }
+  f->bytes = st.st_size;
+  f->map = (char *)mmap(NULL, f->bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, f->fd, 0);
+  if(f->map == MAP_FAILED){
+    printf("can't map %s: %s\n", path, strerror(errno));
+    f->map = NULL;
+    matrix_file_close(f);
+    return 0;
+  }
+  memcpy(&f->header, f->map, sizeof(f->header));
+  if(!header_valid(&f->header, f->bytes, path)){
+    matrix_file_close(f);
+    return 0;
+  }
+  f->payload = f->map + f->header.payload_offset;
+  f->payload_bytes = matrix_file_payload_bytes(&f->header);
+
+  // The checksum reads the whole payload, the hint has the kernel read it ahead in large requests
+  madvise(f->map, f->bytes, MADV_WILLNEED);
+  checksum = matrix_checksum(f->payload, f->payload_bytes);
+  if(checksum != f->header.checksum){
+    printf("%s is corrupted, checksum %016llx instead of %016llx\n", path,
+	   (unsigned long long)checksum, (unsigned long long)f->header.checksum);
+    matrix_file_close(f);
+    return 0;
+  }
+  return 1;
+}
+
+
+/*****************************************************
+ Whether the payload is what the drivers multiply, a
+ row-major matrix of doubles, usable without a copy
+ ****************************************************/
+int matrix_file_is_native(const matrix_file *f){
+  return f->header.dtype == MATRIX_DTYPE_FLOAT64 && f->header.layout == MATRIX_LAYOUT_ROW_MAJOR;
+}
+
+
+/*****************************************************
+ Copies the matrix into dest, row-major doubles with a
+ leading dimension of ld, from any type and layout
+ ****************************************************/
+void matrix_file_read(const matrix_file *f, double *dest, int ld){
+  const matrix_file_header *h = &f->header;
+  int rows = h->rows, cols = h->cols, tile = h->tile;
+  size_t tiles_per_row = (h->layout == MATRIX_LAYOUT_TILED) ? (cols + tile - 1) / tile : 0;
+  int i;
+
+# pragma omp parallel for schedule(static)
+  for(i=0; i<rows; i++){
+    int j;
+    for(j=0; j<cols; j++){
+      size_t index;
+      if(h->layout == MATRIX_LAYOUT_ROW_MAJOR)
+        index = (size_t)i*cols + j;
+      else if(h->layout == MATRIX_LAYOUT_COL_MAJOR)
+        index = (size_t)j*rows + i;
+      else
+        index = ((i / tile)*tiles_per_row + j / tile)*tile*(size_t)tile + (size_t)(i % tile)*tile + j % tile;
+      dest[(size_t)i*ld + j] = (h->dtype == MATRIX_DTYPE_FLOAT32)
+        ? ((const float *)f->payload)[index] : ((const double *)f->payload)[index];
+    }
+  }
+}
+
+
+/*****************************************************
+ Creates a matrix file sized for its payload and maps
+ it shared, so the caller writes the elements in place.
+ The header only goes in with matrix_file_commit, until
+ then the file is rejected by matrix_file_open. An
+ alignment of 0 is MATRIX_FILE_ALIGN. Returns the
+ payload, NULL on failure
+ ****************************************************/
+void *matrix_file_create(matrix_file *f, const char *path, int rows, int cols,
+			 int dtype, int layout, int tile, size_t alignment){
+  matrix_file_header *h = &f->header;
+
+  memset(f, 0, sizeof(*f));
+  f->fd = -1;
+  if(alignment == 0)
+    alignment = MATRIX_FILE_ALIGN;
+  memcpy(h->magic, MATRIX_FILE_MAGIC, sizeof(h->magic));
+  h->version = MATRIX_FILE_VERSION;
+  h->dtype = dtype;
+  h->layout = layout;
+  h->alignment = alignment;
+  h->rows = rows;
+  h->cols = cols;
+  h->tile = (layout == MATRIX_LAYOUT_TILED) ? tile : 0;
+  h->payload_offset = (sizeof(*h) + alignment - 1) / alignment * alignment;
+  f->payload_bytes = matrix_file_payload_bytes(h);
+  f->bytes = h->payload_offset + f->payload_bytes;
+  f->writable = 1;
+  if(f->payload_bytes == 0 || f->bytes < f->payload_bytes){
+    printf("can't create %s, a %dx%d matrix is too large to address\n", path, rows, cols);
+    return NULL;
+  }
+
+  f->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(f->fd < 0){
+    printf("can't create %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  if(ftruncate(f->fd, f->bytes) != 0){
+    printf("can't size %s to %zu bytes: %s\n", path, f->bytes, strerror(errno));
+    matrix_file_close(f);
+    return NULL;
+  }
+  f->map = (char *)mmap(NULL, f->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+  if(f->map == MAP_FAILED){
+    printf("can't map %s: %s\n", path, strerror(errno));
+    f->map = NULL;
+    matrix_file_close(f);
+    return NULL;
+  }
+  f->payload = f->map + h->payload_offset;
+  return f->payload;
+}
+
+
+/*****************************************************
+ Seals a created file once its payload is written: the
+ checksum and the header go in, and everything is
+ flushed to the file. Returns 0 on failure
+ ****************************************************/
+int matrix_file_commit(matrix_file *f){
+  if(!f->writable || f->map == NULL)
+    return 0;
+  f->header.checksum = matrix_checksum(f->payload, f->payload_bytes);
+  memcpy(f->map, &f->header, sizeof(f->header));
+  if(msync(f->map, f->bytes, MS_SYNC) != 0){
+    printf("can't write the matrix file back: %s\n", strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+
+void matrix_file_close(matrix_file *f){
+  if(f->map != NULL)
+    munmap(f->map, f->bytes);
+  if(f->fd >= 0)
+    close(f->fd);
+  f->map = NULL;
+  f->payload = NULL;
+  f->fd = -1;
+}
+
+
+/*****************************************************
+ Takes --input A.bin B.bin or --output C.bin at
+ argv[*arg], moving *arg to the last argument used.
+ Returns 0 when argv[*arg] is neither
+ ****************************************************/
+int matrix_io_option(int argc, char *argv[], int *arg, matrix_io_args *io){
+  if(strcmp(argv[*arg], "--input") == 0 && *arg+2 < argc){
+    io->input_a = argv[++(*arg)];
+    io->input_b = argv[++(*arg)];
+    return 1;
+  }
+  if(strcmp(argv[*arg], "--output") == 0 && *arg+1 < argc){
+    io->output = argv[++(*arg)];
+    return 1;
+  }
+  return 0;
+}
+
+
+/*****************************************************
+ Opens the two inputs, when given, which must be
+ square and of the same size. A size of 0 takes theirs,
+ any other has to match it. Returns 0 on failure
+ ****************************************************/
+int matrix_io_load_inputs(const matrix_io_args *io, int *size, matrix_file *a, matrix_file *b){
+  int n;
+
+  if(io->input_a == NULL)
+    return 1;
+  if(!matrix_file_open(a, io->input_a))
+    return 0;
+  if(!matrix_file_open(b, io->input_b)){
+    matrix_file_close(a);
+    return 0;
+  }
+  n = a->header.rows;
+  if(a->header.cols != a->header.rows || b->header.rows != a->header.rows || b->header.cols != a->header.rows){
+    printf("the inputs must be square and of the same size, %s is %llux%llu and %s %llux%llu\n",
+	   io->input_a, (unsigned long long)a->header.rows, (unsigned long long)a->header.cols,
+	   io->input_b, (unsigned long long)b->header.rows, (unsigned long long)b->header.cols);
+  }else if(*size > 0 && *size != n){
+    printf("size %d doesn't match the %dx%d matrices of the inputs\n", *size, n, n);
+  }else{
+    *size = n;
+    return 1;
+  }
+  matrix_file_close(a);
+  matrix_file_close(b);
+  return 0;
+}
+
+
+/*****************************************************
+ The operand held by an input file: its payload itself
+ when it is a row-major matrix of doubles, otherwise
+ its elements converted into buffer
+ ****************************************************/
+double *matrix_io_operand(const matrix_file *f, const char *path, double *buffer, int size){
+  int native = matrix_file_is_native(f);
+
+  printf("INPUT %s: %dx%d %s %s, %s\n", path, size, size, matrix_dtype_name(f->header.dtype),
+	 matrix_layout_name(f->header.layout), native ? "used in place" : "converted");
+  if(native)
+    return (double *)f->payload;
+  matrix_file_read(f, buffer, size);
+  return buffer;
+}
@@ -0,0 +1,78 @@
+#ifndef MATRIX_IO_H_
+#define MATRIX_IO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// First bytes of every matrix file, and the version of the header that follows them
+#define MATRIX_FILE_MAGIC   "MATRIXBN"
+#define MATRIX_FILE_VERSION 1
+
+// Alignment of the payload written when none is asked for, a cache line (and AVX-512 vector)
+#define MATRIX_FILE_ALIGN 64
+
+// Element types
+#define MATRIX_DTYPE_FLOAT64 0
+#define MATRIX_DTYPE_FLOAT32 1
+
+// Payload layouts. Tiled stores tile x tile blocks, row by row of blocks, each block row-major and
+// the blocks on the right and bottom edges padded with zeros to a whole tile
+#define MATRIX_LAYOUT_ROW_MAJOR 0
+#define MATRIX_LAYOUT_COL_MAJOR 1
+#define MATRIX_LAYOUT_TILED     2
+
+/*** TYPEDEFS AND STRUCTS***/
+// On-disk header, 64 bytes in the byte order of the host. The payload starts at payload_offset, a
+// multiple of alignment, and takes the elements rounded up to whole 8-byte words (zero padded).
+// checksum is matrix_checksum of those words
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t dtype;
+  uint32_t layout;
+  uint32_t alignment;
+  uint64_t rows;
+  uint64_t cols;
+  uint32_t tile;
+  uint32_t reserved;
+  uint64_t payload_offset;
+  uint64_t checksum;
+} matrix_file_header;
+
+// A matrix file mapped in memory. Files opened for reading are mapped privately, so the payload can
+// be used in place and a stray write never reaches the file; files created for writing are shared
+// mappings the result is computed straight into
+typedef struct {
+  int fd;
+  char *map;
+  size_t bytes;
+  matrix_file_header header;
+  void *payload;
+  size_t payload_bytes;
+  int writable;
+} matrix_file;
+
+// Inputs and output named on the command line, NULL when not given
+typedef struct {
+  const char *input_a;
+  const char *input_b;
+  const char *output;
+} matrix_io_args;
+
+size_t matrix_file_payload_bytes(const matrix_file_header *h);
+uint64_t matrix_checksum(const void *payload, size_t bytes);
+int matrix_file_open(matrix_file *f, const char *path);
+int matrix_file_is_native(const matrix_file *f);
+void matrix_file_read(const matrix_file *f, double *dest, int ld);
+void *matrix_file_create(matrix_file *f, const char *path, int rows, int cols,
+			 int dtype, int layout, int tile, size_t alignment);
+int matrix_file_commit(matrix_file *f);
+void matrix_file_close(matrix_file *f);
+const char *matrix_dtype_name(int dtype);
+const char *matrix_layout_name(int layout);
+
+int matrix_io_option(int argc, char *argv[], int *arg, matrix_io_args *io);
+int matrix_io_load_inputs(const matrix_io_args *io, int *size, matrix_file *a, matrix_file *b);
+double *matrix_io_operand(const matrix_file *f, const char *path, double *buffer, int size);
+
+#endif /* MATRIX_IO_H_ */
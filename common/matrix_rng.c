@@ -0,0 +1,48 @@
+#include <stdlib.h>
+#include <omp.h>
+#include "matrix_rng.h"
+
+
+/*****************************************************
+ Seed of the generated operands, MATRIX_SEED or the
+ default one, so every run and back end multiplies the
+ same matrices unless asked otherwise
+ ****************************************************/
+uint64_t matrix_seed(void){
+  const char *value = getenv("MATRIX_SEED");
+  return (value != NULL) ? strtoull(value, NULL, 0) : MATRIX_SEED_DEFAULT;
+}
+
+
+/*****************************************************
+ Key of one stream of a seed, the streams being far
+ apart starting points of the SplitMix64 sequence
+ ****************************************************/
+uint64_t matrix_rng_key(uint64_t seed, uint64_t stream){
+  return rng_mix(seed ^ rng_mix(stream + 0x632BE59BD9B4E019ULL));
+}
+
+
+/*****************************************************
+ Fills a rows x cols matrix (row stride ld) with
+ uniform values in [0,1). Element (i,j) is a pure
+ function of the seed, the stream and i*cols+j, so the
+ rows are split over the threads and the inner loop is
+ vectorized while the matrix stays bit-identical for
+ any thread count, vector width or back end
+ ****************************************************/
+void matrix_random(double *matrix, int rows, int cols, int ld,
+		   uint64_t seed, uint64_t stream){
+  uint64_t key = matrix_rng_key(seed, stream);
+  int i;
+
+# pragma omp parallel for schedule(static)
+  for(i=0; i<rows; i++){
+    double *row = matrix + (size_t)i*ld;
+    uint64_t first = (uint64_t)i*cols;
+    int j;
+#   pragma omp simd
+    for(j=0; j<cols; j++)
+      row[j] = rng_uniform(rng_counter(key, first + j));
+  }
+}
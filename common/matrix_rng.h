@@ -0,0 +1,43 @@
+#ifndef MATRIX_RNG_H_
+#define MATRIX_RNG_H_
+
+#include <stdint.h>
+
+// Seed used when MATRIX_SEED is not set
+#define MATRIX_SEED_DEFAULT 5307
+
+// Streams of the operands, so A and B differ under the same seed
+#define MATRIX_STREAM_A 0
+#define MATRIX_STREAM_B 1
+
+/*****************************************************
+ SplitMix64 finalizer: a bijective mix of the 64 bits,
+ the output function of the SplitMix generator
+ ****************************************************/
+static inline uint64_t rng_mix(uint64_t z){
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/*****************************************************
+ Value number index of the SplitMix64 sequence started
+ at key, computed directly from the counter instead of
+ stepping a state, so any element can be generated
+ alone and in any order
+ ****************************************************/
+static inline uint64_t rng_counter(uint64_t key, uint64_t index){
+  return rng_mix(key + (index + 1) * 0x9E3779B97F4A7C15ULL);
+}
+
+// Uniform double in [0,1) from the top 53 bits
+static inline double rng_uniform(uint64_t bits){
+  return (double)(bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+uint64_t matrix_seed(void);
+uint64_t matrix_rng_key(uint64_t seed, uint64_t stream);
+void matrix_random(double *matrix, int rows, int cols, int ld,
+		   uint64_t seed, uint64_t stream);
+
+#endif /* MATRIX_RNG_H_ */
@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include "matrix_view.h"
+
+/*****************************************************
+ Fills a view describing the dense square product
+ C = A*B that the drivers have always computed
+ ****************************************************/
+void gemm_view_square(gemm_view *g, int size, const double *a,
+		      const double *b, double *c){
+  g->m = g->n = g->k = size;
+  g->alpha = 1.0;
+  g->beta = 0.0;
+  g->a = a; g->lda = size; g->trans_a = MV_NOTRANS;
+  g->b = b; g->ldb = size; g->trans_b = MV_NOTRANS;
+  g->c = c; g->ldc = size;
+}
+
+/*****************************************************
+ Restricts a view to the m x n block of C starting at
+ (i,j) and to the k-deep slice of the inner dimension
+ starting at p. No data is copied, only the pointers move
+ ****************************************************/
+void gemm_view_block(const gemm_view *g, int i, int j, int p,
+		     int m, int n, int k, gemm_view *block){
+  int a_rs, a_cs, b_rs, b_cs;
+
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+  *block = *g;
+  block->m = m;
+  block->n = n;
+  block->k = k;
+  block->a = g->a + (long)i*a_rs + (long)p*a_cs;
+  block->b = g->b + (long)p*b_rs + (long)j*b_cs;
+  block->c = g->c + (long)i*g->ldc + j;
+}
+
+/*****************************************************
+ Computes the rows [row_begin, row_end) of the result
+ with the straightforward dot product, in the same
+ summation order as the original matrix_mult_sq
+ ****************************************************/
+void matrix_gemm_rows(const gemm_view *g, int row_begin, int row_end){
+  int a_rs, a_cs, b_rs, b_cs;
+  int rows, cols, j;
+
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+  for(rows=row_begin; rows<row_end; rows++){
+    const double *a_row = g->a + (long)rows*a_rs;
+    double *c_row = g->c + (long)rows*g->ldc;
+    for(cols=0; cols<g->n; cols++){
+      const double *b_col = g->b + (long)cols*b_cs;
+      double acc = 0.0;
+      for(j=0; j<g->k; j++)
+        acc += a_row[(long)j*a_cs] * b_col[(long)j*b_rs];
+      c_row[cols] = (g->beta == 0.0) ? g->alpha*acc : g->alpha*acc + g->beta*c_row[cols];
+    }
+  }
+}
+
+/*****************************************************
+ Sequential reference multiplication of any view
+ ****************************************************/
+void matrix_gemm_ref(const gemm_view *g){
+  matrix_gemm_rows(g, 0, g->m);
+}
@@ -0,0 +1,40 @@
+#ifndef MATRIX_VIEW_H_
+#define MATRIX_VIEW_H_
+
+// Transposition flags of the operands, op(X) being X itself or its transpose
+#define MV_NOTRANS 0
+#define MV_TRANS   1
+
+/*** TYPEDEFS AND STRUCTS***/
+// Describes C = alpha*op(A)*op(B) + beta*C, where op(A) is m x k, op(B) is k x n and C is m x n.
+// The operands are row-major views into possibly larger arrays: lda, ldb and ldc are the distances,
+// in elements, between two consecutive rows of the stored matrices, so sub-blocks are used in place.
+// As in BLAS, C is not read when beta is zero
+typedef struct {
+  int m, n, k;
+  double alpha, beta;
+  const double *a; int lda; int trans_a;
+  const double *b; int ldb; int trans_b;
+  double *c; int ldc;
+} gemm_view;
+
+/*****************************************************
+ Row and column strides of op(A) and op(B), element
+ (i,j) of op(A) being a[i*a_rs + j*a_cs]
+ ****************************************************/
+static inline void gemm_view_strides(const gemm_view *g, int *a_rs, int *a_cs,
+				     int *b_rs, int *b_cs){
+  *a_rs = g->trans_a ? 1 : g->lda;
+  *a_cs = g->trans_a ? g->lda : 1;
+  *b_rs = g->trans_b ? 1 : g->ldb;
+  *b_cs = g->trans_b ? g->ldb : 1;
+}
+
+void gemm_view_square(gemm_view *g, int size, const double *a,
+		      const double *b, double *c);
+void gemm_view_block(const gemm_view *g, int i, int j, int p,
+		     int m, int n, int k, gemm_view *block);
+void matrix_gemm_rows(const gemm_view *g, int row_begin, int row_end);
+void matrix_gemm_ref(const gemm_view *g);
+
+#endif /* MATRIX_VIEW_H_ */
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <omp.h>
+#include "perf_counters.h"
+
+// Cache line size used to turn LLC misses into bytes moved from memory
+#define PERF_LINE_BYTES 64
+
+static const char *event_names[PERF_NUM_EVENTS] = {
+  "cycles", "instructions", "L1D misses", "LLC misses", "dTLB misses", "FP vector ops"
+};
+
+
+/*****************************************************
+ Whether the counters were asked for, through the
+ MATRIX_PERF environment variable
+ ****************************************************/
+int perf_requested(void){
+  const char *value = getenv("MATRIX_PERF");
+  return value != NULL && strcmp(value, "0") != 0;
+}
+
+
+/*****************************************************
+ perf_event_attr of each counted event, 0 when it has
+ no encoding on this cpu
+ ****************************************************/
+static int event_attr(int event, struct perf_event_attr *attr){
+  memset(attr, 0, sizeof(*attr));
+  attr->size = sizeof(*attr);
+  attr->disabled = 1;
+  // User space only, which perf_event_paranoid=2 still allows for our own threads
+  attr->exclude_kernel = 1;
+  attr->exclude_hv = 1;
+  attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  switch(event){
+    case PERF_CYCLES:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_CPU_CYCLES;
+      return 1;
+    case PERF_INSTRUCTIONS:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+      return 1;
+    case PERF_L1D_MISSES:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                   | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      return 1;
+    case PERF_LLC_MISSES:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_CACHE_MISSES;
+      return 1;
+    case PERF_DTLB_MISSES:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                   | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      return 1;
+    case PERF_FP_VECTOR_OPS:
+#if defined(__x86_64__) || defined(__i386__)
+      // FP_ARITH_INST_RETIRED (event 0xC7) with the 128/256/512-bit packed double umasks, Intel only
+      if(!__builtin_cpu_is("intel"))
+        return 0;
+      attr->type = PERF_TYPE_RAW;
+      attr->config = 0xC7 | ((0x04 | 0x10 | 0x40) << 8);
+      return 1;
+#else
+      return 0;
+#endif
+  }
+  return 0;
+}
+
+
+/*****************************************************
+ Opens, resets and starts the counters of every thread.
+ The OpenMP runtime reuses the same team for the next
+ parallel region, so counters opened here by each
+ thread follow the kernel's threads
+ ****************************************************/
+void perf_begin(perf_session *session){
+  memset(session, 0, sizeof(*session));
+  session->enabled = perf_requested();
+  if(!session->enabled)
+    return;
+
+# pragma omp parallel shared(session)
+  {
+    int tid = omp_get_thread_num();
+    int e;
+
+#   pragma omp single
+    session->num_threads = (omp_get_num_threads() < PERF_MAX_THREADS) ? omp_get_num_threads() : PERF_MAX_THREADS;
+
+    if(tid < PERF_MAX_THREADS){
+      for(e=0; e<PERF_NUM_EVENTS; e++){
+        struct perf_event_attr attr;
+        int fd = -1;
+        if(event_attr(e, &attr))
+          fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        session->fds[tid][e] = fd;
+        // Remembers why the first counter failed, e.g. EACCES under perf_event_paranoid or ENOENT in a VM without a PMU
+        if(fd < 0 && e == PERF_CYCLES){
+#         pragma omp atomic write
+          session->open_errno = errno;
+        }
+        if(fd >= 0){
+          ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+          ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+      }
+    }
+  }
+}
+
+
+/*****************************************************
+ Stops and reads the counters, each thread closing its own
+ ****************************************************/
+void perf_end(perf_session *session){
+  if(!session->enabled)
+    return;
+
+# pragma omp parallel shared(session)
+  {
+    int tid = omp_get_thread_num();
+    int e;
+
+    if(tid < session->num_threads){
+      for(e=0; e<PERF_NUM_EVENTS; e++){
+        int fd = session->fds[tid][e];
+        unsigned long long data[3];
+        if(fd < 0)
+          continue;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        // value, time enabled, time running: the value is scaled up when the counter was multiplexed
+        if(read(fd, data, sizeof(data)) == sizeof(data) && data[2] > 0){
+          session->samples[tid].values[e] = (double)data[0] * data[1] / data[2];
+          session->samples[tid].valid[e] = 1;
+        }
+        close(fd);
+      }
+    }
+  }
+}
+
+
+/*****************************************************
+ Prints the raw counters of every thread and, for the
+ whole team, IPC, arithmetic intensity (flops per byte
+ brought in from memory, LLC misses times the line size)
+ and bytes per flop, the coordinates of the kernel on a
+ roofline plot
+ ****************************************************/
+void perf_report(const perf_session *session, const char *kernel, double flops){
+  perf_sample total;
+  int t, e;
+
+  if(!session->enabled)
+    return;
+
+  memset(&total, 0, sizeof(total));
+  for(e=0; e<PERF_NUM_EVENTS; e++)
+    total.valid[e] = 1;
+
+  printf("COUNTERS OF %s (%d threads)\n", kernel, session->num_threads);
+  if(session->open_errno != 0)
+    printf("  cycle counter unavailable: %s\n", strerror(session->open_errno));
+  for(t=0; t<session->num_threads; t++){
+    printf("  thread %3d:", t);
+    for(e=0; e<PERF_NUM_EVENTS; e++){
+      if(session->samples[t].valid[e])
+        printf(" %s %.0f,", event_names[e], session->samples[t].values[e]);
+      else
+        printf(" %s n/a,", event_names[e]);
+      total.values[e] += session->samples[t].values[e];
+      total.valid[e] &= session->samples[t].valid[e];
+    }
+    printf("\n");
+  }
+
+  printf("  total: IPC ");
+  if(total.valid[PERF_CYCLES] && total.valid[PERF_INSTRUCTIONS] && total.values[PERF_CYCLES] > 0)
+    printf("%.2f", total.values[PERF_INSTRUCTIONS] / total.values[PERF_CYCLES]);
+  else
+    printf("n/a");
+  if(total.valid[PERF_LLC_MISSES] && total.values[PERF_LLC_MISSES] > 0 && flops > 0){
+    double bytes = total.values[PERF_LLC_MISSES] * PERF_LINE_BYTES;
+    printf(", memory traffic %.3f GB, arithmetic intensity %.2f flop/byte, %.4f bytes/flop",
+           bytes * 1e-9, flops / bytes, bytes / flops);
+  }else{
+    printf(", arithmetic intensity n/a");
+  }
+  if(total.valid[PERF_FP_VECTOR_OPS])
+    printf(", FP vector ops %.0f", total.values[PERF_FP_VECTOR_OPS]);
+  printf("\n");
+}
@@ -0,0 +1,38 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+// Largest OpenMP team whose threads are counted separately
+#define PERF_MAX_THREADS 256
+
+// Counted events, in the order of perf_sample.values
+#define PERF_CYCLES        0
+#define PERF_INSTRUCTIONS  1
+#define PERF_L1D_MISSES    2
+#define PERF_LLC_MISSES    3
+#define PERF_DTLB_MISSES   4
+#define PERF_FP_VECTOR_OPS 5
+#define PERF_NUM_EVENTS    6
+
+/*** TYPEDEFS AND STRUCTS***/
+// Counter values of one thread, scaled up when the kernel multiplexed them. valid is 0 for
+// events the cpu or the kernel's perf_event_paranoid setting does not let us count
+typedef struct {
+  double values[PERF_NUM_EVENTS];
+  int valid[PERF_NUM_EVENTS];
+} perf_sample;
+
+// Counters of one kernel invocation, opened by every thread of the OpenMP team
+typedef struct {
+  int enabled;
+  int num_threads;
+  int open_errno;
+  int fds[PERF_MAX_THREADS][PERF_NUM_EVENTS];
+  perf_sample samples[PERF_MAX_THREADS];
+} perf_session;
+
+int perf_requested(void);
+void perf_begin(perf_session *session);
+void perf_end(perf_session *session);
+void perf_report(const perf_session *session, const char *kernel, double flops);
+
+#endif /* PERF_COUNTERS_H_ */
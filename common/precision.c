@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <omp.h>
+#include "precision.h"
+#include "verify.h"
+
+static const char *precision_names[] = { "double", "float", "mixed", "refine" };
+
+
+/*****************************************************
+ Precision from its name, or -1 when it has none
+ ****************************************************/
+int precision_parse(const char *name){
+  int precision;
+
+  for(precision=PREC_DOUBLE; precision<=PREC_REFINE; precision++)
+    if(strcmp(name, precision_names[precision]) == 0)
+      return precision;
+  return -1;
+}
+
+/*****************************************************
+ Precision from the MATRIX_PRECISION environment
+ variable (double, float, mixed or refine)
+ ****************************************************/
+int precision_mode(void){
+  const char *value = getenv("MATRIX_PRECISION");
+  int precision;
+
+  if(value == NULL)
+    return PREC_DOUBLE;
+  precision = precision_parse(value);
+  if(precision < 0){
+    printf("unknown MATRIX_PRECISION value %s, expected double, float, mixed or refine\n", value);
+    return PREC_DOUBLE;
+  }
+  return precision;
+}
+
+const char *precision_name(int precision){
+  return precision_names[precision];
+}
+
+
+/*****************************************************
+ Relative tolerance of a length k dot product in the
+ given precision. Mixed adds the rounding of the
+ operands to float (up to eps_f per product) to the
+ double sums. Refine only rounds in its double sums,
+ as double does
+ ****************************************************/
+double precision_tol(int precision, int k){
+  double steps = (k > 4) ? k : 4;
+
+  switch(precision){
+    case PREC_FLOAT: return steps*FLT_EPSILON;
+    case PREC_MIXED: return 2*FLT_EPSILON + verify_default_tol(k);
+    default: return verify_default_tol(k);
+  }
+}
+
+
+/*****************************************************
+ Rounds a rows x cols double matrix to float into hi,
+ packed with a leading dimension of cols, and when lo
+ is given the rounding error into it, so src = hi + lo
+ to about 48 bits
+ ****************************************************/
+void precision_split(const double *src, int rows, int cols, int ld, float *hi, float *lo){
+  int i, j;
+
+# pragma omp parallel for private(j) schedule(static)
+  for(i=0; i<rows; i++)
+    for(j=0; j<cols; j++){
+      double x = src[(long)i*ld + j];
+      float head = (float)x;
+      hi[(long)i*cols + j] = head;
+      if(lo != NULL)
+        lo[(long)i*cols + j] = (float)(x - (double)head);
+    }
+}
+
+
+/*****************************************************
+ Cuts a rows x cols double matrix in REFINE_SLICES
+ float slices, packed one after the other with a
+ leading dimension of cols, scaled per row (per_row)
+ or per column. Slice p of a line whose largest value
+ is below 2^e holds multiples of 2^(e-(p+1)*b), b being
+ REFINE_SLICE_BITS, of at most b bits, and the double
+ residual goes on to the next slice, so the line is
+ the sum of its slices to 2^(e-6b)
+ ****************************************************/
+void precision_slices(const double *src, int rows, int cols, int ld, int per_row, float *parts){
+  int lines = per_row ? rows : cols, length = per_row ? cols : rows;
+  size_t elems = (size_t)rows*cols;
+  int line;
+
+# pragma omp parallel for schedule(static)
+  for(line=0; line<lines; line++){
+    long step = per_row ? 1 : ld, out_step = per_row ? 1 : cols;
+    const double *x = src + (per_row ? (long)line*ld : line);
+    long out = per_row ? (long)line*cols : line;
+    double largest = 0, unit;
+    int i, p, e;
+
+    for(i=0; i<length; i++)
+      largest = fmax(largest, fabs(x[i*step]));
+    frexp(largest, &e);
+    for(i=0; i<length; i++){
+      double residual = x[i*step];
+      unit = ldexp(1.0, e);
+      for(p=0; p<REFINE_SLICES; p++){
+        double slice;
+        unit = ldexp(unit, -REFINE_SLICE_BITS);
+        slice = rint(residual/unit)*unit;
+        parts[p*elems + out + i*out_step] = (float)slice;
+        residual -= slice;
+      }
+    }
+  }
+}
+
+
+/*****************************************************
+ Row kernel on float operands, the sums kept in acc_t.
+ Each row of C is built in a buffer of acc_t by adding
+ one scaled row of op(B) at a time, a contiguous loop
+ of the vector width of acc_t unless B is transposed
+ ****************************************************/
+#define PRECISION_ROW_KERNEL(name, acc_t)				\
+void name(const gemm_view_f *g){					\
+  int a_rs = g->trans_a ? 1 : g->lda, a_cs = g->trans_a ? g->lda : 1;	\
+  int b_rs = g->trans_b ? 1 : g->ldb, b_cs = g->trans_b ? g->ldb : 1;	\
+									\
+  _Pragma("omp parallel")						\
+  {									\
+    acc_t *acc = (acc_t *)malloc(sizeof(acc_t)*(g->n > 0 ? g->n : 1));	\
+    int i, j, p;							\
+									\
+    if(acc == NULL){							\
+      printf("can't allocate the row buffer of " #name "\n");		\
+      exit(-1);								\
+    }									\
+    _Pragma("omp for schedule(static)")					\
+    for(i=0; i<g->m; i++){						\
+      double *c_row = g->c + (long)i*g->ldc;				\
+      for(j=0; j<g->n; j++)						\
+        acc[j] = 0;							\
+      for(p=0; p<g->k; p++){						\
+        const float *b_row = g->b + (long)p*b_rs;			\
+        acc_t a_ip = g->a[(long)i*a_rs + (long)p*a_cs];			\
+        _Pragma("omp simd")						\
+        for(j=0; j<g->n; j++)						\
+          acc[j] += a_ip * (acc_t)b_row[(long)j*b_cs];			\
+      }									\
+      for(j=0; j<g->n; j++)						\
+        c_row[j] = (g->beta == 0.0) ? g->alpha*acc[j]			\
+          : g->alpha*acc[j] + g->beta*c_row[j];				\
+    }									\
+    free(acc);								\
+  }									\
+}
+
+PRECISION_ROW_KERNEL(matrix_gemm_float_ref, float)
+PRECISION_ROW_KERNEL(matrix_gemm_mixed_ref, double)
+
+
+/*****************************************************
+ Refine: double accuracy out of float products only.
+ The operands are cut in REFINE_SLICES float slices by
+ precision_slices, so that on a panel of REFINE_PANEL
+ of the inner dimension every slice product and its
+ sums are exact in float. The float kernel runs each
+ product of slices Ap*Bq with p+q < REFINE_SLICES, the
+ head A0*B0 first, one panel at a time, and adds it
+ into the double C, where the only rounding happens.
+ The terms left out are below 2^-54 of
+ k*max|A|*max|B|. That is 21 float products per panel:
+ it only beats double where fp32 runs at more than
+ ten times the fp64 rate
+ ****************************************************/
+static void matrix_gemm_refine(const gemm_view *g, void (*float_kernel)(const gemm_view_f *g)){
+  int rows_a = g->trans_a ? g->k : g->m, cols_a = g->trans_a ? g->m : g->k;
+  int rows_b = g->trans_b ? g->n : g->k, cols_b = g->trans_b ? g->k : g->n;
+  size_t size_a = (size_t)rows_a*cols_a, size_b = (size_t)rows_b*cols_b;
+  float *parts_a, *parts_b;
+  gemm_view_f f;
+  int k0, t, p;
+
+  parts_a = (float *)malloc(sizeof(float)*(REFINE_SLICES*(size_a + size_b) + 1));
+  if(parts_a == NULL){
+    printf("can't allocate the float slices of the operands\n");
+    exit(-1);
+  }
+  parts_b = parts_a + REFINE_SLICES*size_a;
+  // Slices scaled by the rows of op(A) and the columns of op(B)
+  precision_slices(g->a, rows_a, cols_a, g->lda, !g->trans_a, parts_a);
+  precision_slices(g->b, rows_b, cols_b, g->ldb, g->trans_b, parts_b);
+
+  f.m = g->m; f.n = g->n; f.k = 0;
+  f.alpha = g->alpha; f.beta = g->beta;
+  f.a = parts_a; f.lda = cols_a; f.trans_a = g->trans_a;
+  f.b = parts_b; f.ldb = cols_b; f.trans_b = g->trans_b;
+  f.c = g->c; f.ldc = g->ldc;
+  // Without an inner dimension C is only scaled by beta
+  if(g->k == 0)
+    float_kernel(&f);
+
+  for(k0=0; k0<g->k; k0+=REFINE_PANEL){
+    // Column k0 of op(A) and row k0 of op(B) in the packed slices
+    size_t off_a = g->trans_a ? (size_t)k0*cols_a : (size_t)k0;
+    size_t off_b = g->trans_b ? (size_t)k0 : (size_t)k0*cols_b;
+
+    f.k = (g->k - k0 < REFINE_PANEL) ? g->k - k0 : REFINE_PANEL;
+    for(t=0; t<REFINE_SLICES; t++)
+      for(p=0; p<=t; p++){
+        f.a = parts_a + p*size_a + off_a;
+        f.b = parts_b + (t-p)*size_b + off_b;
+        float_kernel(&f);
+        f.beta = 1.0;
+      }
+  }
+  free(parts_a);
+}
+
+
+/*****************************************************
+ C = alpha*op(A)*op(B) + beta*C in the given precision.
+ The operands are rounded to float once (O(n^2) next
+ to the O(n^3) product, in half the bytes), keeping
+ their transposition, and the back end's kernel runs
+ on them. Double runs the double kernel on the view
+ ****************************************************/
+void matrix_gemm_precision(const gemm_view *g, int precision, const precision_kernels *kernels){
+  void (*float_kernel)(const gemm_view_f *g) = kernels->float_kernel ? kernels->float_kernel : matrix_gemm_float_ref;
+  void (*mixed_kernel)(const gemm_view_f *g) = kernels->mixed_kernel ? kernels->mixed_kernel : matrix_gemm_mixed_ref;
+  int rows_a = g->trans_a ? g->k : g->m, cols_a = g->trans_a ? g->m : g->k;
+  int rows_b = g->trans_b ? g->n : g->k, cols_b = g->trans_b ? g->k : g->n;
+  size_t size_a = (size_t)rows_a*cols_a, size_b = (size_t)rows_b*cols_b;
+  float *a_hi, *b_hi;
+  gemm_view_f f;
+
+  if(precision == PREC_DOUBLE){
+    kernels->double_kernel(g);
+    return;
+  }
+  if(precision == PREC_REFINE){
+    matrix_gemm_refine(g, float_kernel);
+    return;
+  }
+
+  a_hi = (float *)malloc(sizeof(float)*(size_a + size_b + 1));
+  if(a_hi == NULL){
+    printf("can't allocate the float copies of the operands\n");
+    exit(-1);
+  }
+  b_hi = a_hi + size_a;
+  precision_split(g->a, rows_a, cols_a, g->lda, a_hi, NULL);
+  precision_split(g->b, rows_b, cols_b, g->ldb, b_hi, NULL);
+
+  f.m = g->m; f.n = g->n; f.k = g->k;
+  f.alpha = g->alpha; f.beta = g->beta;
+  f.a = a_hi; f.lda = cols_a; f.trans_a = g->trans_a;
+  f.b = b_hi; f.ldb = cols_b; f.trans_b = g->trans_b;
+  f.c = g->c; f.ldc = g->ldc;
+
+  if(precision == PREC_FLOAT)
+    float_kernel(&f);
+  else
+    mixed_kernel(&f);
+  free(a_hi);
+}
@@ -0,0 +1,51 @@
+#ifndef PRECISION_H_
+#define PRECISION_H_
+
+#include "matrix_view.h"
+
+// Precisions of a multiply, picked per call or through the MATRIX_PRECISION environment variable:
+// double throughout, float operands with float sums, float operands with double sums (mixed), and
+// refine, double accuracy out of float arithmetic: the operands are cut in float slices whose
+// products are exact in float over panels of the inner dimension, and only their sum is double
+#define PREC_DOUBLE 0
+#define PREC_FLOAT  1
+#define PREC_MIXED  2
+#define PREC_REFINE 3
+
+// Slices refine cuts the operands in, of REFINE_SLICE_BITS bits each, and the length of the
+// panels of the inner dimension a float product of two slices is exact over: 2*9 bits for the
+// products and 6 for the sums of 64 of them fill the 24 bits of a float
+#define REFINE_SLICES     6
+#define REFINE_SLICE_BITS 9
+#define REFINE_PANEL      64
+
+/*** TYPEDEFS AND STRUCTS***/
+// gemm_view with float operands. The result stays double whatever the precision, so every mode
+// writes into the caller's matrix
+typedef struct {
+  int m, n, k;
+  double alpha, beta;
+  const float *a; int lda; int trans_a;
+  const float *b; int ldb; int trans_b;
+  double *c; int ldc;
+} gemm_view_f;
+
+// Kernels of one back end. float_kernel sums in float and mixed_kernel in double, NULL picks the
+// portable row kernels below
+typedef struct {
+  void (*double_kernel)(const gemm_view *g);
+  void (*float_kernel)(const gemm_view_f *g);
+  void (*mixed_kernel)(const gemm_view_f *g);
+} precision_kernels;
+
+int precision_mode(void);
+int precision_parse(const char *name);
+const char *precision_name(int precision);
+double precision_tol(int precision, int k);
+void precision_split(const double *src, int rows, int cols, int ld, float *hi, float *lo);
+void precision_slices(const double *src, int rows, int cols, int ld, int per_row, float *parts);
+void matrix_gemm_float_ref(const gemm_view_f *g);
+void matrix_gemm_mixed_ref(const gemm_view_f *g);
+void matrix_gemm_precision(const gemm_view *g, int precision, const precision_kernels *kernels);
+
+#endif /* PRECISION_H_ */
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
+#include <omp.h>
+#include "verify.h"
+#include "matrix_rng.h"
+
+
+/*****************************************************
+ Verification method of a size x size run, from the
+ MATRIX_VERIFY environment variable (auto, full,
+ freivalds or none). In auto mode the runs up to
+ VERIFY_FULL_MAX_SIZE are compared element by element
+ against the sequential multiply, larger ones get the
+ O(n^2) Freivalds check instead of a second O(n^3) one
+ ****************************************************/
+int verify_method(int size){
+  const char *value = getenv("MATRIX_VERIFY");
+
+  if(value != NULL){
+    if(strcmp(value, "full") == 0) return VERIFY_FULL;
+    if(strcmp(value, "freivalds") == 0) return VERIFY_FREIVALDS;
+    if(strcmp(value, "none") == 0) return VERIFY_NONE;
+    if(strcmp(value, "auto") != 0)
+      printf("unknown MATRIX_VERIFY value %s, using auto\n", value);
+  }
+  return (size <= VERIFY_FULL_MAX_SIZE) ? VERIFY_FULL : VERIFY_FREIVALDS;
+}
+
+
+/*****************************************************
+ Relative tolerance of a dot product of length k, whose
+ rounding error grows at most as k*eps/2 (times the
+ magnitude of the terms)
+ ****************************************************/
+double verify_default_tol(int k){
+  return (k > 4 ? k : 4) * DBL_EPSILON;
+}
+
+
+/*****************************************************
+ Maps a double to an integer whose order follows the
+ order of the doubles, so the difference of two mapped
+ values counts the doubles between them
+ ****************************************************/
+static int64_t ordered_bits(double x){
+  int64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return (bits < 0) ? INT64_MIN - bits : bits;
+}
+
+static long ulp_distance(double x, double y){
+  int64_t a = ordered_bits(x), b = ordered_bits(y);
+  // Both are in [-2^63, 2^63), so the difference is computed unsigned and clamped
+  uint64_t d = (a > b) ? (uint64_t)a - (uint64_t)b : (uint64_t)b - (uint64_t)a;
+  return (d > (uint64_t)LONG_MAX) ? LONG_MAX : (long)d;
+}
+
+static int histogram_bucket(double rel){
+  int bucket;
+  if(!(rel >= 1e-16))
+    return (rel != rel) ? VERIFY_BUCKETS-1 : 0;
+  bucket = (int)floor(log10(rel)) + 17;
+  return (bucket >= VERIFY_BUCKETS) ? VERIFY_BUCKETS-1 : bucket;
+}
+
+
+static void report_init(verify_report *report, const char *method, double rel_tol, long ulp_tol){
+  memset(report, 0, sizeof(*report));
+  report->method = method;
+  report->rel_tol = rel_tol;
+  report->ulp_tol = ulp_tol;
+  report->worst_row = report->worst_col = -1;
+}
+
+/*****************************************************
+ Adds one checked value to a (thread's) report
+ ****************************************************/
+static void report_add(verify_report *report, int row, int col, double expected,
+		       double actual, double scale){
+  double diff = fabs(actual - expected);
+  double rel = diff / ((scale > DBL_MIN) ? scale : DBL_MIN);
+  long ulps = ulp_distance(expected, actual);
+
+  // NaNs compare false everywhere, they fail and become the worst element
+  if(rel != rel)
+    rel = INFINITY;
+  report->checked++;
+  report->histogram[histogram_bucket(rel)]++;
+  if(!(rel <= report->rel_tol) && ulps > report->ulp_tol)
+    report->failures++;
+  if(ulps > report->max_ulp)
+    report->max_ulp = ulps;
+  if(rel > report->max_rel || report->worst_row < 0){
+    report->max_rel = rel;
+    report->worst_row = row;
+    report->worst_col = col;
+    report->worst_expected = expected;
+    report->worst_actual = actual;
+  }
+}
+
+static void report_merge(verify_report *into, const verify_report *from){
+  int b;
+
+  into->checked += from->checked;
+  into->failures += from->failures;
+  for(b=0; b<VERIFY_BUCKETS; b++)
+    into->histogram[b] += from->histogram[b];
+  if(from->max_ulp > into->max_ulp)
+    into->max_ulp = from->max_ulp;
+  if(from->worst_row >= 0 && (from->max_rel > into->max_rel || into->worst_row < 0)){
+    into->max_rel = from->max_rel;
+    into->worst_row = from->worst_row;
+    into->worst_col = from->worst_col;
+    into->worst_expected = from->worst_expected;
+    into->worst_actual = from->worst_actual;
+  }
+}
+
+
+/*****************************************************
+ Compares every element of an m x n result with the
+ expected one, rows split over the OpenMP threads.
+ lde and lda are the row strides of both matrices.
+ Returns 1 when no element is outside the tolerance
+ ****************************************************/
+int verify_compare(const double *expected, int lde, const double *actual, int lda,
+		   int m, int n, double rel_tol, long ulp_tol, verify_report *report){
+  report_init(report, "full", rel_tol, ulp_tol);
+
+# pragma omp parallel shared(report)
+  {
+    verify_report local;
+    int i, j;
+
+    report_init(&local, "full", rel_tol, ulp_tol);
+#   pragma omp for schedule(static)
+    for(i=0; i<m; i++)
+      for(j=0; j<n; j++)
+        report_add(&local, i, j, expected[(size_t)i*lde + j], actual[(size_t)i*lda + j],
+                   fabs(expected[(size_t)i*lde + j]));
+
+#   pragma omp critical
+    report_merge(report, &local);
+  }
+  return report->failures == 0;
+}
+
+
+/*****************************************************
+ Randomized check of C = alpha*op(A)*op(B), g being the
+ view the result was computed on with beta zero. Each
+ round draws a vector x of random signs and compares
+ C*x with alpha*op(A)*(op(B)*x), three matrix-vector
+ products instead of a second multiply. An element of
+ C that is off changes its entry of C*x whatever the
+ signs, so a wrong result passes a round only through
+ errors cancelling each other, with probability at
+ most 1/2. The entries are compared relative to
+ |alpha|*|op(A)|*(|op(B)|*|x|), with rel_tol widened
+ by the rounding of the three products
+ ****************************************************/
+int verify_freivalds(const gemm_view *g, int rounds, unsigned int seed,
+		     double rel_tol, verify_report *report){
+  int a_rs, a_cs, b_rs, b_cs;
+  double *x = (double *)malloc(sizeof(double)*g->n);
+  double *y = (double *)malloc(sizeof(double)*g->k);
+  double *y_abs = (double *)malloc(sizeof(double)*g->k);
+  double tol = rel_tol + (2.0*g->k + g->n) * DBL_EPSILON;
+  int r;
+
+  report_init(report, "freivalds", tol, VERIFY_ULP_TOL);
+  if(g->beta != 0.0){
+    printf("the Freivalds check needs the product itself, beta must be zero\n");
+    free(x); free(y); free(y_abs);
+    return 0;
+  }
+  gemm_view_strides(g, &a_rs, &a_cs, &b_rs, &b_cs);
+
+  for(r=0; r<rounds; r++){
+    uint64_t key = matrix_rng_key(seed, r);
+    int j;
+
+    // Random signs from the counter-based generator, one stream per round
+    for(j=0; j<g->n; j++)
+      x[j] = (rng_counter(key, j) >> 63) ? 1.0 : -1.0;
+
+#   pragma omp parallel shared(report)
+    {
+      verify_report local;
+      int i, p, q;
+
+      // y = op(B)*x and |op(B)|*|x|, the scale of the rounding errors
+#     pragma omp for schedule(static)
+      for(p=0; p<g->k; p++){
+        double sum = 0, sum_abs = 0;
+        for(q=0; q<g->n; q++){
+          double b = g->b[(size_t)p*b_rs + (size_t)q*b_cs];
+          sum += b*x[q];
+          sum_abs += fabs(b);
+        }
+        y[p] = sum;
+        y_abs[p] = sum_abs;
+      }
+
+      // Entry i of alpha*op(A)*y against entry i of C*x
+      report_init(&local, "freivalds", tol, VERIFY_ULP_TOL);
+#     pragma omp for schedule(static)
+      for(i=0; i<g->m; i++){
+        double expected = 0, scale = 0, actual = 0;
+        for(p=0; p<g->k; p++){
+          double a = g->a[(size_t)i*a_rs + (size_t)p*a_cs];
+          expected += a*y[p];
+          scale += fabs(a)*y_abs[p];
+        }
+        for(q=0; q<g->n; q++)
+          actual += g->c[(size_t)i*g->ldc + q]*x[q];
+        report_add(&local, i, -1, g->alpha*expected, actual, fabs(g->alpha)*scale);
+      }
+
+#     pragma omp critical
+      report_merge(report, &local);
+    }
+  }
+
+  free(x);
+  free(y);
+  free(y_abs);
+  return report->failures == 0;
+}
+
+
+/*****************************************************
+ Prints the outcome of a check: how many values failed,
+ the worst one and how the relative errors spread
+ ****************************************************/
+void verify_print(const verify_report *report, const char *kernel){
+  int b;
+
+  printf("CHECK OF %s (%s): %ld of %ld values outside tolerance (rel %.1e or %ld ulp), max %ld ulp\n",
+         kernel, report->method, report->failures, report->checked, report->rel_tol,
+         report->ulp_tol, report->max_ulp);
+  if(report->worst_row >= 0){
+    if(report->worst_col >= 0)
+      printf("  worst element (%d,%d): expected %.17g, got %.17g, relative error %.3e\n",
+             report->worst_row, report->worst_col, report->worst_expected,
+             report->worst_actual, report->max_rel);
+    else
+      printf("  worst entry %d of C*x: expected %.17g, got %.17g, relative error %.3e\n",
+             report->worst_row, report->worst_expected, report->worst_actual, report->max_rel);
+  }
+
+  printf("  relative errors:");
+  for(b=0; b<VERIFY_BUCKETS; b++){
+    if(report->histogram[b] == 0)
+      continue;
+    if(b == 0)
+      printf(" <1e-16: %ld", report->histogram[b]);
+    else if(b == VERIFY_BUCKETS-1)
+      printf(" >=1e%d: %ld", b-17, report->histogram[b]);
+    else
+      printf(" 1e%d: %ld", b-17, report->histogram[b]);
+  }
+  printf("\n");
+}
+
+
+/*****************************************************
+ Check of the drivers' dense size x size C = A*B with
+ the given method, reference being the sequential
+ result (only read by the full comparison). Prints the
+ report and returns 1 when the result is correct
+ ****************************************************/
+int verify_square(int method, int size, const double *a, const double *b,
+		  const double *reference, const double *c, const char *kernel){
+  return verify_square_tol(method, size, a, b, reference, c, verify_default_tol(size), kernel);
+}
+
+/*****************************************************
+ verify_square with the relative tolerance given, for
+ results computed in less than double precision
+ ****************************************************/
+int verify_square_tol(int method, int size, const double *a, const double *b,
+		      const double *reference, const double *c, double rel_tol,
+		      const char *kernel){
+  verify_report report;
+  gemm_view g;
+  int ok;
+
+  if(method == VERIFY_NONE)
+    return 1;
+  if(method == VERIFY_FULL){
+    ok = verify_compare(reference, size, c, size, size, size,
+                        rel_tol, VERIFY_ULP_TOL, &report);
+  }else{
+    gemm_view_square(&g, size, a, b, (double *)c);
+    ok = verify_freivalds(&g, 2, 12345u, rel_tol, &report);
+  }
+  verify_print(&report, kernel);
+  return ok;
+}
+
+
+/*****************************************************
+ Checks a batch of count size x size results, stored
+ one after the other, against the reference batch
+ ****************************************************/
+int verify_batch(const double *reference, const double *c, int size, int count,
+		 const char *kernel){
+  verify_report report;
+  int ok = verify_compare(reference, size, c, size, count*size, size,
+                          verify_default_tol(size), VERIFY_ULP_TOL, &report);
+
+  verify_print(&report, kernel);
+  return ok;
+}
@@ -0,0 +1,53 @@
+#ifndef VERIFY_H_
+#define VERIFY_H_
+
+#include "matrix_view.h"
+
+// Relative errors are binned by decade, from below 1e-16 up to 1e-16*10^(VERIFY_BUCKETS-2) and above
+#define VERIFY_BUCKETS 12
+
+// Verification methods, picked through the MATRIX_VERIFY environment variable
+#define VERIFY_AUTO      0
+#define VERIFY_FULL      1
+#define VERIFY_FREIVALDS 2
+#define VERIFY_NONE      3
+
+// Largest size checked against the sequential multiply in auto mode, larger runs use Freivalds
+#define VERIFY_FULL_MAX_SIZE 2048
+
+// Units in the last place an element may be off by, whatever its relative error
+#define VERIFY_ULP_TOL 4
+
+/*** TYPEDEFS AND STRUCTS***/
+// Outcome of a check. An element passes when its relative error is within rel_tol or when it is
+// within ulp_tol units in the last place of the expected value. For Freivalds the "elements" are
+// the entries of C*x, and the relative error is taken against |alpha|*|op(A)|*(|op(B)|*|x|)
+typedef struct {
+  const char *method;
+  long checked;
+  long failures;
+  double rel_tol;
+  long ulp_tol;
+  double max_rel;
+  long max_ulp;
+  int worst_row, worst_col;
+  double worst_expected, worst_actual;
+  long histogram[VERIFY_BUCKETS];
+} verify_report;
+
+int verify_method(int size);
+double verify_default_tol(int k);
+int verify_compare(const double *expected, int lde, const double *actual, int lda,
+		   int m, int n, double rel_tol, long ulp_tol, verify_report *report);
+int verify_freivalds(const gemm_view *g, int rounds, unsigned int seed,
+		     double rel_tol, verify_report *report);
+void verify_print(const verify_report *report, const char *kernel);
+int verify_square(int method, int size, const double *a, const double *b,
+		  const double *reference, const double *c, const char *kernel);
+int verify_square_tol(int method, int size, const double *a, const double *b,
+		      const double *reference, const double *c, double rel_tol,
+		      const char *kernel);
+int verify_batch(const double *reference, const double *c, int size, int count,
+		 const char *kernel);
+
+#endif /* VERIFY_H_ */
@@ -0,0 +1,34 @@
+#!/bin/sh
+
+# Sweeps every back end over the same sizes and writes one CSV, e.g.
+#   ./run_bench.sh 256,512,1024 1,2,4,8 32,64,128 bench.csv
+sizes=${1:-256,512}
+threads=${2:-1}
+local_sizes=${3:-64}
+output=${4:-bench.csv}
+trials=${TRIALS:-5}
+root=$(pwd)
+
+case "$output" in
+  /*) ;;
+  *) output="$root/$output" ;;
+esac
+
+echo "compile applications"
+
+(cd OpenMP && gcc -g -O3 -fopenmp matrix_omp.c matrix_blocked.c matrix_numa.c matrix_strassen.c matrix_recursive.c matrix_batched.c matrix_ooc.c ../common/matrix_view.c ../common/bench.c ../common/perf_counters.c ../common/verify.c ../common/matrix_rng.c ../common/arena.c ../common/precision.c ../common/matrix_io.c -o matrix_omp.exe -lm)
+(cd "Open MP & SSE" && gcc -g -O3 -msse -fopenmp matrix_sse.c ../common/matrix_view.c ../common/bench.c ../common/perf_counters.c ../common/verify.c ../common/matrix_rng.c ../common/arena.c ../common/precision.c ../common/matrix_io.c -o matrix_sse.exe -lm)
+# The OpenCL back end is optional, hosts without an OpenCL SDK skip it
+(cd OpenCL && make -s > /dev/null 2>&1) || echo "OpenCL back end not built, skipping it"
+
+echo "executing the benchmarks"
+
+(cd OpenMP && ./matrix_omp.exe bench --sizes $sizes --threads $threads --trials $trials --output "$output")
+(cd "Open MP & SSE" && ./matrix_sse.exe bench --sizes $sizes --threads $threads --trials $trials --output "$output" --append)
+if [ -x OpenCL/vecMatMul ]; then
+  (cd OpenCL && ./vecMatMul bench --sizes $sizes --local-sizes $local_sizes --trials $trials --output "$output" --append)
+fi
+
+echo "results written to $output"
+
+rm -fr *~ OpenMP/matrix_omp.exe "Open MP & SSE/matrix_sse.exe"